@@ -2,113 +2,211 @@
 //                                                      Include Header Files                                                               //
 //-----------------------------------------------------------------------------------------------------------------------------------------//
 #include "xvtLib.h"
-#include "P1.h"
-#include "P6.h"
+#include "BatchInspector.h"
+#include "InspectionServer.h"
+#include "Recipe.h"
+#include <csignal>
+#include <cstdio>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+//-----------------------------------------------------------------------------------------------------------------------------------------//
+//                                                             Stop Signal                                                                 //
+//-----------------------------------------------------------------------------------------------------------------------------------------//
+// Set by SIGINT/SIGTERM: the streaming mode finishes the frames already read, writes their results and exits.
+static std::atomic<bool> g_stop{ false };
+
+static void onStopSignal(int)
+{
+    g_stop.store(true);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------------------------//
+//                                                            Command Line                                                                 //
+//-----------------------------------------------------------------------------------------------------------------------------------------//
+static void printUsage(const char* program)
+{
+    std::cout << "Usage: " << program << " [recipe] [options]\n"
+              << "  recipe               Inspection recipe (default: recipe/Quizz2.rcp)\n"
+              << "  -i, --images DIR     Directory of the input images (overrides image_dir)\n"
+              << "  -o, --results DIR    Directory of the result images (overrides result_dir)\n"
+              << "  -j, --threads N      Number of worker threads (overrides threads)\n"
+              << "  --set KEY=VALUE      Override any global recipe key\n"
+              << "  --watch DIR          Run continuously on the images written to DIR\n"
+              << "  --stdin              Run continuously on the frame records read from stdin\n"
+              << "  --shm NAME           Run continuously on the frames pushed into the shared memory ring NAME\n"
+              << "  --serve PATH         Serve inspection requests on the Unix domain socket PATH until stopped\n"
+              << "  --teach-outline      Print the cell outline of each point's image, to use as its reference_outline\n"
+              << "  -h, --help           Show this help\n";
+}
 
 //-----------------------------------------------------------------------------------------------------------------------------------------//
 //                                                              Main Function                                                              //
 //-----------------------------------------------------------------------------------------------------------------------------------------//
-int main() {
-
-    //================================================================ P5 ==================================================================//
-    cv::Mat P5 = loadImage("D:/Quizz2/Image/P5.tif");
-    cv::Rect ROI_P5(1000, 500, 1000, 1500);
-    cv::Mat P5Result = P6ImageProcessing(P5, ROI_P5); // Same processing as P6
-
-    //================================================================ P6 ==================================================================//
-    cv::Mat P6 = loadImage("D:/Quizz2/Image/P6.tif");
-    cv::Rect ROI_P6(1000, 500, 1000, 1500);
-    cv::Mat P6Result = P6ImageProcessing(P6, ROI_P6);
-
-    //================================================================ P7 ==================================================================//
-    cv::Mat P7 = loadImage("D:/Quizz2/Image/P7.tif");
-    cv::Rect ROI_P7(1000, 500, 1000, 1500);
-    // Mirror image P7 to process same with P6
-    cv::Mat flippedP7;
-    cv::flip(P7, flippedP7, 1);
-
-    // Mirror ROI
-    cv::Rect flippedROI7(
-        P7.cols - (ROI_P7.x + ROI_P7.width),
-        ROI_P7.y,
-        ROI_P7.width,
-        ROI_P7.height
-    );
-    cv::Mat P7Result = P6ImageProcessing(flippedP7, flippedROI7);
-    cv::flip(P7Result, P7Result, 1); //flip back the result
-
-    //================================================================ P8 ===============================================================//
-    cv::Mat P8 = loadImage("D:/Quizz2/Image/P8.tif");
-    cv::Rect ROI_P8(1000, 500, 1000, 1500);
-    // Mirror image P8 to process same with P6
-    cv::Mat flippedP8;
-    cv::flip(P8, flippedP8, 1);
-
-    // Mirror ROI
-    cv::Rect flippedROI8(
-        P8.cols - (ROI_P8.x + ROI_P8.width),
-        ROI_P8.y,
-        ROI_P8.width,
-        ROI_P8.height
-    );
-    cv::Mat P8Result = P6ImageProcessing(flippedP8, flippedROI8);
-    cv::flip(P8Result, P8Result, 1); //flip back the result
-
-    //================================================================ P1 ===============================================================//
-    cv::Mat P1 = loadImage("D:/Quizz2/Image/P1.tif");
-    cv::Rect ROI_P1(1600, 500, 300, 1500);
-    cv::Mat P1Result = P1ImageProcessing(P1, ROI_P1);
-
-    ////================================================================ P2 ===============================================================//
-    cv::Mat P2 = loadImage("D:/Quizz2/Image/P2.tif");
-    cv::Rect ROI_P2(500, 500, 1000, 1500);
-    cv::Mat P2Result = P1ImageProcessing(P2, ROI_P2); // Same processing as P1
-
-    //================================================================ P3 ===============================================================//
-    cv::Mat P3 = loadImage("D:/Quizz2/Image/P3.tif");
-    cv::Rect ROI_P3(2000, 500, 1000, 1500);
-
-    // Mirror image P3 to process same with P1
-    cv::Mat flippedP3;
-    cv::flip(P3, flippedP3, 0);
-    // Mirror ROI
-    cv::Rect flippedROI3(
-        ROI_P3.x,
-        P3.rows - (ROI_P3.y + ROI_P3.height),
-        ROI_P3.width,
-        ROI_P3.height
-    );
-    cv::Mat P3Result = P1ImageProcessing(flippedP3, flippedROI3);
-    cv::flip(P3Result, P3Result, 0); //flip back the result
-
-    //================================================================ P4 ===============================================================//
-    cv::Mat P4 = loadImage("D:/Quizz2/Image/P4.tif");
-    cv::Rect ROI_P4(500, 600, 300, 1300);
-
-    // Mirror image P4 to process same with P1
-    cv::Mat flippedP4;
-    cv::flip(P4, flippedP4, 0);
-    // Mirror ROI
-    cv::Rect flippedROI4(
-        ROI_P4.x,
-        P4.rows - (ROI_P4.y + ROI_P4.height),
-        ROI_P4.width,
-        ROI_P4.height
-    );
-    cv::Mat P4Result = P1ImageProcessing(flippedP4, flippedROI4);
-    cv::flip(P4Result, P4Result, 0); //flip back the result
-
-    //================================================================ Save Results =====================================================//
-    cv::imwrite("D:/Quizz2/Result/P1_Result.png", P1Result);
-    cv::imwrite("D:/Quizz2/Result/P2_Result.png", P2Result);
-    cv::imwrite("D:/Quizz2/Result/P3_Result.png", P3Result);
-    cv::imwrite("D:/Quizz2/Result/P4_Result.png", P4Result);
-    cv::imwrite("D:/Quizz2/Result/P5_Result.png", P5Result);
-    cv::imwrite("D:/Quizz2/Result/P6_Result.png", P6Result);
-    cv::imwrite("D:/Quizz2/Result/P7_Result.png", P7Result);
-    cv::imwrite("D:/Quizz2/Result/P8_Result.png", P8Result);
-
-    return 0;
+int main(int argc, char** argv) {
+
+    //================================================================ Parse Arguments =====================================================//
+    std::string recipePath = "recipe/Quizz2.rcp";
+    std::vector<std::pair<std::string, std::string>> overrides;
+    std::string watchDir, shmName, servePath;
+    bool readStdin = false;
+    bool teachOutline = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else if (arg == "-i" || arg == "--images")  overrides.emplace_back("image_dir", value());
+        else if (arg == "-o" || arg == "--results") overrides.emplace_back("result_dir", value());
+        else if (arg == "-j" || arg == "--threads") overrides.emplace_back("threads", value());
+        else if (arg == "--watch") watchDir = value();
+        else if (arg == "--shm")   shmName = value();
+        else if (arg == "--serve") servePath = value();
+        else if (arg == "--stdin") readStdin = true;
+        else if (arg == "--teach-outline") teachOutline = true;
+        else if (arg == "--set") {
+            std::string pair = value();
+            size_t eq = pair.find('=');
+            if (eq == std::string::npos) {
+                std::cerr << "--set expects KEY=VALUE" << std::endl;
+                return 2;
+            }
+            overrides.emplace_back(pair.substr(0, eq), pair.substr(eq + 1));
+        }
+        else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return 2;
+        }
+        else recipePath = arg;
+    }
+
+    //================================================================ Load Recipe =========================================================//
+    // The recipe describes every inspection point (image, ROI, algorithm, orientation, thresholds) of the cell model.
+    Recipe recipe;
+    try {
+        recipe = loadRecipe(recipePath, overrides);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+
+    //================================================================ Teach Reference Outlines ===========================================//
+    // Commissioning: the outline of the cell on the reference images, for the ROIs taught on them to follow the cell
+    if (teachOutline) {
+        int missing = 0;
+        for (const auto& point : recipe.points) {
+            cv::Mat frame = loadImage(point.imagePath);
+            cv::Rect outline;
+            if (!frame.empty() && locateCellOutline(frame, point.outline, outline)) {
+                std::cout << "[" << point.name << "] reference_outline = " << outline.x << ", " << outline.y << ", "
+                          << outline.width << ", " << outline.height << std::endl;
+            }
+            else {
+                std::cerr << "No cell outline found in " << point.imagePath << std::endl;
+                ++missing;
+            }
+        }
+        return missing == 0 ? 0 : 1;
+    }
+
+    //================================================================ Inspection Server ===================================================//
+    // Daemon mode: clients send raw ROIs over the socket and get the measurements back, with nothing written to disk
+    if (!servePath.empty()) {
+        try {
+            InspectionServer server(recipe.points, servePath, recipe.threads);
+            std::signal(SIGINT, onStopSignal);
+            std::signal(SIGTERM, onStopSignal);
+            std::cout << "Serving " << recipe.points.size() << " inspection points on " << servePath << std::endl;
+            server.run(g_stop);
+
+            const InspectionServerStats stats = server.stats();
+            std::cout << stats.requests << " requests from " << stats.connections << " connections, " << stats.failed
+                      << " failed, deepest pipeline " << stats.maxPipeline << std::endl;
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 2;
+        }
+        return 0;
+    }
+
+    //================================================================ Process and Save Results ============================================//
+    // All the points run concurrently: the cell takes about as long as its slowest point.
+    BatchInspector inspector(recipe.threads, recipe.maxInFlight, recipe.output);
+    if (!recipe.measurementLog.empty() && !inspector.setMeasurementLog(recipe.measurementLog)) {
+        std::cerr << "Cannot open measurement log " << recipe.measurementLog << std::endl;
+    }
+
+    // Streaming mode: one frame source instead of the images of the recipe, until the source ends or a stop signal
+    std::unique_ptr<FrameSource> source;
+    try {
+        if (!watchDir.empty())
+            source = std::make_unique<DirectoryFrameSource>(watchDir);
+        else if (!shmName.empty())
+            source = std::make_unique<SharedMemoryFrameSource>(shmName);
+        else if (readStdin) {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+            source = std::make_unique<StreamFrameSource>(std::cin);
+#else
+            // Unbuffered, so no record sits in the stdio buffer while the source polls the descriptor for the stop signal
+            std::setvbuf(stdin, nullptr, _IONBF, 0);
+            source = std::make_unique<StreamFrameSource>(std::cin, "stdin", fileno(stdin));
+#endif
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+
+    if (source) {
+        std::signal(SIGINT, onStopSignal);
+        std::signal(SIGTERM, onStopSignal);
+        unsigned long long frames = inspector.run(*source, recipe.points, g_stop);
+        std::cout << frames << " frames inspected, " << inspector.ngCount() << " NG, " << inspector.failedCount() << " failed" << std::endl;
+    }
+    else {
+        inspector.submitCell(recipe.points);
+        inspector.wait();
+    }
+
+    // Back-pressure of the result images: time the inspection waited for the encoder, and results dropped
+    const ResultWriterStats output = inspector.resultStats();
+    if (output.blocked > 0 || output.dropped > 0) {
+        std::cout << "Result writer: " << output.written << " written, " << output.dropped << " dropped, "
+                  << output.blocked << " waits (" << output.blockedMs << " ms), max queue " << output.maxQueueDepth
+                  << ", encode " << output.encodeMs << " ms, write " << output.writeMs << " ms" << std::endl;
+    }
+
+    // Tracked edge search: cells measured around the edges of the previous ones, and the fallbacks to the full search
+    const EdgeTrackerStats tracking = inspector.trackerStats();
+    if (tracking.tracked > 0 || tracking.fallbacks > 0) {
+        std::cout << "Edge tracking: " << tracking.tracked << " tracked, " << tracking.fallbacks << " fallbacks, "
+                  << tracking.searched << " full searches, " << tracking.lost << " tracks lost" << std::endl;
+    }
+
+    if (!recipe.profileOutput.empty()) {
+        if (!Profiler::enabled)
+            std::cerr << "profile_output is set but the build has no XVT_ENABLE_PROFILING: the report is empty" << std::endl;
+        if (!Profiler::instance().dump(recipe.profileOutput))
+            std::cerr << "Cannot write profile " << recipe.profileOutput << std::endl;
+    }
+
+    return inspector.failedCount() == 0 ? 0 : 1;
 }
 
 //-----------------------------------------------------------------------------------------------------------------------------------------//
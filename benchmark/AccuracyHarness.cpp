@@ -0,0 +1,371 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                               AccuracyHarness.cpp                                                                //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+// Runs every variant of the P1 and P6 pipelines (denoise backend x bit depth x pyramid, strips, tracked search) over random
+// synthetic phantoms with a known gap, in parallel, and reports the gap error of each variant next to its latency and
+// throughput. A speed change to the kernels is accepted with the accuracy it costs, measured here. The torn columns show
+// what a torn separator does to the gap, e.g. with --variants P1.nlm.u16 for the full-ROI profile against the strips; the
+// tracked variants also report their confidence against the full search's on the same phantoms.
+//
+// Usage: AccuracyHarness [--count N] [--threads N] [--seed N] [--noise MAX] [--tolerance PX] [--variants LIST]
+//                        [--csv FILE] [--save DIR] [--max-fail PCT]
+//
+// --variants keeps the variants whose name contains one of the comma-separated words, e.g. "P1.nlm,P6.gaussian.u16".
+// --max-fail makes the exit code 1 if a variant misses the gap or is off by more than the tolerance on more than PCT
+// percent of the phantoms, for use as a regression gate.
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "BatchInspector.h"
+#include "P1.h"
+#include "P6.h"
+#include "Phantom.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+struct HarnessConfig {
+    int count = 1000;               // phantoms per orientation
+    unsigned int threads = 0;       // 0 for all hardware threads
+    unsigned int seed = 1;
+    double maxNoise = 1200.0;       // largest read noise drawn, in 16-bit counts
+    double tolerance = 1.0;         // gap error counted as a failure, in pixels
+    double maxFailPercent = -1.0;   // regression gate, negative to disable
+    std::vector<std::string> filters;
+    std::string csvPath;
+    std::string saveDir;
+};
+
+struct Variant {
+    std::string name;               // e.g. "P1.nlm.u16.pyr2"
+    bool columns = false;           // P6 variants run on the transposed phantoms
+    bool tracked = false;           // searched around the edges of a full search of the same phantom
+    InspectionPoint point;
+};
+
+struct Sample {
+    bool measured = false;          // false if the kernel threw
+    GapMeasurement measurement;
+    double ms = 0.0;
+    double fullConfidence = 0.0;    // tracked variants: the confidence of the full search that gave the track
+};
+
+struct PhantomInfo {
+    PhantomSpec spec;
+    double gap = 0.0;
+};
+
+std::vector<std::string> split(const std::string& text, char separator)
+{
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator))
+        if (!part.empty()) parts.push_back(part);
+    return parts;
+}
+
+bool parseArguments(int argc, char** argv, HarnessConfig& config)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--count") config.count = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--threads") config.threads = static_cast<unsigned int>(std::max(0, std::atoi(value.c_str())));
+        else if (arg == "--seed") config.seed = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+        else if (arg == "--noise") config.maxNoise = std::max(1.0, std::atof(value.c_str()));
+        else if (arg == "--tolerance") config.tolerance = std::max(0.0, std::atof(value.c_str()));
+        else if (arg == "--max-fail") config.maxFailPercent = std::atof(value.c_str());
+        else if (arg == "--variants") config.filters = split(value, ',');
+        else if (arg == "--csv") config.csvPath = value;
+        else if (arg == "--save") config.saveDir = value;
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/// <summary>
+/// Every combination of kernel, denoise backend, bit depth and pyramid mode that the recipe can select, plus the default
+/// of each kernel with strips and with the tracked search, filtered by name. The frames go through measureFrame with the
+/// ROI-first conversion, like the production points.
+/// </summary>
+std::vector<Variant> makeVariants(const std::vector<std::string>& filters)
+{
+    static const std::pair<DenoiseMethod, const char*> METHODS[] = {
+        { DenoiseMethod::NLM, "nlm" }, { DenoiseMethod::GAUSSIAN, "gaussian" }, { DenoiseMethod::BOX, "box" },
+        { DenoiseMethod::MEDIAN, "median" }, { DenoiseMethod::PROFILE, "profile" } };
+
+    std::vector<Variant> variants;
+    for (bool columns : { false, true }) {
+        for (const auto& [method, methodName] : METHODS) {
+            for (int depth : { CV_8U, CV_16U }) {
+                for (int levels : { 0, 2 }) {
+                    Variant variant;
+                    variant.name = std::string(columns ? "P6." : "P1.") + methodName + (depth == CV_16U ? ".u16" : ".u8")
+                                 + (levels > 0 ? ".pyr" + std::to_string(levels) : "");
+                    variant.columns = columns;
+                    InspectionPoint& point = variant.point;
+                    point.name = variant.name;
+                    point.kernel = columns ? P6Measure : P1Measure;
+                    point.params = columns ? P6_DEFAULT_PARAMS : P1_DEFAULT_PARAMS;
+                    point.params.denoise = method;
+                    point.params.pyramidLevels = levels;
+                    point.margin = 32;
+                    point.depth = depth;
+                    point.annotate = AnnotationPolicy::NEVER;
+
+                    bool selected = filters.empty();
+                    for (const auto& filter : filters)
+                        selected = selected || variant.name.find(filter) != std::string::npos;
+                    if (selected)
+                        variants.push_back(std::move(variant));
+                }
+            }
+        }
+
+        // With strips the reported gap is the median of the intact strips, so a torn separator should not bias it.
+        // The tracked search keeps every confidence, even a low one, to compare it with the full search's.
+        for (bool tracked : { false, true }) {
+            Variant variant;
+            variant.name = std::string(columns ? "P6." : "P1.") + (tracked ? "nlm.u16.tracked" : "nlm.u16.strips");
+            variant.columns = columns;
+            variant.tracked = tracked;
+            InspectionPoint& point = variant.point;
+            point.name = variant.name;
+            point.kernel = columns ? P6Measure : P1Measure;
+            point.params = columns ? P6_DEFAULT_PARAMS : P1_DEFAULT_PARAMS;
+            if (tracked) {
+                point.params.trackWindow = 8;
+                point.params.trackMinConfidence = 0.0;
+            }
+            else {
+                point.params.stripWidth = 32;
+            }
+            point.margin = 32;
+            point.depth = CV_16U;
+            point.annotate = AnnotationPolicy::NEVER;
+
+            bool selected = filters.empty();
+            for (const auto& filter : filters)
+                selected = selected || variant.name.find(filter) != std::string::npos;
+            if (selected)
+                variants.push_back(std::move(variant));
+        }
+    }
+    return variants;
+}
+
+/// <summary>
+/// Measure one phantom with every variant of its orientation. Runs on a worker; each sample slot is written by one task only.
+/// </summary>
+void runPhantom(const HarnessConfig& config, int index, bool columns, const std::vector<Variant>& variants,
+                std::vector<std::vector<Sample>>& samples, std::vector<PhantomInfo>& phantoms)
+{
+    const Phantom phantom = makePhantom(randomPhantomSpec(config.seed + static_cast<unsigned int>(index), columns, config.maxNoise));
+    phantoms[index] = { phantom.spec, phantom.gap };
+
+    if (!config.saveDir.empty()) {
+        const std::string path = (std::filesystem::path(config.saveDir) / ("phantom" + std::to_string(index) + (columns ? "_P6.tif" : "_P1.tif"))).string();
+        if (!cv::imwrite(path, phantom.image))
+            std::cerr << "Cannot write " << path << std::endl;
+    }
+
+    for (size_t v = 0; v < variants.size(); ++v) {
+        if (variants[v].columns != columns) continue;
+
+        // A mirrored phantom is scanned from the other side, so the kernel still selects the same pair of edges
+        InspectionPoint point = variants[v].point;
+        point.imagePath = "phantom#" + std::to_string(index);
+        point.ROI = phantom.ROI;
+        if (phantom.spec.mirrored)
+            point.params.orientation = columns ? Orientation::FROM_RIGHT : Orientation::FROM_TOP;
+
+        Sample& sample = samples[v][index];
+        auto t0 = std::chrono::steady_clock::now();
+        try {
+            // The track is the full search of the same phantom, as if the previous cell had been identical
+            if (variants[v].tracked) {
+                InspectionPoint full = point;
+                full.params.trackWindow = 0;
+                const GapMeasurement reference = measureFrame(full, phantom.image);
+                sample.fullConfidence = reference.confidence;
+                if (reference.valid) {
+                    point.params.trackPeak = reference.peakPosition;
+                    point.params.trackValley = reference.valleyPosition;
+                }
+                t0 = std::chrono::steady_clock::now();
+            }
+            sample.measurement = measureFrame(point, phantom.image);
+            sample.measured = true;
+        }
+        catch (const std::exception& e) {
+            std::cerr << point.name << " on " << point.imagePath << ": " << e.what() << std::endl;
+        }
+        sample.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    }
+}
+
+void writeCsv(const std::string& filePath, const std::vector<Variant>& variants, const std::vector<std::vector<Sample>>& samples,
+              const std::vector<PhantomInfo>& rowPhantoms, const std::vector<PhantomInfo>& columnPhantoms)
+{
+    std::ofstream csv(filePath);
+    if (!csv) {
+        std::cerr << "Cannot open " << filePath << std::endl;
+        return;
+    }
+    csv << "variant,phantom,seed,mirrored,torn_fraction,read_noise,edge_blur,tilt_deg,true_gap,valid,gap,error,confidence,ms\n";
+    for (size_t v = 0; v < variants.size(); ++v) {
+        const auto& phantoms = variants[v].columns ? columnPhantoms : rowPhantoms;
+        for (size_t i = 0; i < samples[v].size(); ++i) {
+            const Sample& s = samples[v][i];
+            const PhantomSpec& spec = phantoms[i].spec;
+            const bool valid = s.measured && s.measurement.valid;
+            csv << variants[v].name << ',' << i << ',' << spec.seed << ',' << spec.mirrored << ',' << spec.tornFraction << ','
+                << spec.readNoise << ',' << spec.edgeBlur << ',' << spec.tiltDeg << ',' << phantoms[i].gap << ',' << valid << ','
+                << (valid ? s.measurement.gap : 0.0) << ',' << (valid ? s.measurement.gap - phantoms[i].gap : 0.0) << ','
+                << s.measurement.confidence << ',' << s.ms << '\n';
+        }
+    }
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Main Function                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+int main(int argc, char** argv)
+{
+    HarnessConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        std::cerr << "Usage: AccuracyHarness [--count N] [--threads N] [--seed N] [--noise MAX] [--tolerance PX] [--variants LIST]\n"
+                     "                       [--csv FILE] [--save DIR] [--max-fail PCT]" << std::endl;
+        return 2;
+    }
+
+    const std::vector<Variant> variants = makeVariants(config.filters);
+    if (variants.empty()) {
+        std::cerr << "No variant matches --variants" << std::endl;
+        return 2;
+    }
+    bool rows = false, columns = false;
+    for (const auto& variant : variants)
+        (variant.columns ? columns : rows) = true;
+    if (!config.saveDir.empty())
+        std::filesystem::create_directories(config.saveDir);
+
+    // The pool supplies the parallelism: OpenCV's own threads are turned off so each call is timed on one core
+    cv::setNumThreads(1);
+    ThreadPool pool(config.threads);
+    std::vector<std::vector<Sample>> samples(variants.size(), std::vector<Sample>(config.count));
+    std::vector<PhantomInfo> rowPhantoms(config.count), columnPhantoms(config.count);
+
+    std::printf("%d phantoms per orientation, %zu variants, %u threads, noise up to %.0f\n\n",
+                config.count, variants.size(), pool.size(), config.maxNoise);
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < config.count; ++i) {
+        if (rows)
+            pool.submit([&, i] { runPhantom(config, i, false, variants, samples, rowPhantoms); });
+        if (columns)
+            pool.submit([&, i] { runPhantom(config, i, true, variants, samples, columnPhantoms); });
+    }
+    pool.wait();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    //--------------- Report ----------------------------------------//
+    // Errors are signed (measured - true) in pixels; a miss is a phantom whose gap was not found.
+    // The torn columns only count the phantoms with a torn separator: compare a .strips variant with the same one without.
+    // frames/s assumes every worker runs this variant: workers x 1000 / mean latency.
+    std::printf("%-22s %7s %9s %8s %9s %9s %7s %9s %9s %9s %9s %9s\n", "variant", "found", "bias[px]", "rms[px]", "p95|err|",
+                "max|err|", "fail%", "bias torn", "rms torn", "p50[ms]", "p99[ms]", "frames/s");
+    bool gateFailed = false;
+    for (size_t v = 0; v < variants.size(); ++v) {
+        const auto& phantoms = variants[v].columns ? columnPhantoms : rowPhantoms;
+        std::vector<double> absErrors, latencies;
+        double sum = 0.0, squares = 0.0, tornSum = 0.0, tornSquares = 0.0, totalMs = 0.0;
+        int found = 0, failed = 0, torn = 0;
+        for (int i = 0; i < config.count; ++i) {
+            const Sample& s = samples[v][i];
+            latencies.push_back(s.ms);
+            totalMs += s.ms;
+            if (!s.measured || !s.measurement.valid) {
+                ++failed;
+                continue;
+            }
+            const double error = s.measurement.gap - phantoms[i].gap;
+            ++found;
+            sum += error;
+            squares += error * error;
+            absErrors.push_back(std::abs(error));
+            if (std::abs(error) > config.tolerance) ++failed;
+            if (phantoms[i].spec.tornFraction > 0.0) {
+                ++torn;
+                tornSum += error;
+                tornSquares += error * error;
+            }
+        }
+
+        const double failPercent = 100.0 * failed / config.count;
+        const double meanMs = totalMs / config.count;
+        std::printf("%-22s %6.1f%% %9.3f %8.3f %9.3f %9.3f %6.1f%% %9.3f %9.3f %9.3f %9.3f %9.1f\n",
+                    variants[v].name.c_str(), 100.0 * found / config.count,
+                    found > 0 ? sum / found : 0.0, found > 0 ? std::sqrt(squares / found) : 0.0,
+                    percentile(absErrors, 95.0), percentile(absErrors, 100.0), failPercent,
+                    torn > 0 ? tornSum / torn : 0.0, torn > 0 ? std::sqrt(tornSquares / torn) : 0.0,
+                    percentile(latencies, 50.0), percentile(latencies, 99.0),
+                    meanMs > 0.0 ? pool.size() * 1000.0 / meanMs : 0.0);
+        if (config.maxFailPercent >= 0.0 && failPercent > config.maxFailPercent)
+            gateFailed = true;
+    }
+    std::printf("\n%.1f s wall, tolerance %.2f px\n", seconds, config.tolerance);
+
+    // The tracked search sees only two bands around the edges: its confidence should still match the full search's
+    bool header = false;
+    for (size_t v = 0; v < variants.size(); ++v) {
+        if (!variants[v].tracked) continue;
+        std::vector<double> ratios;
+        for (int i = 0; i < config.count; ++i) {
+            const Sample& s = samples[v][i];
+            if (s.measured && s.measurement.tracked && s.fullConfidence > 0.0)
+                ratios.push_back(s.measurement.confidence / s.fullConfidence);
+        }
+        if (!header) {
+            std::printf("\n%-22s %8s %30s\n", "tracked vs full", "tracked", "confidence ratio p5/p50/p95");
+            header = true;
+        }
+        std::printf("%-22s %7.1f%% %10.3f %9.3f %9.3f\n", variants[v].name.c_str(), 100.0 * ratios.size() / config.count,
+                    percentile(ratios, 5.0), percentile(ratios, 50.0), percentile(ratios, 95.0));
+    }
+
+    if (!config.csvPath.empty())
+        writeCsv(config.csvPath, variants, samples, rowPhantoms, columnPhantoms);
+
+    if (gateFailed)
+        std::cerr << "A variant fails on more than " << config.maxFailPercent << "% of the phantoms" << std::endl;
+    return gateFailed ? 1 : 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,144 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                              FindPeakBenchmark.cpp                                                               //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+// Times FindPeak::run on long synthetic derivative profiles and compares it with the previous quadratic prominence and
+// distance filters, checking that both select the same peaks.
+//
+// Usage: FindPeakBenchmark [maxLength=1000000] [repeats=5]
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "xvtLib.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+/// <summary>
+/// Noisy derivative-like signal: a few strong edges on a random walk with white noise.
+/// </summary>
+std::vector<double> makeSignal(int length, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0.0, 2.0);
+    std::normal_distribution<double> drift(0.0, 0.3);
+
+    std::vector<double> signal(length);
+    double walk = 0.0;
+    for (int i = 0; i < length; ++i) {
+        walk += drift(rng);
+        signal[i] = walk + noise(rng);
+        if (i % 1500 == 750) signal[i] += 40.0;
+        if (i % 1500 == 1100) signal[i] -= 40.0;
+    }
+    return signal;
+}
+
+/// <summary>
+/// The previous FindPeak filters: scan outwards from every extremum, compare every candidate with every selected peak.
+/// </summary>
+std::vector<FindPeak::PeakInfo> referenceRun(const std::vector<double>& s, FindPeak::Mode mode, int minDistance, double minProminence)
+{
+    const bool peakMode = mode == FindPeak::Mode::PEAK;
+    auto higher = [peakMode](double a, double b) { return peakMode ? a > b : a < b; };
+
+    std::vector<FindPeak::PeakInfo> extrema;
+    for (int i = 1; i < (int)s.size() - 1; ++i)
+        if (higher(s[i], s[i - 1]) && higher(s[i], s[i + 1]))
+            extrema.push_back({ i, s[i] });
+
+    std::vector<FindPeak::PeakInfo> prominent;
+    for (const auto& p : extrema) {
+        double leftBase = p.value, rightBase = p.value;
+        for (int i = p.position - 1; i >= 0 && !higher(s[i], p.value); --i)
+            leftBase = peakMode ? std::min(leftBase, s[i]) : std::max(leftBase, s[i]);
+        for (int i = p.position + 1; i < (int)s.size() && !higher(s[i], p.value); ++i)
+            rightBase = peakMode ? std::min(rightBase, s[i]) : std::max(rightBase, s[i]);
+        double prominence = peakMode ? p.value - std::max(leftBase, rightBase) : std::min(leftBase, rightBase) - p.value;
+        if (prominence >= minProminence)
+            prominent.push_back(p);
+    }
+
+    std::stable_sort(prominent.begin(), prominent.end(),
+        [&](const FindPeak::PeakInfo& a, const FindPeak::PeakInfo& b) { return higher(a.value, b.value); });
+    std::vector<FindPeak::PeakInfo> selected;
+    for (const auto& p : prominent) {
+        bool conflict = false;
+        for (const auto& q : selected)
+            conflict = conflict || std::abs(p.position - q.position) < minDistance;
+        if (!conflict)
+            selected.push_back(p);
+    }
+    std::sort(selected.begin(), selected.end(),
+        [](const FindPeak::PeakInfo& a, const FindPeak::PeakInfo& b) { return a.position < b.position; });
+    return selected;
+}
+
+template <typename F>
+double bestOfMs(int repeats, F&& f)
+{
+    double best = 1e300;
+    for (int r = 0; r < repeats; ++r) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+    return best;
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Main Function                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+int main(int argc, char** argv)
+{
+    const int maxLength = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    const int repeats = argc > 2 ? std::atoi(argv[2]) : 5;
+    const int referenceLimit = 200000; // the quadratic reference gets too slow beyond this
+
+    std::printf("%10s %6s %12s %14s %8s %6s\n", "length", "mode", "run [ms]", "reference [ms]", "speedup", "same");
+    for (int length = 1000; length <= maxLength; length *= 10) {
+        std::vector<double> signal = makeSignal(length, 42u + length);
+
+        for (FindPeak::Mode mode : { FindPeak::Mode::PEAK, FindPeak::Mode::VALLEY }) {
+            FindPeak findPeak(mode, 20, 5);
+            FindPeak::Workspace workspace;
+            std::vector<FindPeak::PeakInfo> peaks;
+            double runMs = bestOfMs(repeats, [&] {
+                if (mode == FindPeak::Mode::PEAK)
+                    findPeak.run<FindPeak::Mode::PEAK>(std::span<const double>(signal), peaks, workspace);
+                else
+                    findPeak.run<FindPeak::Mode::VALLEY>(std::span<const double>(signal), peaks, workspace);
+            });
+
+            const char* modeName = mode == FindPeak::Mode::PEAK ? "peak" : "valley";
+            if (length > referenceLimit) {
+                std::printf("%10d %6s %12.3f %14s %8s %6s\n", length, modeName, runMs, "-", "-", "-");
+                continue;
+            }
+
+            std::vector<FindPeak::PeakInfo> reference;
+            double referenceMs = bestOfMs(repeats, [&] { reference = referenceRun(signal, mode, 20, 5); });
+
+            bool same = peaks.size() == reference.size();
+            for (size_t i = 0; same && i < peaks.size(); ++i)
+                same = peaks[i].position == reference[i].position;
+
+            std::printf("%10d %6s %12.3f %14.3f %7.1fx %6s\n", length, modeName, runMs, referenceMs,
+                referenceMs / runMs, same ? "yes" : "NO");
+        }
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
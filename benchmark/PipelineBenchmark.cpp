@@ -0,0 +1,394 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                              PipelineBenchmark.cpp                                                               //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+// Times every stage of the P1 and P6 inspection paths on synthetic 16-bit battery frames (makePhantom) and reports latency
+// percentiles and throughput per stage, followed by the measure-only and the annotated end-to-end kernels.
+//
+// The "prof" rows time the Profiler itself: 1000 samples on one thread, then 1000 per thread on every hardware thread at
+// once. The instrumentation overhead of the kernels is the difference between the P1Measure/P6Measure rows of two builds,
+// one configured with -DXVT_ENABLE_PROFILING=ON and one with OFF (the first line says which one ran), e.g. with --csv.
+//
+// Usage: PipelineBenchmark [--width N] [--height N] [--noise SIGMA] [--iterations N] [--warmup N]
+//                          [--denoise nlm|gaussian|box|median|profile] [--csv FILE]
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "xvtLib.h"
+#include "P1.h"
+#include "P6.h"
+#include "Phantom.h"
+#include "Profiler.h"
+#include "RawFrame.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+struct BenchmarkConfig {
+    int width = 3000;
+    int height = 2500;
+    double noise = 400.0;           // standard deviation of the sensor noise, in 16-bit counts
+    int iterations = 30;
+    int warmup = 3;
+    DenoiseMethod denoise = DenoiseMethod::NLM;
+    std::string csvPath;
+};
+
+struct StageResult {
+    std::string path;
+    std::string stage;
+    double pixels = 0.0;            // pixels processed per call, for the throughput column
+    std::vector<double> samplesMs;
+};
+
+/// <summary>
+/// Synthetic 16-bit X-ray of the cell edge, rendered by makePhantom: the jelly roll ends at 55% of the scan axis, then the
+/// separator gap, the anode overhang up to 80% and the can wall, with the beam falloff and Gaussian sensor noise.
+/// </summary>
+cv::Mat makeBenchmarkFrame(const BenchmarkConfig& config, bool columns, unsigned int seed)
+{
+    PhantomSpec spec;
+    spec.columns = columns;
+    spec.length = columns ? config.width : config.height;
+    spec.width = columns ? config.height : config.width;
+    spec.cathodeEnd = spec.length * 0.55;
+    spec.separatorWidth = std::max(8, spec.length / 60);
+    spec.gap = spec.length * 0.80 - spec.cathodeEnd - spec.separatorWidth;
+    spec.edgeBlur = 2.0;
+    spec.readNoise = config.noise;
+    spec.seed = seed;
+    return makePhantom(spec).image;
+}
+
+/// <summary>
+/// Runs `body` for the warm-up and measured iterations and records the wall time of each measured call.
+/// </summary>
+StageResult measure(const BenchmarkConfig& config, const std::string& path, const std::string& stage, double pixels,
+                    const std::function<void()>& body)
+{
+    StageResult result{ path, stage, pixels, {} };
+    result.samplesMs.reserve(config.iterations);
+    for (int i = 0; i < config.warmup; ++i)
+        body();
+    for (int i = 0; i < config.iterations; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        body();
+        auto t1 = std::chrono::steady_clock::now();
+        result.samplesMs.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+    }
+    return result;
+}
+
+void printHeader()
+{
+    std::printf("%-4s %-22s %9s %9s %9s %9s %9s %10s %10s\n",
+        "path", "stage", "min [ms]", "p50", "p90", "p99", "max", "frames/s", "MPix/s");
+}
+
+void printResult(const StageResult& r)
+{
+    double p50 = percentile(r.samplesMs, 50.0);
+    std::printf("%-4s %-22s %9.3f %9.3f %9.3f %9.3f %9.3f %10.1f %10.1f\n",
+        r.path.c_str(), r.stage.c_str(),
+        percentile(r.samplesMs, 0.0), p50, percentile(r.samplesMs, 90.0), percentile(r.samplesMs, 99.0),
+        percentile(r.samplesMs, 100.0),
+        p50 > 0 ? 1000.0 / p50 : 0.0,
+        p50 > 0 ? r.pixels / p50 / 1000.0 : 0.0);
+}
+
+void writeCsv(const std::string& filePath, const std::vector<StageResult>& results)
+{
+    std::ofstream csv(filePath);
+    if (!csv) {
+        std::cerr << "Cannot open " << filePath << std::endl;
+        return;
+    }
+    csv << "path,stage,pixels,iterations,min_ms,p50_ms,p90_ms,p99_ms,max_ms\n";
+    for (const auto& r : results) {
+        csv << r.path << ',' << r.stage << ',' << r.pixels << ',' << r.samplesMs.size() << ','
+            << percentile(r.samplesMs, 0.0) << ',' << percentile(r.samplesMs, 50.0) << ','
+            << percentile(r.samplesMs, 90.0) << ',' << percentile(r.samplesMs, 99.0) << ','
+            << percentile(r.samplesMs, 100.0) << '\n';
+    }
+}
+
+bool parseArguments(int argc, char** argv, BenchmarkConfig& config)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--width") config.width = std::atoi(value.c_str());
+        else if (arg == "--height") config.height = std::atoi(value.c_str());
+        else if (arg == "--noise") config.noise = std::atof(value.c_str());
+        else if (arg == "--iterations") config.iterations = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--warmup") config.warmup = std::max(0, std::atoi(value.c_str()));
+        else if (arg == "--csv") config.csvPath = value;
+        else if (arg == "--denoise") {
+            if (value == "nlm") config.denoise = DenoiseMethod::NLM;
+            else if (value == "gaussian") config.denoise = DenoiseMethod::GAUSSIAN;
+            else if (value == "box") config.denoise = DenoiseMethod::BOX;
+            else if (value == "median") config.denoise = DenoiseMethod::MEDIAN;
+            else if (value == "profile") config.denoise = DenoiseMethod::PROFILE;
+            else {
+                std::cerr << "Unknown denoise method " << value << std::endl;
+                return false;
+            }
+        }
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return config.width >= 256 && config.height >= 256;
+}
+
+/// <summary>
+/// Stage-by-stage replica of one inspection path. `dim` and the filters follow P1 (rows, dim = 1) or P6 (columns,
+/// dim = 0); the end-to-end kernel is timed last so the stage sum can be compared with it.
+/// </summary>
+void benchmarkPath(const BenchmarkConfig& config, const std::string& path, const std::string& framePath,
+                   cv::Rect ROI, const InspectionParams& params, std::vector<StageResult>& results)
+{
+    const bool p6 = path == "P6";
+    const int dim = p6 ? 0 : 1;
+    const double roiPixels = static_cast<double>(ROI.area());
+    const double framePixels = static_cast<double>(config.width) * config.height;
+
+    cv::Mat image;
+    results.push_back(measure(config, path, "loadImage", framePixels, [&] { image = loadImage(framePath); }));
+    cv::Rect cropROI = ROI;
+    results.push_back(measure(config, path, "loadImageROI", roiPixels, [&] {
+        cropROI = ROI;
+        loadImageROI(framePath, cropROI, 32);
+    }));
+
+    // The same frame as a memory-mapped raw file: no decoder, and the ROI variant only touches the pages it converts
+    const std::string rawPath = std::filesystem::path(framePath).replace_extension(".raw").string();
+    if (writeRawFrame(rawPath, cv::imread(framePath, cv::IMREAD_UNCHANGED)) > 0) {
+        results.push_back(measure(config, path, "loadImage(raw)", framePixels, [&] { loadImage(rawPath); }));
+        results.push_back(measure(config, path, "loadImageROI(raw)", roiPixels, [&] {
+            cropROI = ROI;
+            loadImageROI(rawPath, cropROI, 32);
+        }));
+        std::filesystem::remove(rawPath);
+    }
+
+    // Registration of the ROI: the outline search on the frame decimated 8 times, the cost a placed ROI adds per frame
+    cv::Rect outline;
+    results.push_back(measure(config, path, "locateCellOutline(/8)", framePixels, [&] {
+        locateCellOutline(image, OutlineParams(), outline);
+    }));
+
+    // Stretch of the 16-bit ROI: min/max to 8-bit, and the percentile stretch to 8 and 16 bits (bit_depth = 16)
+    const cv::Mat frame16 = cv::imread(framePath, cv::IMREAD_UNCHANGED);
+    if (frame16.type() == CV_16UC1) {
+        const cv::Mat roi16 = frame16(ROI);
+        cv::Mat stretched;
+        double lowVal = 0, highVal = 0;
+        results.push_back(measure(config, path, "convert16To8bit", roiPixels,
+            [&] { convert16To8bit(roi16, stretched, lowVal, highVal); }));
+        results.push_back(measure(config, path, "normalizePercentile8", roiPixels,
+            [&] { normalizePercentile(roi16, stretched, CV_8U, 0.1, lowVal, highVal); }));
+        results.push_back(measure(config, path, "normalizePercentile16", roiPixels,
+            [&] { normalizePercentile(roi16, stretched, CV_16U, 0.1, lowVal, highVal); }));
+    }
+
+    cv::Mat srcImg = image(ROI).clone();
+    cv::Mat claheImg = srcImg;
+    if (p6) {
+        results.push_back(measure(config, path, "CLAHEOpenCV", roiPixels,
+            [&] { CLAHEOpenCV(srcImg, claheImg, 3.0, cv::Size(8, 8)); }));
+    }
+
+    cv::Mat denoisedImg;
+    results.push_back(measure(config, path, "denoiseImage", roiPixels,
+        [&] { denoiseImage(claheImg, denoisedImg, params.denoise, p6 ? 15.0f : 10.0f); }));
+
+    cv::Mat blurImg = denoisedImg;
+    if (p6 && params.denoise == DenoiseMethod::NLM) {
+        results.push_back(measure(config, path, "bilateralFilter", roiPixels,
+            [&] { cv::bilateralFilter(denoisedImg, blurImg, 9, 75, 150); }));
+    }
+
+    // cv::reduce is what the profile used to be built with; computeProfile is the fused replacement
+    cv::Mat reduced;
+    results.push_back(measure(config, path, "cv::reduce", roiPixels,
+        [&] { cv::reduce(blurImg, reduced, dim, cv::REDUCE_AVG, CV_64F); }));
+    ProfileWorkspace workspace;
+    results.push_back(measure(config, path, "computeProfile", roiPixels,
+        [&] { computeProfile(blurImg, dim, false, workspace, params.denoise == DenoiseMethod::PROFILE ? 7 : 0); }));
+
+    FindPeak::Workspace peakWorkspace;
+    std::vector<FindPeak::PeakInfo> peaks, valleys;
+    const std::span<const double> derivative(workspace.derivative);
+    FindPeak findPeak(FindPeak::Mode::PEAK, params.minDistance, params.peakProminence);
+    FindPeak findValley(FindPeak::Mode::VALLEY, params.minDistance, params.valleyProminence);
+    results.push_back(measure(config, path, "FindPeak::run", static_cast<double>(derivative.size()), [&] {
+        findPeak.run<FindPeak::Mode::PEAK>(derivative, peaks, peakWorkspace);
+        findValley.run<FindPeak::Mode::VALLEY>(derivative, valleys, peakWorkspace);
+    }));
+
+    GapMeasurement gap;
+    results.push_back(measure(config, path, "measureGap", static_cast<double>(derivative.size()), [&] {
+        gap = GapMeasurement();
+        if (!peaks.empty() && !valleys.empty())
+            measureGap(derivative, p6 ? peaks.front().position : peaks.back().position, valleys.back().position,
+                       false, params.pixelSizeUm, gap);
+    }));
+
+    GapMeasurement kernelGap;
+    ResultOverlay overlay;
+    results.push_back(measure(config, path, p6 ? "P6Measure" : "P1Measure", roiPixels, [&] {
+        kernelGap = p6 ? P6Measure(image, ROI, params, &overlay) : P1Measure(image, ROI, params, &overlay);
+    }));
+
+    // The same point of 16 cells in one call: the MPix/s column compares with the frame-by-frame kernel
+    std::vector<cv::Mat> cells;
+    for (int i = 0; i < 16; ++i)
+        cells.push_back(image.clone());
+    std::vector<GapMeasurement> batchGaps;
+    results.push_back(measure(config, path, p6 ? "P6MeasureBatch(x16)" : "P1MeasureBatch(x16)", roiPixels * cells.size(), [&] {
+        batchGaps = p6 ? P6MeasureBatch(cells, ROI, params) : P1MeasureBatch(cells, ROI, params);
+    }));
+
+    // Coarse-to-fine: the filters only see the downsampled ROI and two bands around the edges
+    InspectionParams pyramidParams = params;
+    pyramidParams.pyramidLevels = 2;
+    GapMeasurement pyramidGap;
+    results.push_back(measure(config, path, p6 ? "P6Measure(pyramid)" : "P1Measure(pyramid)", roiPixels, [&] {
+        pyramidGap = p6 ? P6Measure(image, ROI, pyramidParams) : P1Measure(image, ROI, pyramidParams);
+    }));
+
+    // Tracked: the next cell of a steady line, searched within 8 px of the edges measured above
+    InspectionParams trackedParams = params;
+    trackedParams.trackWindow = 8;
+    if (kernelGap.valid) {
+        trackedParams.trackPeak = kernelGap.peakPosition;
+        trackedParams.trackValley = kernelGap.valleyPosition;
+    }
+    GapMeasurement trackedGap;
+    results.push_back(measure(config, path, p6 ? "P6Measure(tracked)" : "P1Measure(tracked)", roiPixels, [&] {
+        trackedGap = p6 ? P6Measure(image, ROI, trackedParams) : P1Measure(image, ROI, trackedParams);
+    }));
+
+    cv::Mat resultImg;
+    results.push_back(measure(config, path, "drawResult", framePixels, [&] { resultImg = drawResult(image, overlay); }));
+
+    results.push_back(measure(config, path, p6 ? "P6ImageProcessing" : "P1ImageProcessing", roiPixels, [&] {
+        resultImg = p6 ? P6ImageProcessing(image, ROI, params, &kernelGap) : P1ImageProcessing(image, ROI, params, &kernelGap);
+    }));
+    results.push_back(measure(config, path, "end-to-end (load+run)", framePixels, [&] {
+        cv::Mat frame = loadImage(framePath);
+        resultImg = p6 ? P6ImageProcessing(frame, ROI, params, &kernelGap) : P1ImageProcessing(frame, ROI, params, &kernelGap);
+    }));
+
+    std::printf("%s: gap %s %.2f px (confidence %.1f), pyramid %s %.2f px, batch %s %.2f px, tracked %s %.2f px%s\n", path.c_str(),
+                kernelGap.valid ? "=" : "not found,", kernelGap.gap, kernelGap.confidence, pyramidGap.valid ? "=" : "not found,",
+                pyramidGap.gap, batchGaps.front().valid ? "=" : "not found,", batchGaps.front().gap,
+                trackedGap.valid ? "=" : "not found,", trackedGap.gap, trackedGap.tracked ? "" : " (fell back)");
+}
+
+/// <summary>
+/// Cost of the Profiler samples, alone and with every hardware thread recording at once like the workers of a pool.
+/// The samples are discarded afterwards.
+/// </summary>
+void benchmarkProfiler(const BenchmarkConfig& config, std::vector<StageResult>& results)
+{
+    constexpr int SAMPLES = 1000;
+    auto recordSamples = [] {
+        ProfilePointScope point("benchmark");
+        for (int i = 0; i < SAMPLES; ++i) {
+            Profiler::instance().record("stage", 0.5);
+            Profiler::instance().count("counter", i);
+        }
+    };
+    results.push_back(measure(config, "prof", "record+count(1000)", SAMPLES, recordSamples));
+
+    const unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    results.push_back(measure(config, "prof", "record+count(1000/thr)", static_cast<double>(SAMPLES) * threads, [&] {
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; ++t)
+            workers.emplace_back(recordSamples);
+        for (auto& worker : workers)
+            worker.join();
+    }));
+    Profiler::instance().reset();
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Main Function                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+int main(int argc, char** argv)
+{
+    BenchmarkConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        std::cerr << "Usage: PipelineBenchmark [--width N] [--height N] [--noise SIGMA] [--iterations N] [--warmup N]\n"
+                     "                         [--denoise nlm|gaussian|box|median|profile] [--csv FILE]" << std::endl;
+        return 2;
+    }
+
+    // The frames go through the TIFF codec like the production images, so loadImage is part of the measurement
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string rowsPath = (dir / "xvt_bench_rows.tif").string();
+    const std::string colsPath = (dir / "xvt_bench_cols.tif").string();
+    cv::Mat rows, cols;
+    try {
+        rows = makeBenchmarkFrame(config, false, 1u);
+        cols = makeBenchmarkFrame(config, true, 2u);
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "Cannot render the synthetic frames: " << ex.what() << std::endl;
+        return 1;
+    }
+    if (!cv::imwrite(rowsPath, rows) || !cv::imwrite(colsPath, cols)) {
+        std::cerr << "Cannot write the synthetic frames to " << dir << std::endl;
+        return 1;
+    }
+
+    std::printf("frame %dx%d, noise %.0f, %d iterations (+%d warm-up), %d threads, profiling %s\n\n", config.width,
+                config.height, config.noise, config.iterations, config.warmup, cv::getNumThreads(), Profiler::enabled ? "on" : "off");
+
+    // ROIs straddle the separator gap like the recipe points do
+    InspectionParams p1 = P1_DEFAULT_PARAMS;
+    InspectionParams p6 = P6_DEFAULT_PARAMS;
+    p1.denoise = p6.denoise = config.denoise;
+    cv::Rect p1ROI(config.width / 3, config.height * 35 / 100, std::min(300, config.width / 4), config.height * 50 / 100);
+    cv::Rect p6ROI(config.width * 35 / 100, config.height / 3, config.width * 50 / 100, std::min(300, config.height / 4));
+
+    std::vector<StageResult> results;
+    benchmarkPath(config, "P1", rowsPath, p1ROI, p1, results);
+    benchmarkPath(config, "P6", colsPath, p6ROI, p6, results);
+    benchmarkProfiler(config, results);
+
+    std::printf("\n");
+    printHeader();
+    for (const auto& r : results)
+        printResult(r);
+
+    if (!config.csvPath.empty())
+        writeCsv(config.csvPath, results);
+
+    std::filesystem::remove(rowsPath);
+    std::filesystem::remove(colsPath);
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,232 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include "xvtLib.h"
+#include "EdgeTracker.h"
+#include "FrameSource.h"
+#include "ResultWriter.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   Declaration                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Signature shared by the inspection kernels (P1ImageProcessing, P6ImageProcessing).
+/// </summary>
+using InspectionKernel = cv::Mat (*)(const cv::Mat, cv::Rect, const InspectionParams&, GapMeasurement*);
+
+/// <summary>
+/// Signature shared by the measure-only kernels (P1Measure, P6Measure).
+/// </summary>
+using MeasureKernel = GapMeasurement (*)(const cv::Mat&, cv::Rect, const InspectionParams&, ResultOverlay*);
+
+/// <summary>
+/// When the annotated result image of a point is rendered and written.
+/// </summary>
+enum class AnnotationPolicy
+{
+    ALWAYS,     // Every part.
+    NG,         // Only the NG parts: gap not found or outside the limits.
+    EVERY_N,    // The NG parts and every annotateEvery-th cell.
+    NEVER       // Measurement only.
+};
+
+/// <summary>
+/// One inspection point of a cell: where to read the image, how to process it and where to write the result.
+/// </summary>
+struct InspectionPoint
+{
+    std::string name;           // The name of the point (P1..P8).
+    std::string imagePath;      // The path of the input image.
+    std::string resultPath;     // The path of the annotated result image.
+    cv::Rect ROI;               // The ROI in the coordinates of the loaded image.
+    cv::Rect referenceOutline;  // The cell outline of the frame the ROI was taught on, or empty to keep the ROI fixed.
+    OutlineParams outline;      // The outline detection that places the ROI when referenceOutline is set.
+    MeasureKernel kernel;       // The kernel measuring the gap.
+    InspectionParams params;    // The kernel parameters, including the scan orientation.
+    int margin = -1;            // Margin kept around the ROI when only the ROI is converted, or -1 to convert the full frame.
+    int depth = CV_8U;          // CV_8U to stretch 16-bit frames to 8-bit, CV_16U to keep them 16-bit through the kernel.
+    double clipPercent = 0.0;   // The percentage of pixels saturated at each end of the stretch, 0 for min/max.
+    bool compareDenoise = false;// Also run the NLM baseline and report the gap and time difference of params.denoise.
+    AnnotationPolicy annotate = AnnotationPolicy::ALWAYS; // When the result image is written.
+    int annotateEvery = 1;      // The cell period of AnnotationPolicy::EVERY_N.
+    double gapMin = 0.0;        // The smallest good gap, in micrometres if params.pixelSizeUm > 0, else in pixels.
+    double gapMax = 0.0;        // The largest good gap, same unit. 0 for no upper limit.
+};
+
+/// <summary>
+/// Load and measure one inspection point, without rendering the result image.
+/// </summary>
+/// <param name="point">The inspection point.</param>
+/// <param name="image">If not null, receives the image the kernel measured, for a later drawResult.</param>
+/// <param name="overlay">If not null, receives the result overlay, for a later drawResult.</param>
+/// <returns>The measured gap.</returns>
+GapMeasurement measurePoint(const InspectionPoint& point, cv::Mat* image = nullptr, ResultOverlay* overlay = nullptr);
+
+/// <summary>
+/// Measure one inspection point on a frame already in memory, without rendering the result image.
+/// With a reference outline, the ROI is first placed relative to the cell outline located on the frame.
+/// </summary>
+/// <param name="point">The inspection point. Its imagePath is only used in the error messages.</param>
+/// <param name="frame">The raw frame. (8UC1 or 16UC1)</param>
+/// <param name="image">If not null, receives the image the kernel measured, for a later drawResult.</param>
+/// <param name="overlay">If not null, receives the result overlay, for a later drawResult.</param>
+/// <returns>The measured gap.</returns>
+GapMeasurement measureFrame(const InspectionPoint& point, const cv::Mat& frame, cv::Mat* image = nullptr,
+                            ResultOverlay* overlay = nullptr);
+
+/// <summary>
+/// Load, process and return the annotated result of one inspection point.
+/// </summary>
+/// <param name="point">The inspection point.</param>
+/// <param name="measurement">If not null, receives the measured gap.</param>
+/// <returns>The annotated result image: the full frame, or the ROI plus margin when point.margin >= 0. (8UC3)</returns>
+cv::Mat inspectPoint(const InspectionPoint& point, GapMeasurement* measurement = nullptr);
+
+/// <summary>
+/// Judge a measurement against the gap limits of its point. With strips, the gap judged is the median of the accepted strips.
+/// </summary>
+/// <param name="point">The inspection point.</param>
+/// <param name="measurement">The measurement of the point.</param>
+/// <returns>True if the gap was found and is within [gapMin, gapMax].</returns>
+bool isGapGood(const InspectionPoint& point, const GapMeasurement& measurement);
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Run inspection points of many cells concurrently on a thread pool.
+/// The number of images loaded but not yet written is bounded, so submitting a long queue of cells blocks
+/// instead of growing memory. Each point is measured and logged first; its result image is then handed to a ResultWriter,
+/// which renders, encodes and writes it on its own threads, and only if its AnnotationPolicy asks for it.
+/// The points with InspectionParams::trackWindow > 0 start each cell from the edges of the previous ones (EdgeTracker).
+/// </summary>
+class BatchInspector
+{
+public:
+    /// <summary>
+    /// Constructor of the BatchInspector class.
+    /// </summary>
+    /// <param name="numThreads">The number of worker threads. 0 uses all hardware threads.</param>
+    /// <param name="maxInFlight">The maximum number of points in flight. 0 uses twice the number of workers.</param>
+    /// <param name="output">The encoding and queue options of the result images.</param>
+    explicit BatchInspector(unsigned int numThreads = 0, unsigned int maxInFlight = 0,
+                            const ResultWriterOptions& output = ResultWriterOptions());
+
+    /// <summary>
+    /// Destructor. Waits for the submitted points.
+    /// </summary>
+    ~BatchInspector();
+
+    /// <summary>
+    /// Queue one inspection point as a cell of its own. Blocks while the in-flight limit is reached.
+    /// </summary>
+    /// <param name="point">The inspection point.</param>
+    void submit(const InspectionPoint& point);
+
+    /// <summary>
+    /// Queue all the inspection points of a cell.
+    /// </summary>
+    /// <param name="cell">The inspection points of the cell.</param>
+    void submitCell(const std::vector<InspectionPoint>& cell);
+
+    /// <summary>
+    /// Long-running mode: inspect the frames of a source until it ends or stop is set, then wait for them.
+    /// Each frame goes to the point whose image name (without extension) it is or ends with after a '_', e.g.
+    /// "cell0042_P3" to the point reading P3.tif; its result is named after the frame. Reading the next frame overlaps
+    /// with the measurement of the previous ones, and the workers keep their buffers warm from frame to frame.
+    /// </summary>
+    /// <param name="source">The frame source.</param>
+    /// <param name="points">The inspection points of the recipe.</param>
+    /// <param name="stop">Set from another thread or a signal handler to stop after the frames already read.</param>
+    /// <returns>The number of frames submitted.</returns>
+    unsigned long long run(FrameSource& source, const std::vector<InspectionPoint>& points, const std::atomic<bool>& stop);
+
+    /// <summary>
+    /// Block until every submitted point has been measured and its result image written.
+    /// </summary>
+    void wait();
+
+    /// <summary>
+    /// Append one CSV line per processed point to a measurement log, for SPC. A header is written if the file is new.
+    /// Columns: point, image, valid, gap_px, gap_um, peak_px, valley_px, confidence, the strip statistics, then ok
+    /// (1 if the gap is within the limits of the point).
+    /// </summary>
+    /// <param name="filePath">Path to the CSV file.</param>
+    /// <returns>True if the file could be opened.</returns>
+    bool setMeasurementLog(const std::string& filePath);
+
+    /// <summary>
+    /// Get the number of points that failed since construction, including the result images that could not be written.
+    /// </summary>
+    /// <returns>The number of failed points.</returns>
+    int failedCount() const { return m_failed.load() + static_cast<int>(m_writer.stats().failed); }
+
+    /// <summary>
+    /// Get the back-pressure and throughput counters of the result images.
+    /// </summary>
+    ResultWriterStats resultStats() const { return m_writer.stats(); }
+
+    /// <summary>
+    /// Get the number of points judged NG (gap not found or outside the limits) since construction.
+    /// </summary>
+    /// <returns>The number of NG points.</returns>
+    int ngCount() const { return m_ng.load(); }
+
+    /// <summary>
+    /// Get the counters of the tracked edge search.
+    /// </summary>
+    EdgeTrackerStats trackerStats() const { return m_tracker.stats(); }
+
+private:
+    unsigned int m_maxInFlight;
+    unsigned int m_inFlight = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_slotFree;
+    std::atomic<int> m_failed{ 0 };
+    std::atomic<int> m_ng{ 0 };
+    std::atomic<unsigned long long> m_cells{ 0 };
+    std::mutex m_logMutex;
+    std::ofstream m_log;
+    EdgeTracker m_tracker;
+    ResultWriter m_writer;
+    ThreadPool m_pool; // Declared last: the workers must stop before the members above are destroyed.
+
+    /// <summary>
+    /// Queue one inspection point of the given cell, on its image file or on a frame already in memory.
+    /// </summary>
+    void enqueue(const InspectionPoint& point, unsigned long long cellIndex, const cv::Mat& frame = cv::Mat());
+
+    /// <summary>
+    /// Measure one point, log it and queue its result image if the annotation policy asks for it. Runs on a worker thread.
+    /// </summary>
+    /// <param name="point">The inspection point.</param>
+    /// <param name="cellIndex">The index of the cell the point belongs to, for AnnotationPolicy::EVERY_N.</param>
+    /// <param name="frame">The raw frame, or empty to load point.imagePath.</param>
+    void process(const InspectionPoint& point, unsigned long long cellIndex, const cv::Mat& frame);
+
+    /// <summary>
+    /// Append a measurement to the measurement log, if any.
+    /// </summary>
+    /// <param name="point">The inspection point.</param>
+    /// <param name="measurement">The measurement of the point.</param>
+    /// <param name="good">The judgement of the measurement.</param>
+    void logMeasurement(const InspectionPoint& point, const GapMeasurement& measurement, bool good);
+
+    /// <summary>
+    /// Release the in-flight slot held by a finished point.
+    /// </summary>
+    void releaseSlot();
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,80 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  EdgeTracker.h                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include "xvtLib.h"
+#include <map>
+#include <mutex>
+#include <string>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   Declaration                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Counters of the EdgeTracker since construction.
+/// </summary>
+struct EdgeTrackerStats
+{
+    unsigned long long tracked = 0;     // The measurements found by the tracked search.
+    unsigned long long fallbacks = 0;   // The measurements with a track that fell back to the full search.
+    unsigned long long searched = 0;    // The measurements without a track, searched in full.
+    unsigned long long lost = 0;        // The tracks dropped after an invalid or low-confidence measurement.
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Remembers the last accepted edge positions of each inspection point, so the next cell on the line only searches a
+/// window around them (InspectionParams::trackWindow). Only a measurement with a confidence of at least
+/// InspectionParams::trackMinConfidence updates the track; any other drops it, and the next cell is searched in full.
+/// Thread-safe: consecutive cells of a point may be measured concurrently, each one starting from the latest track.
+/// </summary>
+class EdgeTracker
+{
+public:
+    /// <summary>
+    /// Set the tracked positions of a point in its parameters, or clear them if the point has no track.
+    /// </summary>
+    /// <param name="point">The name of the inspection point.</param>
+    /// <param name="params">The kernel parameters of the point.</param>
+    void apply(const std::string& point, InspectionParams& params) const;
+
+    /// <summary>
+    /// Update the track of a point with its latest measurement.
+    /// </summary>
+    /// <param name="point">The name of the inspection point.</param>
+    /// <param name="params">The kernel parameters the point was measured with, as set by apply.</param>
+    /// <param name="measurement">The measurement.</param>
+    void update(const std::string& point, const InspectionParams& params, const GapMeasurement& measurement);
+
+    /// <summary>
+    /// Drop every track, e.g. when the line changes product.
+    /// </summary>
+    void reset();
+
+    /// <summary>
+    /// Get a snapshot of the counters.
+    /// </summary>
+    EdgeTrackerStats stats() const;
+
+private:
+    /// <summary>
+    /// The last accepted edges of a point, in ROI coordinates along the scan axis.
+    /// </summary>
+    struct Track
+    {
+        double peak = -1.0;
+        double valley = -1.0;
+    };
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, Track> m_tracks;
+    EdgeTrackerStats m_stats;
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
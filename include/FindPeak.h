@@ -0,0 +1,252 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    FindPeak.h                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include <algorithm>
+#include <span>
+#include <utility>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Find the peaks/valleys of the signal.
+/// </summary>
+class FindPeak
+{
+public:
+    /// <summary>
+    /// The mode of the FindPeak class.
+    /// </summary>
+    enum class Mode
+    {
+        PEAK,   // Find the peaks.
+        VALLEY  // Find the valleys.
+    };
+
+    /// <summary>
+    /// The peak information.
+    /// </summary>
+    struct PeakInfo
+    {
+        int position; // The position of the peak/valley.
+        double value; // The value of the peak/valley.
+    };
+
+    /// <summary>
+    /// Scratch buffers of run. Reuse one per thread: once grown to the longest signal, run does not allocate.
+    /// </summary>
+    struct Workspace
+    {
+        std::vector<double> leftBase;                   // The prominence base on the left of each sample.
+        std::vector<double> rightBase;                  // The prominence base on the right of each sample.
+        std::vector<std::pair<int, double>> stack;      // The monotonic stack of the base computation.
+        std::vector<unsigned char> blocked;             // The positions blocked by the selected peaks.
+        int extrema = 0;                                // The local extrema found by the last run.
+        int prominent = 0;                              // The extrema of the last run passing the prominence filter.
+    };
+
+    /// <summary>
+    /// Constructor of the FindPeak class.
+    /// </summary>
+    /// <param name="mode">The mode of the FindPeak class.</param>
+    /// <param name="minDistance">The minimum distance between the peaks/valleys.</param>
+    /// <param name="minProminence">The minimum prominence of the peaks/valleys.</param>
+    FindPeak(Mode mode = Mode::PEAK, double minDistance = 0.0, int minProminence = 1) : m_mode(mode), m_minDistance(static_cast<int>(minDistance)), m_minProminence(minProminence) {}
+
+    /// <summary>
+    /// Set the mode of the FindPeak class.
+    /// </summary>
+    /// <param name="mode">The mode of the FindPeak class.</param>
+    void setMode(Mode mode) { m_mode = mode; }
+
+    /// <summary>
+    /// Set the minimum distance between the peaks/valleys.
+    /// </summary>
+    /// <param name="minDistance">The minimum distance between the peaks/valleys.</param>
+    void setMinDistance(int minDistance) { m_minDistance = minDistance; }
+
+    /// <summary>
+    /// Set the minimum prominence of the peaks/valleys.
+    /// </summary>
+    /// <param name="minProminence">The minimum prominence of the peaks/valleys.</param>
+    void setMinProminence(double minProminence) { m_minProminence = minProminence; }
+
+    /// <summary>
+    /// Find the peaks/valleys of the signal with the mode set on the object.
+    /// </summary>
+    /// <param name="signal"></param>
+    /// <returns>The peaks/valleys of the signal.</returns>
+    std::vector<PeakInfo> run(const std::vector<double>& signal);
+
+    /// <summary>
+    /// Find the peaks/valleys of the signal without allocating. The mode is the template argument, not the one set on
+    /// the object.
+    /// </summary>
+    /// <typeparam name="M">The mode: peaks or valleys.</typeparam>
+    /// <typeparam name="T">The sample type (e.g. float, double, uint16_t).</typeparam>
+    /// <param name="signal">The signal to be processed.</param>
+    /// <param name="peaks">Receives the peaks/valleys sorted by position. Its capacity is reused.</param>
+    /// <param name="workspace">The scratch buffers.</param>
+    template <Mode M, typename T>
+    void run(std::span<const T> signal, std::vector<PeakInfo>& peaks, Workspace& workspace) const;
+
+private:
+    Mode m_mode;
+    int m_minDistance;
+    double m_minProminence;
+
+    /// <summary>
+    /// Compare two samples in the order of the mode: greater for peaks, smaller for valleys.
+    /// </summary>
+    template <Mode M, typename T>
+    static constexpr bool higher(T a, T b) { if constexpr (M == Mode::PEAK) return a > b; else return a < b; }
+
+    /// <summary>
+    /// Find the local extrema of the signal.
+    /// </summary>
+    /// <param name="signal">The signal to be processed.</param>
+    /// <param name="extrema">Receives the local extrema of the signal.</param>
+    template <Mode M, typename T>
+    static void findLocalExtrema(std::span<const T> signal, std::vector<PeakInfo>& extrema);
+
+    /// <summary>
+    /// Apply the prominence filter to the signal.
+    /// </summary>
+    /// <param name="extrema">The local extrema of the signal.</param>
+    /// <param name="signal">The signal to be processed.</param>
+    /// <param name="workspace">The scratch buffers.</param>
+    template <Mode M, typename T>
+    void applyProminenceFilter(std::vector<PeakInfo>& extrema, std::span<const T> signal, Workspace& workspace) const;
+
+    /// <summary>
+    /// Apply the distance filter to the signal.
+    /// </summary>
+    /// <param name="extrema">The local extrema of the signal.</param>
+    /// <param name="signalLength">The length of the signal.</param>
+    /// <param name="workspace">The scratch buffers.</param>
+    template <Mode M>
+    void applyDistanceFilter(std::vector<PeakInfo>& extrema, int signalLength, Workspace& workspace) const;
+
+    /// <summary>
+    /// Sort the local extrema by position.
+    /// </summary>
+    /// <param name="extrema">The local extrema of the signal.</param>
+    static void sortByPosition(std::vector<PeakInfo>& extrema);
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                               Template Definition                                                                //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+template <FindPeak::Mode M, typename T>
+void FindPeak::run(std::span<const T> signal, std::vector<PeakInfo>& peaks, Workspace& workspace) const
+{
+    peaks.clear();
+    workspace.extrema = workspace.prominent = 0;
+    if (signal.size() < 3) return;
+
+    findLocalExtrema<M>(signal, peaks);
+    workspace.extrema = static_cast<int>(peaks.size());
+    applyProminenceFilter<M>(peaks, signal, workspace);
+    workspace.prominent = static_cast<int>(peaks.size());
+    applyDistanceFilter<M>(peaks, static_cast<int>(signal.size()), workspace);
+    sortByPosition(peaks);
+}
+
+template <FindPeak::Mode M, typename T>
+void FindPeak::findLocalExtrema(std::span<const T> s, std::vector<PeakInfo>& out)
+{
+    for (int i = 1; i < (int)s.size() - 1; ++i) {
+        if (higher<M>(s[i], s[i - 1]) && higher<M>(s[i], s[i + 1]))
+            out.push_back({ i, static_cast<double>(s[i]) });
+    }
+}
+
+template <FindPeak::Mode M, typename T>
+void FindPeak::applyProminenceFilter(std::vector<PeakInfo>& peaks, std::span<const T> s, Workspace& workspace) const
+{
+    if (peaks.empty()) return;
+
+    // The base on each side of a peak is the lowest sample between the peak and the nearest strictly higher sample
+    // (or the end of the signal). It is computed for every sample with a monotonic stack, which keeps the candidates for
+    // "nearest higher sample" in decreasing order together with the lowest sample of the run they close: O(n) in total.
+    auto lower = [](double a, double b) { return higher<M>(a, b) ? b : a; };
+
+    const int n = static_cast<int>(s.size());
+    workspace.leftBase.resize(n);
+    workspace.rightBase.resize(n);
+    auto& stack = workspace.stack;
+
+    auto scan = [&](int begin, int end, int step, double* base) {
+        stack.clear();
+        for (int i = begin; i != end; i += step) {
+            double runBase = static_cast<double>(s[i]);
+            while (!stack.empty() && !higher<M>(s[stack.back().first], s[i])) {
+                runBase = lower(runBase, stack.back().second);
+                stack.pop_back();
+            }
+            base[i] = runBase;
+            stack.emplace_back(i, runBase);
+        }
+    };
+    scan(0, n, 1, workspace.leftBase.data());
+    scan(n - 1, -1, -1, workspace.rightBase.data());
+
+    auto end = std::remove_if(peaks.begin(), peaks.end(), [&](const PeakInfo& p) {
+        double left = workspace.leftBase[p.position];
+        double right = workspace.rightBase[p.position];
+        double prominence = (M == Mode::PEAK)
+            ? p.value - std::max(left, right)
+            : std::min(left, right) - p.value;
+        return prominence < m_minProminence;
+    });
+    peaks.erase(end, peaks.end());
+}
+
+template <FindPeak::Mode M>
+void FindPeak::applyDistanceFilter(std::vector<PeakInfo>& peaks, int signalLength, Workspace& workspace) const
+{
+    if (peaks.empty()) return;
+
+    // sort by priority, ties broken by position so the result does not depend on the sort implementation
+    std::sort(peaks.begin(), peaks.end(),
+        [](const PeakInfo& a, const PeakInfo& b) {
+            if (a.value != b.value)
+                return higher<M>(a.value, b.value);
+            return a.position < b.position;
+        });
+
+    // A selected peak blocks every position closer than m_minDistance. Selected peaks are at least m_minDistance apart,
+    // so each position is marked at most twice and the filter is linear in the signal length.
+    auto& blocked = workspace.blocked;
+    blocked.assign(signalLength, 0);
+    size_t selected = 0;
+
+    for (const auto& p : peaks) {
+        if (blocked[p.position])
+            continue;
+
+        peaks[selected++] = p;
+        int first = std::max(0, p.position - m_minDistance + 1);
+        int last = std::min(signalLength - 1, p.position + m_minDistance - 1);
+        for (int i = first; i <= last; ++i)
+            blocked[i] = 1;
+    }
+
+    peaks.resize(selected);
+}
+
+inline void FindPeak::sortByPosition(std::vector<PeakInfo>& peaks)
+{
+    std::sort(peaks.begin(), peaks.end(),
+        [](const PeakInfo& a, const PeakInfo& b) {
+            return a.position < b.position;
+        });
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,242 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  FrameSource.h                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include "RawFrame.h"
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   Declaration                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// One frame delivered by a FrameSource.
+/// </summary>
+struct Frame
+{
+    std::string name;               // The frame name, e.g. "cell0042_P3". Matched against the image names of the recipe.
+    std::string origin;             // Where the frame came from, for the logs (a file path, "stdin#12", "shm:line1#12").
+    cv::Mat image;                  // The raw frame. (16UC1 or 8UC1)
+    unsigned long long sequence = 0;// The index of the frame in its source.
+};
+
+/// <summary>
+/// Result of FrameSource::next.
+/// </summary>
+enum class FrameStatus
+{
+    OK,         // A frame was delivered.
+    TIMEOUT,    // No frame within the timeout; call again.
+    END         // The source is exhausted or closed.
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// A stream of frames for the long-running mode. Implementations are used from a single thread.
+/// </summary>
+class FrameSource
+{
+public:
+    virtual ~FrameSource() = default;
+
+    /// <summary>
+    /// Wait for the next frame.
+    /// </summary>
+    /// <param name="frame">Receives the frame.</param>
+    /// <param name="timeoutMs">The longest time to wait, in milliseconds.</param>
+    /// <returns>OK with a frame, TIMEOUT if none arrived in time, END when the source is exhausted.</returns>
+    virtual FrameStatus next(Frame& frame, int timeoutMs) = 0;
+};
+
+/// <summary>
+/// Watches a directory and delivers every new image file (.tif, .tiff, .png, .bmp or .raw) once, in name order.
+/// A file is picked up when its size has not changed between two polls, so half-written files are skipped until the
+/// writer is done. The files present at start are delivered too, unless skipExisting is set. A file that disappears is
+/// forgotten, so a new file written under the same name later is delivered again.
+/// </summary>
+class DirectoryFrameSource : public FrameSource
+{
+public:
+    /// <summary>
+    /// Constructor of the DirectoryFrameSource class.
+    /// </summary>
+    /// <param name="directory">The directory to watch.</param>
+    /// <param name="pollMs">The polling period, in milliseconds.</param>
+    /// <param name="skipExisting">True to ignore the files already in the directory.</param>
+    explicit DirectoryFrameSource(const std::string& directory, int pollMs = 50, bool skipExisting = false);
+
+    FrameStatus next(Frame& frame, int timeoutMs) override;
+
+private:
+    std::string m_directory;
+    int m_pollMs;
+    unsigned long long m_sequence = 0;
+    std::set<std::string> m_done;               // Files already delivered (or skipped) and still in the directory.
+    std::map<std::string, uintmax_t> m_pending; // Files seen growing, with their size at the last poll.
+    std::set<std::string> m_ready;              // Files whose size is stable, waiting to be delivered.
+
+    /// <summary>
+    /// Scan the directory once and move the files with a stable size to m_ready.
+    /// </summary>
+    void poll();
+};
+
+/// <summary>
+/// Reads frames from a binary stream, typically stdin fed by the acquisition process. Each record is:
+///     uint32 nameLength, nameLength bytes of name, RawFrameHeader, rows * cols * elemSize bytes of pixels
+/// The source ends at the end of the stream, or at a corrupt record (bad header, or more than 256 MiB of pixels).
+/// </summary>
+class StreamFrameSource : public FrameSource
+{
+public:
+    /// <summary>
+    /// Constructor of the StreamFrameSource class.
+    /// </summary>
+    /// <param name="stream">The binary stream. Must outlive the source.</param>
+    /// <param name="label">The label of the stream in Frame::origin.</param>
+    /// <param name="fd">The file descriptor under the stream, polled so that next returns TIMEOUT when no record starts in
+    /// time. The stream must not read ahead of it (e.g. std::cin over an unbuffered stdin). -1 to block on the stream.</param>
+    explicit StreamFrameSource(std::istream& stream, const std::string& label = "stdin", int fd = -1);
+
+    /// <summary>
+    /// Read the next record. Without a file descriptor, or on Windows, blocks on the stream: the timeout is not applied.
+    /// </summary>
+    FrameStatus next(Frame& frame, int timeoutMs) override;
+
+private:
+    std::istream& m_stream;
+    std::string m_label;
+    int m_fd;
+    unsigned long long m_sequence = 0;
+};
+
+/// <summary>
+/// Write one record of the StreamFrameSource format.
+/// </summary>
+/// <param name="stream">The binary output stream.</param>
+/// <param name="name">The frame name.</param>
+/// <param name="image">The frame.</param>
+/// <returns>True if the record was written.</returns>
+bool writeFrameRecord(std::ostream& stream, const std::string& name, const cv::Mat& image);
+
+/// <summary>
+/// Single-producer, single-consumer ring of frames in POSIX shared memory (/dev/shm), between the acquisition process
+/// and the inspection. The consumer creates the ring, the producer opens it, pushes frames and closes it when done.
+/// Frames are copied in and out of the slots, so a slot is free again as soon as it has been read.
+/// Not available on Windows: create and open throw std::runtime_error there.
+/// </summary>
+class FrameRing
+{
+public:
+    /// <summary>
+    /// Layout of the shared memory: this header, then slotCount slots of slotBytes bytes.
+    /// A slot is a FrameRing::SlotHeader followed by the pixels.
+    /// </summary>
+    struct Header
+    {
+        char magic[4];                          // "XVTQ".
+        uint32_t version;                       // Layout version.
+        uint32_t slotCount;                     // The number of slots.
+        uint32_t reserved;
+        uint64_t slotBytes;                     // The size of a slot, header included.
+        std::atomic<uint64_t> head;             // The number of frames published by the producer.
+        std::atomic<uint64_t> tail;             // The number of frames released by the consumer.
+        std::atomic<uint32_t> closed;           // Set by the producer after its last frame.
+    };
+
+    /// <summary>
+    /// Header of a slot.
+    /// </summary>
+    struct SlotHeader
+    {
+        char name[64];                          // The frame name, NUL-terminated.
+        RawFrameHeader frame;                   // The frame geometry.
+    };
+
+    /// <summary>
+    /// Create a ring. A stale ring of the same name is replaced. The ring is unlinked when the creator is destroyed.
+    /// </summary>
+    /// <param name="name">The shared memory name, e.g. "/xvt_line1".</param>
+    /// <param name="slotCount">The number of slots.</param>
+    /// <param name="maxFrameBytes">The largest frame a slot can hold, in pixel bytes.</param>
+    static std::unique_ptr<FrameRing> create(const std::string& name, uint32_t slotCount, uint64_t maxFrameBytes);
+
+    /// <summary>
+    /// Open a ring created by another process.
+    /// </summary>
+    /// <param name="name">The shared memory name.</param>
+    static std::unique_ptr<FrameRing> open(const std::string& name);
+
+    ~FrameRing();
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    /// <summary>
+    /// Copy a frame into the next free slot (producer side).
+    /// </summary>
+    /// <param name="name">The frame name, truncated to 63 characters.</param>
+    /// <param name="image">The frame.</param>
+    /// <param name="timeoutMs">The longest time to wait for a free slot, in milliseconds. Negative waits forever.</param>
+    /// <returns>False if the frame is too large or no slot freed up in time.</returns>
+    bool push(const std::string& name, const cv::Mat& image, int timeoutMs = -1);
+
+    /// <summary>
+    /// Copy the oldest frame out of its slot and release the slot (consumer side).
+    /// </summary>
+    FrameStatus pop(Frame& frame, int timeoutMs);
+
+    /// <summary>
+    /// Mark the end of the stream (producer side). The consumer gets END after the remaining frames.
+    /// </summary>
+    void close();
+
+    /// <summary>
+    /// Get the shared memory name.
+    /// </summary>
+    const std::string& name() const { return m_name; }
+
+private:
+    std::string m_name;
+    void* m_memory = nullptr;
+    size_t m_size = 0;
+    bool m_owner = false;
+    unsigned long long m_sequence = 0;
+
+    FrameRing(const std::string& name, void* memory, size_t size, bool owner);
+    Header* header() const { return static_cast<Header*>(m_memory); }
+    unsigned char* slot(uint64_t index) const;
+};
+
+/// <summary>
+/// Delivers the frames of a FrameRing it creates, for a producer process to open.
+/// </summary>
+class SharedMemoryFrameSource : public FrameSource
+{
+public:
+    /// <summary>
+    /// Constructor of the SharedMemoryFrameSource class. Creates the ring.
+    /// </summary>
+    /// <param name="name">The shared memory name, e.g. "/xvt_line1".</param>
+    /// <param name="slotCount">The number of slots.</param>
+    /// <param name="maxFrameBytes">The largest frame a slot can hold, in pixel bytes.</param>
+    SharedMemoryFrameSource(const std::string& name, uint32_t slotCount = 8, uint64_t maxFrameBytes = 64ull << 20);
+
+    FrameStatus next(Frame& frame, int timeoutMs) override;
+
+private:
+    std::unique_ptr<FrameRing> m_ring;
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
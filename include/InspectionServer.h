@@ -0,0 +1,226 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                InspectionServer.h                                                                //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include "BatchInspector.h"
+#include "EdgeTracker.h"
+#include "RawFrame.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   Declaration                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Result of one request, in InspectionResponse::status.
+/// </summary>
+enum class InspectionStatus : uint32_t
+{
+    OK = 0,             // Measured; the gap fields are set (valid tells whether both edges were found).
+    UNKNOWN_POINT = 1,  // No inspection point of that name in the recipe of the server.
+    BAD_REQUEST = 2,    // Malformed header or pixels; the server closes the connection after it.
+    FAILED = 3          // The kernel threw; the message is in the server log.
+};
+
+/// <summary>
+/// Request of the inspection socket protocol: this header, then frame.rows * frame.cols * elemSize bytes of pixels.
+/// The pixels are usually the raw 16-bit ROI (plus some margin) of a frame, not the whole frame. Host byte order.
+/// </summary>
+struct InspectionRequest
+{
+    char magic[4] = { 'X', 'V', 'T', 'I' };    // Request signature.
+    uint32_t version = 1;                       // Protocol version.
+    uint64_t id = 0;                            // Echoed in the response, to match pipelined responses to requests.
+    char point[32] = {};                        // The name of the recipe point to run, NUL-terminated.
+    int32_t roi[4] = {};                        // x, y, width, height of the ROI in the pixels sent. Width 0: all of them.
+    RawFrameHeader frame;                       // The geometry of the pixels. (8UC1 or 16UC1)
+};
+static_assert(sizeof(InspectionRequest) == 96, "InspectionRequest must stay 96 bytes");
+
+/// <summary>
+/// Response of the inspection socket protocol. Responses of pipelined requests may come back out of order.
+/// Positions are in the coordinates of the ROI sent, as in GapMeasurement.
+/// </summary>
+struct InspectionResponse
+{
+    char magic[4] = { 'X', 'V', 'T', 'O' };    // Response signature.
+    uint32_t status = 0;                        // An InspectionStatus.
+    uint64_t id = 0;                            // The id of the request.
+    uint8_t valid = 0;                          // 1 if both edges were found.
+    uint8_t good = 0;                           // 1 if the gap is within the limits of the point.
+    uint8_t tracked = 0;                        // 1 if the edges were found by the tracked search.
+    uint8_t reserved = 0;
+    float processingMs = 0.0f;                  // The time from the request read to the response written, server side.
+    double gap = 0.0;                           // GapMeasurement::gap.
+    double gapUm = 0.0;                         // GapMeasurement::gapUm.
+    double peakPosition = 0.0;                  // GapMeasurement::peakPosition.
+    double valleyPosition = 0.0;                // GapMeasurement::valleyPosition.
+    double confidence = 0.0;                    // GapMeasurement::confidence.
+};
+static_assert(sizeof(InspectionResponse) == 64, "InspectionResponse must stay 64 bytes");
+
+/// <summary>
+/// Counters of the InspectionServer since construction.
+/// </summary>
+struct InspectionServerStats
+{
+    unsigned long long connections = 0;     // The clients accepted.
+    unsigned long long requests = 0;        // The requests read, malformed ones included.
+    unsigned long long failed = 0;          // The requests answered with a status other than OK.
+    unsigned long long bytesIn = 0;         // The request bytes read, headers included.
+    unsigned int maxPipeline = 0;           // The most requests in flight on one connection.
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Long-running inspection service on a Unix domain socket: clients send raw ROIs and get the measurements back, so
+/// neither the process start, the OpenCV initialization, the image codecs nor the disk are paid per image.
+/// Each connection has a reader thread; the requests it reads are measured on a shared worker pool and answered as soon
+/// as they are done, so a client can pipeline up to maxPipeline requests per connection. Not available on Windows:
+/// the constructor throws std::runtime_error there.
+/// </summary>
+class InspectionServer
+{
+public:
+    /// <summary>
+    /// Constructor of the InspectionServer class. Creates the socket; throws std::runtime_error on failure.
+    /// </summary>
+    /// <param name="points">The inspection points of the recipe. Requests name them; their ROI and registration are
+    /// replaced by the ROI of the request.</param>
+    /// <param name="socketPath">The path of the socket. A stale socket at that path is replaced; any other file, or the
+    /// socket of a live server, makes the constructor throw.</param>
+    /// <param name="numThreads">The number of worker threads. 0 uses all hardware threads.</param>
+    /// <param name="maxPipeline">The most requests in flight per connection; the reader stops reading beyond it.</param>
+    InspectionServer(const std::vector<InspectionPoint>& points, const std::string& socketPath, unsigned int numThreads = 0,
+                     unsigned int maxPipeline = 16);
+
+    /// <summary>
+    /// Destructor. Removes the socket.
+    /// </summary>
+    ~InspectionServer();
+
+    InspectionServer(const InspectionServer&) = delete;
+    InspectionServer& operator=(const InspectionServer&) = delete;
+
+    /// <summary>
+    /// Accept and serve clients until stop is set, then finish the requests in flight and close the connections.
+    /// </summary>
+    /// <param name="stop">Set from another thread or a signal handler to stop.</param>
+    void run(const std::atomic<bool>& stop);
+
+    /// <summary>
+    /// Get a snapshot of the counters.
+    /// </summary>
+    InspectionServerStats stats() const;
+
+    /// <summary>
+    /// Get the counters of the tracked edge search.
+    /// </summary>
+    EdgeTrackerStats trackerStats() const { return m_tracker.stats(); }
+
+private:
+    /// <summary>
+    /// A client connection, shared by its reader thread and the requests in flight.
+    /// </summary>
+    struct Connection
+    {
+        int fd = -1;
+        std::thread reader;                 // Runs serve; joined by run once done is set.
+        std::atomic<bool> done{ false };    // The reader has finished and no request is in flight.
+        std::mutex mutex;                   // Serializes the responses and guards inFlight.
+        std::condition_variable slotFree;
+        unsigned int inFlight = 0;
+        bool broken = false;                // A response could not be written: stop reading.
+    };
+
+    std::vector<InspectionPoint> m_points;
+    std::string m_socketPath;
+    unsigned int m_maxPipeline;
+    int m_listenFd = -1;
+    mutable std::mutex m_statsMutex;
+    InspectionServerStats m_stats;
+    EdgeTracker m_tracker;
+    std::mutex m_connectionsMutex;
+    std::list<std::shared_ptr<Connection>> m_connections;
+    ThreadPool m_pool; // Declared last: the workers must stop before the members above are destroyed.
+
+    /// <summary>
+    /// Read the requests of a connection until it closes. Runs on the reader thread of the connection.
+    /// </summary>
+    void serve(std::shared_ptr<Connection> connection);
+
+    /// <summary>
+    /// Measure one request and write its response. Runs on a worker thread.
+    /// </summary>
+    void process(const std::shared_ptr<Connection>& connection, const InspectionRequest& request, const cv::Mat& pixels,
+                 std::chrono::steady_clock::time_point received);
+
+    /// <summary>
+    /// Write a response and release the pipeline slot of its request.
+    /// </summary>
+    void respond(const std::shared_ptr<Connection>& connection, const InspectionResponse& response);
+
+    /// <summary>
+    /// Join the readers of the connections that are done and close them. With every, stop reading on all of them first.
+    /// </summary>
+    void reap(bool every);
+};
+
+/// <summary>
+/// Client side of the inspection socket protocol. Used from a single thread; requests may be pipelined by sending
+/// several before receiving.
+/// </summary>
+class InspectionClient
+{
+public:
+    /// <summary>
+    /// Constructor of the InspectionClient class. Connects to the server; throws std::runtime_error on failure.
+    /// </summary>
+    /// <param name="socketPath">The path of the server socket.</param>
+    explicit InspectionClient(const std::string& socketPath);
+
+    /// <summary>
+    /// Destructor. Closes the connection.
+    /// </summary>
+    ~InspectionClient();
+
+    InspectionClient(const InspectionClient&) = delete;
+    InspectionClient& operator=(const InspectionClient&) = delete;
+
+    /// <summary>
+    /// Send one request.
+    /// </summary>
+    /// <param name="id">The id echoed in the response.</param>
+    /// <param name="point">The name of the recipe point, at most 31 characters.</param>
+    /// <param name="pixels">The ROI pixels. (8UC1 or 16UC1)</param>
+    /// <param name="ROI">The ROI in the pixels, or empty for all of them.</param>
+    /// <returns>False if the connection is closed.</returns>
+    bool send(uint64_t id, const std::string& point, const cv::Mat& pixels, const cv::Rect& ROI = cv::Rect());
+
+    /// <summary>
+    /// Block until the next response.
+    /// </summary>
+    /// <param name="response">Receives the response.</param>
+    /// <returns>False if the connection is closed or the response is malformed.</returns>
+    bool receive(InspectionResponse& response);
+
+private:
+    int m_fd = -1;
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
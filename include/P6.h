@@ -1,12 +1,48 @@
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 //                                                                      Include                                                                        //
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
 #include "xvtLib.h"
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 //                                                                   Declaration                                                                    //
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
-cv::Mat P6ImageProcessing(const cv::Mat image, cv::Rect ROI);
+/// <summary>
+/// Default parameters of the P6 processing.
+/// </summary>
+inline const InspectionParams P6_DEFAULT_PARAMS = { 20, 5.0, 4.0, Orientation::FROM_LEFT };
+
+/// <summary>
+/// Measure the gap of the P6 point without producing a result image.
+/// </summary>
+/// <param name="image">The image. (8UC1, or 16UC1 for the 16-bit path)</param>
+/// <param name="ROI">The ROI in the image.</param>
+/// <param name="params">The kernel parameters.</param>
+/// <param name="overlay">If not null, receives what the annotated result shows, for drawResult.</param>
+/// <returns>The measured gap.</returns>
+GapMeasurement P6Measure(const cv::Mat& image, cv::Rect ROI, const InspectionParams& params = P6_DEFAULT_PARAMS,
+                         ResultOverlay* overlay = nullptr);
+
+/// <summary>
+/// Measure the P6 gap of the same ROI in a batch of frames, e.g. the P6 image of N cells. The ROIs are filtered in parallel and
+/// each filtered ROI is copied into its slot of one contiguous stack (ProcessingContext::Buffer::BATCH), then the profiles and
+/// derivatives of the whole stack are computed in a single pass and the peak search and gap measurement run back to back on it.
+/// Same results as P6Measure on each frame: the pyramid search, and the tracked search when params has a track, run
+/// P6Measure frame by frame with the same params.
+/// </summary>
+/// <param name="images">The frames, all of the same size and type. (8UC1, or 16UC1 for the 16-bit path)</param>
+/// <param name="ROI">The ROI, the same in every frame.</param>
+/// <param name="params">The kernel parameters.</param>
+/// <param name="overlays">If not null, receives the overlay of each frame, for drawResult.</param>
+/// <returns>The measured gap of each frame.</returns>
+std::vector<GapMeasurement> P6MeasureBatch(std::span<const cv::Mat> images, cv::Rect ROI, const InspectionParams& params = P6_DEFAULT_PARAMS,
+                                           std::vector<ResultOverlay>* overlays = nullptr);
+
+/// <summary>
+/// Measure the gap of the P6 point and return the annotated result: P6Measure followed by drawResult.
+/// </summary>
+cv::Mat P6ImageProcessing(const cv::Mat image, cv::Rect ROI, const InspectionParams& params = P6_DEFAULT_PARAMS,
+                          GapMeasurement* measurement = nullptr);
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 //                                                                   End of file                                                                    //
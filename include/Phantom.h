@@ -0,0 +1,78 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Phantom.h                                                                     //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include <opencv2/opencv.hpp>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   Declaration                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Geometry and acquisition of a synthetic 16-bit X-ray phantom of the cell edge.
+/// Along the scan axis, from the inside of the cell outwards: the jelly roll (cathode layers), the separator gap, the anode
+/// overhang and the can wall. The gap is the distance between the separator/anode edge and the anode/can edge: the pair
+/// of edges P1 (FROM_BOTTOM) and P6 (FROM_LEFT) select. Positions are continuous: an edge at 100.0 lies on the centre of
+/// pixel 100, and the edges are blurred by a Gaussian point spread function, so the ground truth is sub-pixel.
+/// </summary>
+struct PhantomSpec
+{
+    int length = 512;               // The frame size along the scan axis, in pixels.
+    int width = 320;                // The frame size across the scan axis, in pixels.
+    bool columns = false;           // False: layers stacked along the rows (P1). True: along the columns (P6).
+    bool mirrored = false;          // True to flip the frame along the scan axis, for the FROM_TOP/FROM_RIGHT orientations.
+
+    double cathodeEnd = 160.0;      // The cathode/separator edge.
+    double separatorWidth = 20.0;   // The width of the separator gap.
+    double gap = 60.0;              // The ground truth: from the separator/anode edge to the anode/can edge.
+    double tiltDeg = 0.0;           // The rotation of the edges; the ground truth holds at the centre of the ROI.
+
+    double cathodeLevel = 30000.0;  // The intensity of the jelly roll, in 16-bit counts.
+    double separatorLevel = 18000.0;// The intensity of the separator gap.
+    double anodeLevel = 34000.0;    // The intensity of the anode overhang.
+    double canLevel = 9000.0;       // The intensity of the can wall.
+    double beamFalloff = 4000.0;    // The intensity ramp across the frame.
+    double layerContrast = 1500.0;  // The peak-to-peak contrast of the electrode layers.
+    double layerPeriod = 7.0;       // The layer period across the frame, in pixels.
+
+    double edgeBlur = 1.0;          // The sigma of the point spread function, in pixels.
+    double readNoise = 400.0;       // The sigma of the sensor noise, in counts.
+    double quantumGain = 0.0;       // The quantum noise: its variance is quantumGain * intensity.
+    double tornFraction = 0.0;      // The fraction of the columns (rows) where the separator is torn and the cathode meets the anode.
+
+    unsigned int seed = 0;          // The seed of the noise, the layer phase and the torn region.
+};
+
+/// <summary>
+/// A rendered phantom and its ground truth, in the coordinates of the frame.
+/// </summary>
+struct Phantom
+{
+    PhantomSpec spec;
+    cv::Mat image;                  // The frame. (16UC1)
+    cv::Rect ROI;                   // The ROI of the inspection: the whole gap plus some jelly roll and can wall.
+    double peakEdge = 0.0;          // The separator/anode edge along the scan axis, at the centre of the ROI.
+    double valleyEdge = 0.0;        // The anode/can edge along the scan axis, at the centre of the ROI.
+    double gap = 0.0;               // The ground-truth gap, in pixels.
+};
+
+/// <summary>
+/// Render a phantom.
+/// </summary>
+/// <param name="spec">The geometry and acquisition. Its edges must fit in the frame with room for the ROI.</param>
+/// <returns>The phantom.</returns>
+Phantom makePhantom(const PhantomSpec& spec);
+
+/// <summary>
+/// Draw a random phantom for an accuracy run: gap, separator width, tilt, blur, noise, layer contrast, torn separator
+/// and orientation vary within the range the production images cover.
+/// </summary>
+/// <param name="seed">The seed. The same seed gives the same phantom.</param>
+/// <param name="columns">True for a P6 phantom, false for a P1 phantom.</param>
+/// <param name="maxNoise">The largest read noise drawn, in counts.</param>
+/// <returns>The phantom geometry and acquisition.</returns>
+PhantomSpec randomPhantomSpec(unsigned int seed, bool columns, double maxNoise = 1200.0);
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,220 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Profiler.h                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                      Macros                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+// The kernels are instrumented with these macros only. They compile to nothing unless XVT_ENABLE_PROFILING is defined,
+// so the Profiler class itself is always available (e.g. to dump an empty report) but costs nothing when disabled.
+//
+//     XVT_PROFILE_POINT(name)              Attribute the samples of the current thread to an inspection point.
+//     XVT_PROFILE_STOPWATCH(sw)            Start a stopwatch named sw.
+//     XVT_PROFILE_LAP(sw, "stage")         Record the time since the previous lap of sw as "stage".
+//     XVT_PROFILE_COUNT("name", value)     Record one sample of a counter (extrema found, bytes allocated...).
+//
+// Stage and counter names must be string literals: the samples are keyed by their address.
+#define XVT_PROFILE_CONCAT_(a, b) a##b
+#define XVT_PROFILE_CONCAT(a, b) XVT_PROFILE_CONCAT_(a, b)
+
+#ifdef XVT_ENABLE_PROFILING
+#define XVT_PROFILE_POINT(name) ProfilePointScope XVT_PROFILE_CONCAT(xvtProfilePoint, __LINE__)(name)
+#define XVT_PROFILE_STOPWATCH(sw) ProfileStopwatch sw
+#define XVT_PROFILE_LAP(sw, stage) sw.lap(stage)
+#define XVT_PROFILE_COUNT(name, value) Profiler::instance().count(name, static_cast<double>(value))
+#else
+#define XVT_PROFILE_POINT(name) ((void)0)
+#define XVT_PROFILE_STOPWATCH(sw) ((void)0)
+#define XVT_PROFILE_LAP(sw, stage) ((void)0)
+#define XVT_PROFILE_COUNT(name, value) ((void)0)
+#endif
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Process-wide store of the stage timings and counters, aggregated per inspection point.
+///
+/// Timings go into fixed-bucket latency histograms, counters into min/max/sum summaries. Each thread records into its own
+/// store, keyed by the address of the name, under a lock that only the reports contend for; the stores are merged by name
+/// when a report is rendered. A sample costs a pointer hash and an uncontended lock, so the workers of a pool do not
+/// serialize on the profiler.
+/// </summary>
+class Profiler
+{
+public:
+    /// <summary>
+    /// Whether the kernels were compiled with XVT_ENABLE_PROFILING.
+    /// </summary>
+#ifdef XVT_ENABLE_PROFILING
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    /// <summary>
+    /// Upper bounds of the latency histogram buckets, in milliseconds. The last bucket is unbounded.
+    /// </summary>
+    static constexpr double BUCKET_BOUNDS_MS[] = { 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000 };
+    static constexpr int BUCKET_COUNT = static_cast<int>(std::size(BUCKET_BOUNDS_MS)) + 1;
+
+    /// <summary>
+    /// Latency histogram of one stage.
+    /// </summary>
+    struct Histogram
+    {
+        long long buckets[BUCKET_COUNT] = {};   // Non-cumulative sample counts per bucket.
+        long long count = 0;                    // The number of samples.
+        double sumMs = 0.0;                     // The sum of the samples.
+        double minMs = 0.0;                     // The smallest sample.
+        double maxMs = 0.0;                     // The largest sample.
+    };
+
+    /// <summary>
+    /// Summary of one counter.
+    /// </summary>
+    struct Counter
+    {
+        long long samples = 0;                  // The number of recorded values.
+        double sum = 0.0;                       // The sum of the values.
+        double min = 0.0;                       // The smallest value.
+        double max = 0.0;                       // The largest value.
+    };
+
+    /// <summary>
+    /// Get the process-wide profiler.
+    /// </summary>
+    static Profiler& instance();
+
+    /// <summary>
+    /// Record the duration of a stage for the inspection point of the calling thread.
+    /// </summary>
+    /// <param name="stage">The stage name, a string literal, e.g. "denoise".</param>
+    /// <param name="ms">The duration in milliseconds.</param>
+    void record(const char* stage, double ms);
+
+    /// <summary>
+    /// Record one value of a counter for the inspection point of the calling thread.
+    /// </summary>
+    /// <param name="name">The counter name, a string literal, e.g. "peak_extrema".</param>
+    /// <param name="value">The value.</param>
+    void count(const char* name, double value);
+
+    /// <summary>
+    /// Set the inspection point the samples of the calling thread are attributed to.
+    /// </summary>
+    /// <param name="point">The point name. Empty attributes the samples to "unnamed".</param>
+    static void setCurrentPoint(const std::string& point);
+
+    /// <summary>
+    /// Get the inspection point of the calling thread.
+    /// </summary>
+    static const std::string& currentPoint();
+
+    /// <summary>
+    /// Discard every sample, of every thread.
+    /// </summary>
+    void reset();
+
+    /// <summary>
+    /// Render the samples as a JSON document: { "enabled": ..., "points": { point: { "stages": ..., "counters": ... } } }.
+    /// </summary>
+    std::string toJson() const;
+
+    /// <summary>
+    /// Render the samples in the Prometheus text exposition format (xvt_stage_duration_ms histogram, xvt_counter summary).
+    /// </summary>
+    std::string toPrometheus() const;
+
+    /// <summary>
+    /// Write the report to a file: JSON if the path ends with ".json", Prometheus text otherwise.
+    /// </summary>
+    /// <param name="filePath">The output file. It is replaced.</param>
+    /// <returns>True if the file was written.</returns>
+    bool dump(const std::string& filePath) const;
+
+private:
+    struct PointStats
+    {
+        std::map<std::string, Histogram> stages;
+        std::map<std::string, Counter> counters;
+    };
+
+    struct ThreadStats; // The samples of one thread, defined in Profiler.cpp.
+
+    mutable std::mutex m_mutex;                             // Guards m_threads.
+    std::vector<std::shared_ptr<ThreadStats>> m_threads;    // Kept after their thread exits, for the reports.
+
+    Profiler() = default;
+
+    /// <summary>
+    /// Get the store of the calling thread, registered on its first sample.
+    /// </summary>
+    ThreadStats& threadStats();
+
+    /// <summary>
+    /// Merge the stores of every thread by point and name. Stages and counters without samples are left out.
+    /// </summary>
+    std::map<std::string, PointStats> merge() const;
+};
+
+/// <summary>
+/// Attributes the samples of the calling thread to an inspection point until the end of the scope.
+/// </summary>
+class ProfilePointScope
+{
+public:
+    explicit ProfilePointScope(const std::string& point) : m_previous(Profiler::currentPoint()) { Profiler::setCurrentPoint(point); }
+    ~ProfilePointScope() { Profiler::setCurrentPoint(m_previous); }
+
+    ProfilePointScope(const ProfilePointScope&) = delete;
+    ProfilePointScope& operator=(const ProfilePointScope&) = delete;
+
+private:
+    std::string m_previous;
+};
+
+/// <summary>
+/// Monotonic stopwatch recording consecutive stages of a kernel.
+/// </summary>
+class ProfileStopwatch
+{
+public:
+    ProfileStopwatch() : m_last(std::chrono::steady_clock::now()) {}
+
+    /// <summary>
+    /// Record the time since the previous lap (or the construction) as a stage and restart.
+    /// </summary>
+    /// <param name="stage">The stage name.</param>
+    void lap(const char* stage)
+    {
+        auto now = std::chrono::steady_clock::now();
+        Profiler::instance().record(stage, std::chrono::duration<double, std::milli>(now - m_last).count());
+        m_last = std::chrono::steady_clock::now(); // the recording itself is not charged to the next stage
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_last;
+};
+
+/// <summary>
+/// Percentile of a set of samples, interpolated linearly between the two closest ranks: p = 0 is the minimum, 100 the
+/// maximum. The benchmarks and the load tool report their latencies with it, so their p50/p99 are comparable.
+/// </summary>
+/// <param name="values">The samples, in any order.</param>
+/// <param name="p">The percentile, in [0, 100].</param>
+/// <returns>The percentile, or 0 if there are no samples.</returns>
+double percentile(std::vector<double> values, double p);
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,114 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    RawFrame.h                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include <opencv2/core.hpp>
+#include <cstdint>
+#include <string>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   Declaration                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Header of a raw frame file: the header is followed by rows * cols * elemSize bytes of pixels, rows contiguous.
+/// Little-endian, 32 bytes, so the pixel data starts aligned for any element type.
+/// </summary>
+struct RawFrameHeader
+{
+    char magic[4] = { 'X', 'V', 'T', 'R' };    // File signature.
+    uint32_t version = 1;                       // Format version.
+    int32_t rows = 0;                           // The number of rows.
+    int32_t cols = 0;                           // The number of columns.
+    int32_t type = 0;                           // The OpenCV type of the pixels (CV_8UC1, CV_16UC1, CV_8UC3...).
+    uint32_t headerSize = sizeof(RawFrameHeader);// Offset of the pixel data, for forward compatibility.
+    uint64_t reserved = 0;
+};
+static_assert(sizeof(RawFrameHeader) == 32, "RawFrameHeader must stay 32 bytes");
+
+/// <summary>
+/// Write an image as a raw frame: header and unencoded pixels.
+/// </summary>
+/// <param name="filePath">Path to the output file. It is replaced.</param>
+/// <param name="image">The image to be written.</param>
+/// <returns>The number of bytes written, 0 on error.</returns>
+size_t writeRawFrame(const std::string& filePath, const cv::Mat& image);
+
+/// <summary>
+/// Check whether a path names a raw frame file (.raw extension, any case).
+/// </summary>
+bool isRawFramePath(const std::string& filePath);
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// A raw frame file mapped read-only into memory. image() wraps the mapped pixels without copying or decoding, and
+/// the pages are only read from disk when touched: converting an ROI reads the rows of the ROI, not the whole frame.
+/// The mapping lives as long as the object, so every cv::Mat viewing image() must be released or cloned before it.
+/// </summary>
+class MappedRawFrame
+{
+public:
+    MappedRawFrame() = default;
+
+    /// <summary>
+    /// Constructor of the MappedRawFrame class. Same as open, but throws std::runtime_error on failure.
+    /// </summary>
+    /// <param name="filePath">Path to the raw frame file.</param>
+    explicit MappedRawFrame(const std::string& filePath);
+
+    ~MappedRawFrame();
+
+    MappedRawFrame(MappedRawFrame&& other) noexcept;
+    MappedRawFrame& operator=(MappedRawFrame&& other) noexcept;
+    MappedRawFrame(const MappedRawFrame&) = delete;
+    MappedRawFrame& operator=(const MappedRawFrame&) = delete;
+
+    /// <summary>
+    /// Map a raw frame file, replacing the current mapping.
+    /// </summary>
+    /// <param name="filePath">Path to the raw frame file.</param>
+    /// <returns>False if the file cannot be mapped or its header is invalid.</returns>
+    bool open(const std::string& filePath);
+
+    /// <summary>
+    /// Unmap the file. image() becomes empty.
+    /// </summary>
+    void close();
+
+    /// <summary>
+    /// Ask the OS to read ahead the pages holding a region, before it is converted, and not the rest of the frame: the
+    /// mapping is marked for random access. No-op where unsupported.
+    /// </summary>
+    /// <param name="region">The region of the frame.</param>
+    void prefetch(const cv::Rect& region) const;
+
+    /// <summary>
+    /// Ask the OS to read the whole frame ahead, in order, before it is converted or searched in full. No-op where
+    /// unsupported.
+    /// </summary>
+    void prefetchAll() const;
+
+    /// <summary>
+    /// Get the frame. A view on the mapped file, not a copy.
+    /// </summary>
+    const cv::Mat& image() const { return m_image; }
+
+    /// <summary>
+    /// Check whether a cv::Mat views the mapped memory, i.e. must be cloned to outlive this object.
+    /// </summary>
+    bool shares(const cv::Mat& image) const { return !m_image.empty() && image.datastart == m_image.datastart; }
+
+    bool empty() const { return m_image.empty(); }
+
+private:
+    void* m_memory = nullptr;
+    size_t m_size = 0;
+    cv::Mat m_image;
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
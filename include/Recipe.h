@@ -0,0 +1,93 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include "BatchInspector.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   Declaration                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// The inspection recipe of a cell model, parsed once at startup into a table of inspection points.
+/// </summary>
+struct Recipe
+{
+    std::string imageDir;               // The directory of the input images.
+    std::string resultDir;              // The directory of the result images.
+    unsigned int threads = 0;           // The number of worker threads. 0 uses all hardware threads.
+    unsigned int maxInFlight = 0;       // The maximum number of points in flight. 0 uses twice the number of workers.
+    int margin = -1;                    // Default InspectionPoint::margin. -1 converts and annotates the full frame.
+    int depth = CV_8U;                  // Default InspectionPoint::depth.
+    double clipPercent = 0.0;           // Default InspectionPoint::clipPercent.
+    double pixelSizeUm = 0.0;           // Default calibrated pixel size in micrometres, 0 if not calibrated.
+    std::string measurementLog;         // The CSV file receiving the measurements, empty for none.
+    std::string profileOutput;          // The file receiving the stage timings (.json or Prometheus text), empty for none.
+    AnnotationPolicy annotate = AnnotationPolicy::ALWAYS; // Default InspectionPoint::annotate.
+    int annotateEvery = 1;              // Default InspectionPoint::annotateEvery.
+    OutlineParams outline;              // Default InspectionPoint::outline.
+    ResultWriterOptions output;         // The encoding and queue of the result images.
+    std::vector<InspectionPoint> points;// The inspection points, in recipe order.
+};
+
+/// <summary>
+/// Load an inspection recipe.
+///
+/// The recipe is an INI-like text file. Keys before the first section are global, each [name] section is a point. '#' and ';'
+/// start a comment at the start of a line or after whitespace, so "/data/line#2" is a valid value:
+///     image_dir = D:/Quizz2/Image
+///     result_dir = D:/Quizz2/Result
+///     margin = 64                     # optional, convert only the ROI plus 64 px (default -1: full frame)
+///     bit_depth = 16                  # optional, 8 (default) or 16: depth the kernels process 16-bit frames at
+///     clip_percent = 0.1              # optional, % of pixels saturated at each end of the 16-bit stretch (default 0: min/max)
+///     pixel_size_um = 12.5            # optional, default 0 (gap reported in pixels only)
+///     measurement_log = result.csv    # optional, CSV of the measurements
+///     profile_output = profile.json   # optional, stage timings (.json, otherwise Prometheus text); needs XVT_ENABLE_PROFILING
+///     annotate = every 10             # optional, always (default), ng, never, or every N cells (and the NG parts)
+///     result_format = png             # optional, png (default), jpeg, raw or thumbnail
+///     png_compression = 1             # optional, 0-9, default 1
+///     jpeg_quality = 90               # optional, 0-100, default 90 (jpeg and thumbnail)
+///     thumbnail_size = 512            # optional, longest side of a thumbnail, default 512
+///     writer_threads = 1              # optional, encoder threads, default 1
+///     writer_queue = 16               # optional, results waiting to be written, default 16
+///     writer_drop = 0                 # optional, 1 drops results when the queue is full instead of waiting
+///     outline_decimation = 8          # optional, downsampling of the cell outline search, default 8
+///     outline_polarity = dark         # optional, dark (default) or bright: the cell against the background
+///     [P3]
+///     algorithm = P1                  # P1 (row profile) or P6 (column profile)
+///     roi = 2000, 500, 1000, 1500     # x, y, width, height
+///     reference_outline = 400, 300, 3200, 2000 # optional, cell outline of the frame the roi was taught on: the roi
+///                                     # then follows the cell outline of each frame (default: fixed roi)
+///     outline_decimation = 8          # optional, default the global decimation
+///     outline_polarity = dark         # optional, default the global polarity
+///     orientation = top               # top/bottom for P1, left/right for P6
+///     image = P3.tif                  # optional, default <name>.tif
+///     margin = 64                     # optional, default the global margin
+///     bit_depth = 16                  # optional, default the global bit depth
+///     clip_percent = 0.1              # optional, default the global clip percentage
+///     denoise = nlm                   # optional, nlm (default), gaussian, box, median or profile
+///     compare_nlm = 1                 # optional, also run nlm and report the gap/time difference
+///     pixel_size_um = 12.5            # optional, default the global pixel size
+///     strip_width = 100               # optional, also measure half-overlapping strips and reject torn ones
+///     pyramid_levels = 2              # optional, find the edges at 1/4 resolution, filter only bands around them (default 0)
+///     track_window = 8                # optional, search each edge within 8 px of the previous cell's (default 0: off)
+///     track_min_confidence = 4        # optional, confidence below which the tracked search falls back, default 4
+///     annotate = ng                   # optional, default the global policy
+///     gap_min = 40                    # optional, smallest good gap (um if the pixel size is set, else px), default 0
+///     gap_max = 120                   # optional, largest good gap, default none
+///     min_distance = 20               # optional, default of the algorithm
+///     peak_prominence = 5             # optional, default of the algorithm
+///     valley_prominence = 5           # optional, default of the algorithm
+/// </summary>
+/// <param name="filePath">Path to the recipe file.</param>
+/// <param name="overrides">Global key/value pairs applied after the file, e.g. { "image_dir", "/data/cell42" }.</param>
+/// <returns>The parsed recipe. Throws std::runtime_error with the offending line if the recipe is invalid.</returns>
+Recipe loadRecipe(const std::string& filePath,
+                const std::vector<std::pair<std::string, std::string>>& overrides = {});
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
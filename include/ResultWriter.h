@@ -0,0 +1,136 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  ResultWriter.h                                                                  //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include "xvtLib.h"
+#include "ThreadPool.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   Declaration                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Encoding of the result images.
+/// </summary>
+enum class ResultFormat
+{
+    PNG,        // Lossless PNG at ResultWriterOptions::pngCompression.
+    JPEG,       // JPEG at ResultWriterOptions::jpegQuality.
+    RAW,        // Unencoded BGR pixels behind a RawFrameHeader (.raw).
+    THUMBNAIL   // JPEG of the ROI plus a margin, scaled down to ResultWriterOptions::thumbnailSize.
+};
+
+/// <summary>
+/// Configuration of the ResultWriter.
+/// </summary>
+struct ResultWriterOptions
+{
+    ResultFormat format = ResultFormat::PNG;
+    int pngCompression = 1;         // 0 (none) to 9 (smallest, slowest). OpenCV's default is 3.
+    int jpegQuality = 90;           // 0 to 100.
+    int thumbnailSize = 512;        // The longest side of a thumbnail, in pixels.
+    int thumbnailMargin = 32;       // The margin kept around the ROI in a thumbnail, in pixels.
+    unsigned int threads = 1;       // The number of encoder threads.
+    unsigned int queueCapacity = 16;// The maximum number of results waiting to be written.
+    bool dropWhenFull = false;      // Drop a result instead of blocking the caller when the queue is full.
+};
+
+/// <summary>
+/// Back-pressure and throughput counters of the ResultWriter since construction.
+/// </summary>
+struct ResultWriterStats
+{
+    unsigned long long submitted = 0;   // The results accepted into the queue.
+    unsigned long long written = 0;     // The results written.
+    unsigned long long dropped = 0;     // The results dropped because the queue was full.
+    unsigned long long failed = 0;      // The results that could not be encoded or written.
+    unsigned long long blocked = 0;     // The submissions that had to wait for a free slot.
+    unsigned long long bytes = 0;       // The bytes written.
+    unsigned int maxQueueDepth = 0;     // The deepest the queue has been.
+    double blockedMs = 0.0;             // The total time callers waited for a free slot.
+    double renderMs = 0.0;              // The total time spent drawing the annotations.
+    double encodeMs = 0.0;              // The total time spent encoding.
+    double writeMs = 0.0;               // The total time spent writing the files.
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Renders, encodes and writes result images on its own threads, behind a bounded queue.
+/// The caller only hands over the measured image and its overlay, so neither the annotation nor the encoder nor the disk
+/// is on the measurement path. When the queue is full the caller blocks (back-pressure) or the result is dropped.
+/// </summary>
+class ResultWriter
+{
+public:
+    /// <summary>
+    /// Constructor of the ResultWriter class.
+    /// </summary>
+    /// <param name="options">The encoding and queue options.</param>
+    explicit ResultWriter(const ResultWriterOptions& options = ResultWriterOptions());
+
+    /// <summary>
+    /// Destructor. Writes the queued results.
+    /// </summary>
+    ~ResultWriter();
+
+    ResultWriter(const ResultWriter&) = delete;
+    ResultWriter& operator=(const ResultWriter&) = delete;
+
+    /// <summary>
+    /// Queue a result image.
+    /// </summary>
+    /// <param name="name">The name of the inspection point, for the error messages and the profiler.</param>
+    /// <param name="filePath">The output path. Its extension is replaced to match the format.</param>
+    /// <param name="image">The image the kernel measured. (8UC1 or 16UC1) It is shared, not copied: do not modify it afterwards.</param>
+    /// <param name="overlay">The overlay filled by the kernel.</param>
+    /// <returns>False if the result was dropped.</returns>
+    bool submit(const std::string& name, const std::string& filePath, const cv::Mat& image, const ResultOverlay& overlay);
+
+    /// <summary>
+    /// Block until every queued result has been written.
+    /// </summary>
+    void flush();
+
+    /// <summary>
+    /// Get the number of results waiting or being written.
+    /// </summary>
+    unsigned int queueDepth() const;
+
+    /// <summary>
+    /// Get a snapshot of the counters.
+    /// </summary>
+    ResultWriterStats stats() const;
+
+    /// <summary>
+    /// Get the options.
+    /// </summary>
+    const ResultWriterOptions& options() const { return m_options; }
+
+    /// <summary>
+    /// Get the output path of a result for a format: the extension of filePath is replaced.
+    /// </summary>
+    static std::string outputPath(const std::string& filePath, ResultFormat format);
+
+private:
+    ResultWriterOptions m_options;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_slotFree;
+    unsigned int m_queued = 0;
+    ResultWriterStats m_stats;
+    ThreadPool m_pool; // Declared last: the workers must stop before the members above are destroyed.
+
+    /// <summary>
+    /// Render, encode and write one result. Runs on an encoder thread. Does not throw: a failure is logged and counted.
+    /// </summary>
+    void write(const std::string& name, const std::string& filePath, const cv::Mat& image, const ResultOverlay& overlay);
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,70 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   ThreadPool.h                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 Class Definition                                                                 //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// Fixed-size pool of worker threads consuming a FIFO queue of tasks.
+/// </summary>
+class ThreadPool
+{
+public:
+    /// <summary>
+    /// Constructor of the ThreadPool class.
+    /// </summary>
+    /// <param name="numThreads">The number of worker threads. 0 uses std::thread::hardware_concurrency().</param>
+    explicit ThreadPool(unsigned int numThreads = 0);
+
+    /// <summary>
+    /// Destructor. Finishes the queued tasks and joins the workers.
+    /// </summary>
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// <summary>
+    /// Queue a task for execution on one of the workers.
+    /// </summary>
+    /// <param name="task">The task to be executed. The task must not throw.</param>
+    void submit(std::function<void()> task);
+
+    /// <summary>
+    /// Block until the queue is empty and no task is running.
+    /// </summary>
+    void wait();
+
+    /// <summary>
+    /// Get the number of worker threads.
+    /// </summary>
+    /// <returns>The number of worker threads.</returns>
+    unsigned int size() const { return static_cast<unsigned int>(m_workers.size()); }
+
+private:
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_taskAvailable;
+    std::condition_variable m_idle;
+    unsigned int m_running = 0;
+    bool m_stop = false;
+
+    /// <summary>
+    /// Worker loop: pop and run tasks until the pool is stopped.
+    /// </summary>
+    void workerLoop();
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -7,19 +7,149 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/opencv.hpp>
 #include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <span>
 #include <vector>
+#include "FindPeak.h"
+#include "Profiler.h"
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 //                                                                   Declaration                                                                    //
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 
 /// <summary>
-/// Load an image from a file.
+/// Ratio of the 16-bit to the 8-bit intensity scale (65535 / 255). 16-bit data is compared with the 8-bit thresholds and
+/// filter strengths through it.
+/// </summary>
+constexpr double U16_PER_U8 = 257.0;
+
+/// <summary>
+/// Direction in which a kernel scans its profile to pick the edges.
+/// </summary>
+enum class Orientation
+{
+    FROM_TOP,       // Scan the rows from the top of the ROI.
+    FROM_BOTTOM,    // Scan the rows from the bottom of the ROI.
+    FROM_LEFT,      // Scan the columns from the left of the ROI.
+    FROM_RIGHT      // Scan the columns from the right of the ROI.
+};
+
+/// <summary>
+/// Denoising applied to the ROI before the profile is extracted.
+/// </summary>
+enum class DenoiseMethod
+{
+    NLM,        // cv::fastNlMeansDenoising (reference, slowest).
+    GAUSSIAN,   // 7x7 Gaussian blur.
+    BOX,        // 7x7 box filter.
+    MEDIAN,     // 5x5 median filter.
+    PROFILE     // No 2-D filtering: smooth the 1-D profile instead.
+};
+
+/// <summary>
+/// Tunable parameters of an inspection kernel.
+/// </summary>
+struct InspectionParams
+{
+    int minDistance = 20;               // The minimum distance between the peaks/valleys of the derivative profile.
+    double peakProminence = 5.0;        // The minimum prominence of the peaks.
+    double valleyProminence = 5.0;      // The minimum prominence of the valleys.
+    Orientation orientation = Orientation::FROM_BOTTOM; // The side of the ROI the edges are searched from.
+    DenoiseMethod denoise = DenoiseMethod::NLM;         // The denoising backend.
+    double pixelSizeUm = 0.0;                           // The calibrated pixel size in micrometres, 0 if not calibrated.
+    int stripWidth = 0;                                 // If > 0, also measure strips of this width across the ROI.
+    int pyramidLevels = 0;                              // If > 0, search the edges on the ROI downsampled 2^levels times and
+                                                        // filter only bands around them at full resolution.
+    int trackWindow = 0;                                // If > 0 and the track is set, search each edge only within this many
+                                                        // pixels of its tracked position, filtering a band around it.
+    double trackMinConfidence = 4.0;                    // The confidence below which a tracked result falls back to the full search.
+    double trackPeak = -1.0;                            // The tracked peak in ROI coordinates along the scan axis, -1 if none.
+    double trackValley = -1.0;                          // The tracked valley, same coordinates. Both are set by an EdgeTracker.
+};
+
+/// <summary>
+/// Statistics of the gap measured independently on strips of the ROI. Strips whose gap is an outlier (torn or frayed
+/// separator) or whose edges are not found are rejected. Gaps are in pixels.
+/// </summary>
+struct StripStatistics
+{
+    int count = 0;              // The number of strips measured.
+    int accepted = 0;           // The number of strips kept after outlier rejection.
+    double minGap = 0.0;        // The smallest accepted gap.
+    double maxGap = 0.0;        // The largest accepted gap.
+    double medianGap = 0.0;     // The median accepted gap.
+};
+
+/// <summary>
+/// The gap measured by a kernel. Positions are sub-pixel, in ROI coordinates along the profile axis (rows for P1,
+/// columns for P6).
+/// </summary>
+struct GapMeasurement
+{
+    bool valid = false;         // True if both edges were found.
+    double peakPosition = 0.0;  // The position of the selected derivative peak.
+    double valleyPosition = 0.0;// The position of the selected derivative valley.
+    double gap = 0.0;           // The distance between the two edges in pixels. With strips, the median of the accepted strips.
+    double gapUm = 0.0;         // The distance between the two edges in micrometres, 0 if the pixel size is not calibrated.
+    double confidence = 0.0;    // Contrast-to-noise ratio of the weaker edge. Below about 3 the edge is hard to tell from noise.
+    bool tracked = false;       // True if the edges were found by the tracked search, around the positions of previous cells.
+    StripStatistics strips;     // The per-strip gaps, if InspectionParams::stripWidth > 0.
+};
+
+/// <summary>
+/// What a kernel draws on its result image, kept so the annotation can be rendered later (or not at all) from the
+/// measurement pass. Lines and rectangles are in ROI coordinates.
+/// </summary>
+struct ResultOverlay
+{
+    cv::Rect ROI;               // The ROI clipped to the image, in image coordinates.
+    bool rows = true;           // True if the edges are rows (P1), false if they are columns (P6).
+    int peakLine = -1;          // The row/column of the selected peak edge, -1 if not found.
+    int valleyLine = -1;        // The row/column of the selected valley edge, -1 if not found.
+    cv::Rect innerRect;         // The region beyond the innermost valley, empty if there is no valley.
+    int lineType = cv::LINE_8;  // The line type of the edges and the inner region.
+};
+
+/// <summary>
+/// Load an image from a file. A .raw frame file (see RawFrame.h) is memory-mapped instead of decoded.
 /// </summary>
 /// <param name="filePath">Path to the image file.</param>
 /// <returns>The loaded image. (8UC1)</returns>
 cv::Mat loadImage(const std::string& filePath);
 
+/// <summary>
+/// Load an image from a file and convert only the ROI plus a margin to 8-bit.
+/// The stretch uses the min/max of the cropped region, the rest of the frame is never converted.
+/// A .raw frame file is memory-mapped, so only the pages of the ROI plus margin are read from disk.
+/// </summary>
+/// <param name="filePath">Path to the image file.</param>
+/// <param name="ROI">The ROI in the frame. On return, the ROI in the coordinates of the returned crop.</param>
+/// <param name="margin">The number of pixels kept around the ROI on each side.</param>
+/// <returns>The ROI plus margin, clipped to the frame. (8UC1)</returns>
+cv::Mat loadImageROI(const std::string& filePath, cv::Rect& ROI, int margin = 32);
+
+/// <summary>
+/// Convert a frame already in memory the way loadImage converts a file: 16-bit frames are stretched to 8-bit.
+/// </summary>
+/// <param name="frame">The frame. (8UC1 or 16UC1)</param>
+/// <param name="depth">CV_8U to stretch 16-bit frames to 8-bit, CV_16U to stretch them over the full 16-bit range.</param>
+/// <param name="clipPercent">The percentage of pixels saturated at each end of the stretch, 0 for min/max.</param>
+/// <returns>The stretched frame. An 8-bit frame is returned as is, not copied. (8UC1 or 16UC1)</returns>
+cv::Mat convertFrame(const cv::Mat& frame, int depth = CV_8U, double clipPercent = 0.0);
+
+/// <summary>
+/// Convert only the ROI plus a margin of a frame already in memory, the way loadImageROI converts a file.
+/// </summary>
+/// <param name="frame">The frame. (8UC1 or 16UC1)</param>
+/// <param name="ROI">The ROI in the frame. On return, the ROI in the coordinates of the returned crop.</param>
+/// <param name="margin">The number of pixels kept around the ROI on each side.</param>
+/// <param name="depth">CV_8U to stretch 16-bit frames to 8-bit, CV_16U to stretch them over the full 16-bit range.</param>
+/// <param name="clipPercent">The percentage of pixels saturated at each end of the stretch, 0 for min/max.</param>
+/// <returns>The ROI plus margin, clipped to the frame. (8UC1 or 16UC1)</returns>
+cv::Mat convertFrameROI(const cv::Mat& frame, cv::Rect& ROI, int margin = 32, int depth = CV_8U, double clipPercent = 0.0);
+
 
 /// <summary>
 /// Refind the ROI of the image. Set the ROI to the image size if the ROI is out of the image size.
@@ -29,6 +159,38 @@ cv::Mat loadImage(const std::string& filePath);
 /// <returns>The refinded ROI.</returns>
 cv::Rect refindROI(const cv::Rect& ROI, const cv::Size& imageSize);
 
+/// <summary>
+/// Parameters of the cell outline detection that places the ROIs on each frame.
+/// </summary>
+struct OutlineParams
+{
+    int decimation = 8;             // The frame is downsampled this many times before the outline is searched.
+    bool darkCell = true;           // True if the cell absorbs more than the background, i.e. is darker in the frame.
+    double minAreaFraction = 0.05;  // The smallest outline accepted, as a fraction of the frame area.
+};
+
+/// <summary>
+/// Locate the outline of the cell on a decimated copy of the frame: area downsampling, Otsu threshold, largest blob.
+/// A few decimated pixels of accuracy are enough to place a ROI; the edges themselves are measured at full resolution.
+/// </summary>
+/// <param name="frame">The frame. (8UC1 or 16UC1)</param>
+/// <param name="params">The decimation and the polarity of the cell.</param>
+/// <param name="outline">Receives the bounding box of the cell in frame coordinates, empty if not found.</param>
+/// <returns>False if no blob large enough was found.</returns>
+bool locateCellOutline(const cv::Mat& frame, const OutlineParams& params, cv::Rect& outline);
+
+/// <summary>
+/// Place a ROI taught on a reference frame at the same position relative to the cell outline of the current frame.
+/// The ROI follows the centre of the outline, so a fixture offset moves the ROI with the cell instead of needing an
+/// oversized ROI to absorb it.
+/// </summary>
+/// <param name="ROI">The ROI taught on the reference frame.</param>
+/// <param name="reference">The cell outline of the reference frame.</param>
+/// <param name="outline">The cell outline of the current frame.</param>
+/// <param name="imageSize">The size of the current frame.</param>
+/// <returns>The placed ROI, clipped to the frame by refindROI. The taught ROI if either outline is empty.</returns>
+cv::Rect placeROI(const cv::Rect& ROI, const cv::Rect& reference, const cv::Rect& outline, const cv::Size& imageSize);
+
 /// <summary>
 /// Restore the 8-bit image to 16-bit image.
 /// </summary>
@@ -55,125 +217,377 @@ bool convert16To8bit(const cv::Mat& src16,
                     double& maxVal);
 
 /// <summary>
-/// Apply CLAHE to the image.
+/// Stretch a 16-bit image between two percentiles of its histogram, computed in one pass and walked over its min/max range
+/// only. A few hot or dead pixels then no longer set the contrast of the whole image, as they do with the min/max stretch
+/// of convert16To8bit.
 /// </summary>
-/// <param name="src">The image to be processed.</param>
-/// <param name="dst">The image after CLAHE.</param>
-/// <param name="clipLimit">The clip limit of the CLAHE.</param>
-/// <param name="tileGridSize">The tile grid size of the CLAHE.</param>
-void CLAHEOpenCV(const cv::Mat& src,
+/// <param name="src16">The image to be stretched. (16UC1)</param>
+/// <param name="dst">The stretched image, saturated outside the percentiles.</param>
+/// <param name="depth">CV_8U to stretch to 0..255, CV_16U to stretch to 0..65535.</param>
+/// <param name="clipPercent">The percentage of pixels saturated at each end. 0 uses the min/max.</param>
+/// <param name="lowVal">Receives the value mapped to 0.</param>
+/// <param name="highVal">Receives the value mapped to the top of the range.</param>
+/// <returns>False if the image is flat between the percentiles; dst is then left unchanged.</returns>
+bool normalizePercentile(const cv::Mat& src16,
+                    cv::Mat& dst,
+                    int depth,
+                    double clipPercent,
+                    double& lowVal,
+                    double& highVal);
+
+/// <summary>
+/// Denoise an image with the selected backend.
+/// </summary>
+/// <param name="src">The image to be denoised. (8UC1 or 16UC1; h is given for 8-bit data and scaled for 16-bit)</param>
+/// <param name="dst">The denoised image. Shares the data of src for DenoiseMethod::PROFILE.</param>
+/// <param name="method">The denoising backend.</param>
+/// <param name="h">The filter strength of the NLM backend.</param>
+void denoiseImage(const cv::Mat& src,
                 cv::Mat& dst,
-                double clipLimit = 3.0,
-                cv::Size tileGridSize = cv::Size(8, 8));
+                DenoiseMethod method,
+                float h);
 
 /// <summary>
-/// Draw double-headed arrow
+/// Reusable buffers of computeProfile. Keep one per thread: once grown to the largest ROI, computeProfile does not allocate.
 /// </summary>
-/// <param name="img">The image on which to draw the arrow.</param>
-/// <param name="p1">The starting point of the arrow.</param>
-/// <param name="p2">The ending point of the arrow.</param>
-/// <param name="color">The color of the arrow.</param>
-/// <param name="thickness">The thickness of the arrow lines (default = 2).</param>
-/// <param name="tipLength">The length of the arrow tips as a fraction of the arrow length (default = 0.05).</param>
-void drawDoubleArrow(const cv::Mat& img,
-                    cv::Point p1,
-                    cv::Point p2,
-                    cv::Scalar color,
-                    int thickness = 4,
-                    double tipLength = 0.1);
+struct ProfileWorkspace
+{
+    std::vector<unsigned int> sums;     // Column sums accumulated over the rows.
+    std::vector<double> profile;        // The averaged profile, in scan order.
+    std::vector<double> derivative;     // The 1st derivative of the profile, derivative[0] = 0.
+};
 
-//--------------------------------------------------------------------------------------------------------------------------------------------------//
-//                                                                   Class Definition                                                               //
-//--------------------------------------------------------------------------------------------------------------------------------------------------//
+/// <summary>
+/// Buffers of the coarse-to-fine (pyramid) edge search, also used by the tracked search.
+/// </summary>
+struct PyramidWorkspace
+{
+    ProfileWorkspace coarse;            // The profile of the downsampled ROI.
+    ProfileWorkspace band;              // The profile of the last refined band.
+    std::vector<double> derivative;     // The full-resolution derivative in scan order: refined inside the bands,
+                                        // interpolated from the coarse profile elsewhere (0 in the tracked search).
+    std::vector<double> bandSamples;    // The derivatives of the bands filtered so far, for the noise of the tracked search.
+};
 
 /// <summary>
-/// Find the peaks/valleys of the signal.
+/// Per-thread state of the inspection kernels, reused from call to call: the CLAHE instance, the intermediate images
+/// and the profile and peak-search buffers. The image buffers grow to the largest ROI seen and are handed out as views,
+/// so once every ROI size has been seen the kernels do not allocate any of them again.
+/// Not thread-safe: use local() to get the context of the calling thread.
 /// </summary>
-class FindPeak
+class ProcessingContext
 {
 public:
     /// <summary>
-    /// The mode of the FindPeak class.
-    /// </summary>
-    enum class Mode
-    {
-        PEAK,   // Find the peaks.
-        VALLEY  // Find the valleys.
-    };
-    
-    /// <summary>
-    /// The peak information.
+    /// The pooled intermediate images. Each kernel stage writes to its own slot, so the views do not overlap.
     /// </summary>
-    struct PeakInfo
+    enum class Buffer
     {
-        int position; // The position of the peak/valley.
-        double value; // The value of the peak/valley.
+        CLAHE,      // The contrast-enhanced ROI.
+        DENOISED,   // The denoised ROI.
+        BLURRED,    // The bilateral-filtered ROI.
+        FLOAT_SRC,  // The input of the bilateral filter on the 16-bit path. (32FC1)
+        FLOAT_DST,  // The output of the bilateral filter on the 16-bit path. (32FC1)
+        COARSE,     // The downsampled ROI of the pyramid search.
+        BATCH,      // The filtered ROIs of a batch, stacked along the rows.
+        COUNT
     };
 
     /// <summary>
-    /// Constructor of the FindPeak class.
+    /// Get the context of the calling thread.
     /// </summary>
-    /// <param name="mode">The mode of the FindPeak class.</param>
-    /// <param name="minDistance">The minimum distance between the peaks/valleys.</param>
-    /// <param name="minProminence">The minimum prominence of the peaks/valleys.</param>
-    FindPeak(Mode mode = Mode::PEAK, double minDistance = 0.0, int minProminence = 1) : m_mode(mode), m_minDistance(static_cast<int>(minDistance)), m_minProminence(minProminence) {}
+    static ProcessingContext& local();
 
     /// <summary>
-    /// Set the mode of the FindPeak class.
+    /// Get the CLAHE instance, created on the first call and reconfigured only when the parameters change.
     /// </summary>
-    /// <param name="mode">The mode of the FindPeak class.</param>
-    void setMode(Mode mode) { m_mode = mode; }
+    /// <param name="clipLimit">The clip limit of the CLAHE.</param>
+    /// <param name="tileGridSize">The tile grid size of the CLAHE.</param>
+    cv::CLAHE& clahe(double clipLimit, cv::Size tileGridSize);
 
     /// <summary>
-    /// Set the minimum distance between the peaks/valleys.
+    /// Get a pooled image of a given size and type. The pool grows when the size or type does not fit.
     /// </summary>
-    /// <param name="minDistance">The minimum distance between the peaks/valleys.</param>
-    void setMinDistance(int minDistance) { m_minDistance = minDistance; }
+    /// <param name="slot">The buffer slot.</param>
+    /// <param name="size">The size of the image.</param>
+    /// <param name="type">The OpenCV type of the image.</param>
+    /// <returns>A view of size `size` into the pooled buffer. Valid until the slot is requested again.</returns>
+    cv::Mat buffer(Buffer slot, cv::Size size, int type);
 
     /// <summary>
-    /// Set the minimum prominence of the peaks/valleys.
+    /// Get the total number of bytes the image pool has allocated since construction.
     /// </summary>
-    /// <param name="minProminence">The minimum prominence of the peaks/valleys.</param>
-    void setMinProminence(double minProminence) { m_minProminence = minProminence; }
+    size_t allocatedBytes() const { return m_allocatedBytes; }
 
-    /// <summary>
-    /// Find the peaks/valleys of the signal.
-    /// </summary>
-    /// <param name="signal"></param>
-    /// <returns>The peaks/valleys of the signal.</returns>
-    std::vector<PeakInfo> run(const std::vector<double>& signal);
+    ProfileWorkspace profile;                       // The buffers of computeProfile.
+    FindPeak::Workspace peakWorkspace;              // The buffers of FindPeak::run.
+    std::vector<FindPeak::PeakInfo> peaks;          // The peaks of the last search.
+    std::vector<FindPeak::PeakInfo> valleys;        // The valleys of the last search.
+    std::vector<unsigned int> histogram;            // The 4 interleaved 16-bit histograms of normalizePercentile, zero between calls.
+    PyramidWorkspace pyramid;                       // The buffers of the pyramid search.
 
 private:
-    Mode m_mode;
-    int m_minDistance;
-    double m_minProminence;
+    cv::Ptr<cv::CLAHE> m_clahe;
+    double m_clipLimit = 0.0;
+    cv::Size m_tileGridSize;
+    cv::Mat m_buffers[static_cast<int>(Buffer::COUNT)];
+    size_t m_allocatedBytes = 0;
+};
 
-    /// <summary>
-    /// Find the local extrema of the signal.   
-    /// </summary>
-    /// <param name="signal">The signal to be processed.</param>
-    /// <returns>The local extrema of the signal.</returns>
-    std::vector<PeakInfo> findLocalExtrema(const std::vector<double>& signal);
+/// <summary>
+/// Average an image along one axis and compute the 1st derivative of the profile in a single pass over the rows.
+/// Same result as cv::reduce(REDUCE_AVG, CV_64F) followed by a backward difference, without the intermediate Mats.
+/// </summary>
+/// <param name="src">The image to be reduced. (8UC1 or 16UC1; a 16-bit profile is divided by 257, so it keeps the 8-bit
+/// scale of the prominence thresholds with the 16-bit precision)</param>
+/// <param name="dim">0 to average each column (profile along x), 1 to average each row (profile along y).</param>
+/// <param name="reverse">True to store the profile from the last column/row to the first.</param>
+/// <param name="workspace">Receives the profile and its derivative.</param>
+/// <param name="smoothKernelSize">If > 0, the profile is smoothed with smoothProfile before the derivative.</param>
+void computeProfile(const cv::Mat& src,
+                int dim,
+                bool reverse,
+                ProfileWorkspace& workspace,
+                int smoothKernelSize = 0);
 
-    /// <summary>
-    /// Apply the prominence filter to the signal.
-    /// </summary>
-    /// <param name="extrema">The local extrema of the signal.</param>
-    /// <param name="signal">The signal to be processed.</param>
-    void applyProminenceFilter(std::vector<PeakInfo>& extrema, const std::vector<double>& signal);
+/// <summary>
+/// computeProfile over a batch of same-sized images stacked along the rows, in one pass over the stack.
+/// The profiles and derivatives are stored one after the other: image t at [t * length, (t + 1) * length).
+/// </summary>
+/// <param name="src">The images stacked along the rows: image t covers the rows [t * rows, (t + 1) * rows). (8UC1 or 16UC1)</param>
+/// <param name="count">The number of images. src.rows must be a multiple of it.</param>
+/// <param name="dim">0 to average each column of each image, 1 to average each row.</param>
+/// <param name="reverse">True to store each profile from its last column/row to its first.</param>
+/// <param name="workspace">Receives the profiles and their derivatives, derivative[t * length] = 0.</param>
+/// <param name="smoothKernelSize">If > 0, each profile is smoothed like smoothProfile before the derivative.</param>
+void computeProfileBatch(const cv::Mat& src,
+                int count,
+                int dim,
+                bool reverse,
+                ProfileWorkspace& workspace,
+                int smoothKernelSize = 0);
 
-    /// <summary>
-    /// Apply the distance filter to the signal.
-    /// </summary>
-    /// <param name="extrema">The local extrema of the signal.</param>
-    void applyDistanceFilter(std::vector<PeakInfo>& extrema);
+/// <summary>
+/// Refine the position of a peak/valley to sub-pixel precision with a parabola through the sample and its two neighbours.
+/// </summary>
+/// <param name="signal">The signal.</param>
+/// <param name="position">The position of the peak/valley.</param>
+/// <returns>The vertex of the parabola, within half a sample of position.</returns>
+double refinePeakPosition(std::span<const double> signal, int position);
 
-    /// <summary>
-    /// Sort the local extrema by position.
-    /// </summary>
-    /// <param name="extrema">The local extrema of the signal.</param>
-    void sortByPosition(std::vector<PeakInfo>& extrema);
-};
+/// <summary>
+/// Measure the gap between a derivative peak and valley, refined to sub-pixel precision.
+/// </summary>
+/// <param name="derivative">The derivative profile, in scan order.</param>
+/// <param name="peakIndex">The index of the selected peak in the derivative profile.</param>
+/// <param name="valleyIndex">The index of the selected valley in the derivative profile.</param>
+/// <param name="reversed">True if the profile was reversed (scan from the bottom/right side of the ROI).</param>
+/// <param name="pixelSizeUm">The calibrated pixel size in micrometres, 0 if not calibrated.</param>
+/// <param name="measurement">Receives the measurement in ROI coordinates.</param>
+/// <param name="noiseSigma">The noise of the derivative for the confidence, or negative to estimate it from `derivative`.</param>
+void measureGap(std::span<const double> derivative,
+                int peakIndex,
+                int valleyIndex,
+                bool reversed,
+                double pixelSizeUm,
+                GapMeasurement& measurement,
+                double noiseSigma = -1.0);
+
+/// <summary>
+/// Estimate the noise of a derivative profile from its mean absolute deviation.
+/// </summary>
+/// <param name="derivative">The derivative profile.</param>
+/// <returns>The standard deviation of the noise, assuming it is Gaussian.</returns>
+double derivativeNoise(std::span<const double> derivative);
+
+/// <summary>
+/// Estimate the noise of derivative samples from their median absolute deviation, which the few large samples of an edge
+/// do not inflate. Used where the samples are dominated by the edges, e.g. the narrow bands of the tracked search.
+/// </summary>
+/// <param name="samples">The derivative samples. Reordered.</param>
+/// <returns>The standard deviation of the noise, assuming it is Gaussian.</returns>
+double robustDerivativeNoise(std::span<double> samples);
+
+/// <summary>
+/// Measure the gap on overlapping strips of a filtered ROI and reject the outlier strips.
+/// Strips are params.stripWidth wide and overlap by half. Their profiles come from sums over half-strip blocks accumulated
+/// in one pass over the image, so all strips together cost about as much as a single profile.
+/// </summary>
+/// <param name="src">The filtered ROI. (8UC1 or 16UC1, scaled as in computeProfile)</param>
+/// <param name="dim">The profile axis as in computeProfile: 0 for a profile along x (strips are bands of rows),
+/// 1 for a profile along y (strips are bands of columns).</param>
+/// <param name="reverse">True to scan the profiles from the end, as in computeProfile.</param>
+/// <param name="params">The kernel parameters.</param>
+/// <param name="peakFromEnd">True to select the last peak of each profile in scan order, false for the first.</param>
+/// <param name="valleyFromEnd">True to select the last valley of each profile in scan order, false for the first.</param>
+/// <param name="measurement">Receives the strip statistics. Its gap, gapUm and valid are replaced by the median of the
+/// accepted strips, so a torn region of the separator does not bias the reported gap nor the OK/NG verdict.</param>
+void measureStrips(const cv::Mat& src,
+                int dim,
+                bool reverse,
+                const InspectionParams& params,
+                bool peakFromEnd,
+                bool valleyFromEnd,
+                GapMeasurement& measurement);
+
+/// <summary>
+/// The local filters of a kernel (denoising, bilateral...), run by the pyramid search on the coarse ROI and on each band.
+/// A filter that depends on the whole image, like CLAHE, does not belong here: its result on a band a few dozen pixels
+/// wide differs from the full ROI's. Run it on the ROI before the search and pass its result as src.
+/// Returns the filtered image, which may be a pooled buffer of the ProcessingContext.
+/// </summary>
+using BandFilter = std::function<cv::Mat(const cv::Mat&)>;
+
+/// <summary>
+/// Coarse stage of the pyramid search: downsample the ROI 2^params.pyramidLevels times (area average), filter it, and find
+/// the candidate peaks and valleys of its derivative profile. The candidates go to context.peaks and context.valleys with
+/// full-resolution scan positions, and context.pyramid.derivative receives the coarse derivative at full resolution.
+/// </summary>
+/// <param name="src">The ROI, before the band filter. (8UC1 or 16UC1)</param>
+/// <param name="dim">The profile axis as in computeProfile.</param>
+/// <param name="reverse">True to scan the profile from the end, as in computeProfile.</param>
+/// <param name="params">The kernel parameters. minDistance is scaled to the coarse profile.</param>
+/// <param name="filter">The local filters of the kernel.</param>
+/// <param name="context">The processing context.</param>
+void pyramidCoarseSearch(const cv::Mat& src,
+                int dim,
+                bool reverse,
+                const InspectionParams& params,
+                const BandFilter& filter,
+                ProcessingContext& context);
+
+/// <summary>
+/// Fine stage of the pyramid search: filter a narrow band of the full-resolution ROI around a coarse candidate, and
+/// locate the extremum of its derivative. The band derivative is written into context.pyramid.derivative, so
+/// measureGap can refine the result to sub-pixel precision as on the full-resolution path.
+/// </summary>
+/// <param name="src">The ROI, before the band filter. (8UC1 or 16UC1)</param>
+/// <param name="dim">The profile axis as in computeProfile.</param>
+/// <param name="reverse">True to scan the profile from the end, as in computeProfile.</param>
+/// <param name="position">The full-resolution scan position of the coarse candidate.</param>
+/// <param name="mode">PEAK to locate the maximum of the derivative, VALLEY the minimum.</param>
+/// <param name="params">The kernel parameters.</param>
+/// <param name="filter">The local filters of the kernel.</param>
+/// <param name="context">The processing context.</param>
+/// <returns>The full-resolution scan position of the edge.</returns>
+int pyramidRefine(const cv::Mat& src,
+                int dim,
+                bool reverse,
+                int position,
+                FindPeak::Mode mode,
+                const InspectionParams& params,
+                const BandFilter& filter,
+                ProcessingContext& context);
+
+/// <summary>
+/// Filter a band of the full-resolution ROI and locate the extremum of its derivative within halfWidth of a position.
+/// The searched derivative samples and their two neighbours are written into context.pyramid.derivative, and the whole
+/// band derivative is appended to context.pyramid.bandSamples. Used by pyramidRefine and by the tracked search.
+/// </summary>
+/// <param name="src">The ROI, before the band filter. (8UC1 or 16UC1)</param>
+/// <param name="dim">The profile axis as in computeProfile.</param>
+/// <param name="reverse">True to scan the profile from the end, as in computeProfile.</param>
+/// <param name="position">The scan position around which to search.</param>
+/// <param name="halfWidth">The search reaches position - halfWidth to position + halfWidth.</param>
+/// <param name="mode">PEAK to locate the maximum of the derivative, VALLEY the minimum.</param>
+/// <param name="params">The kernel parameters.</param>
+/// <param name="filter">The local filters of the kernel.</param>
+/// <param name="context">The processing context. context.pyramid.derivative must hold one sample per scan position.</param>
+/// <returns>The scan position of the extremum.</returns>
+int refineEdgeInBand(const cv::Mat& src,
+                int dim,
+                bool reverse,
+                int position,
+                int halfWidth,
+                FindPeak::Mode mode,
+                const InspectionParams& params,
+                const BandFilter& filter,
+                ProcessingContext& context);
+
+/// <summary>
+/// Tracked search: find the two edges only within params.trackWindow of their tracked positions, filtering one band
+/// around each, and measure the gap. The confidence uses the noise of the bands. The result is rejected when an edge
+/// lies on the border of its window (it moved further) or the confidence is below params.trackMinConfidence.
+/// </summary>
+/// <param name="src">The ROI, before the band filter. (8UC1 or 16UC1)</param>
+/// <param name="dim">The profile axis as in computeProfile.</param>
+/// <param name="reverse">True to scan the profile from the end, as in computeProfile.</param>
+/// <param name="params">The kernel parameters, with trackWindow, trackPeak and trackValley set.</param>
+/// <param name="filter">The local filters of the kernel.</param>
+/// <param name="context">The processing context. context.pyramid.derivative receives the derivative inside the bands.</param>
+/// <param name="peakIndex">Receives the scan position of the peak.</param>
+/// <param name="valleyIndex">Receives the scan position of the valley.</param>
+/// <param name="measurement">Receives the measurement, with tracked set.</param>
+/// <returns>True if the tracked result is accepted; false to run the full search.</returns>
+bool trackEdges(const cv::Mat& src,
+                int dim,
+                bool reverse,
+                const InspectionParams& params,
+                const BandFilter& filter,
+                ProcessingContext& context,
+                int& peakIndex,
+                int& valleyIndex,
+                GapMeasurement& measurement);
+
+/// <summary>
+/// Smooth a 1-D profile in place with a Gaussian kernel. Used by DenoiseMethod::PROFILE.
+/// </summary>
+/// <param name="profile">The profile to be smoothed.</param>
+/// <param name="kernelSize">The size of the Gaussian kernel (odd).</param>
+void smoothProfile(std::vector<double>& profile, int kernelSize = 7);
+
+/// <summary>
+/// Apply CLAHE to the image with the CLAHE instance of the calling thread's ProcessingContext.
+/// </summary>
+/// <param name="src">The image to be processed.</param>
+/// <param name="dst">The image after CLAHE.</param>
+/// <param name="clipLimit">The clip limit of the CLAHE.</param>
+/// <param name="tileGridSize">The tile grid size of the CLAHE.</param>
+void CLAHEOpenCV(const cv::Mat& src,
+                cv::Mat& dst,
+                double clipLimit = 3.0,
+                cv::Size tileGridSize = cv::Size(8, 8));
+
+/// <summary>
+/// Apply CLAHE to the image with the CLAHE instance of a context. A 16-bit image is equalized in 16-bit, without an 8-bit
+/// round trip.
+/// </summary>
+/// <param name="src">The image to be processed.</param>
+/// <param name="dst">The image after CLAHE. If it already has the size and type of the result (e.g. a pooled buffer of
+/// the context), it is written in place.</param>
+/// <param name="context">The processing context.</param>
+/// <param name="clipLimit">The clip limit of the CLAHE.</param>
+/// <param name="tileGridSize">The tile grid size of the CLAHE.</param>
+void CLAHEOpenCV(const cv::Mat& src,
+                cv::Mat& dst,
+                ProcessingContext& context,
+                double clipLimit = 3.0,
+                cv::Size tileGridSize = cv::Size(8, 8));
+
+/// <summary>
+/// Render the annotated result of a kernel: the ROI, both edges, the inner region and the gap arrow on a BGR copy of the
+/// image the kernel measured.
+/// </summary>
+/// <param name="image">The image passed to the kernel. (8UC1, or 16UC1 scaled down to 8-bit)</param>
+/// <param name="overlay">The overlay filled by the kernel.</param>
+/// <returns>The annotated image. (8UC3)</returns>
+cv::Mat drawResult(const cv::Mat& image, const ResultOverlay& overlay);
+
+/// <summary>
+/// Draw double-headed arrow
+/// </summary>
+/// <param name="img">The image on which to draw the arrow.</param>
+/// <param name="p1">The starting point of the arrow.</param>
+/// <param name="p2">The ending point of the arrow.</param>
+/// <param name="color">The color of the arrow.</param>
+/// <param name="thickness">The thickness of the arrow lines (default = 2).</param>
+/// <param name="tipLength">The length of the arrow tips as a fraction of the arrow length (default = 0.05).</param>
+void drawDoubleArrow(const cv::Mat& img,
+                    cv::Point p1,
+                    cv::Point p2,
+                    cv::Scalar color,
+                    int thickness = 4,
+                    double tipLength = 0.1);
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 //                                                                   End of file                                                                    //
@@ -0,0 +1,310 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "BatchInspector.h"
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Definition                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+GapMeasurement measurePoint(const InspectionPoint& point, cv::Mat* loadedImage, ResultOverlay* overlay)
+{
+    XVT_PROFILE_STOPWATCH(stopwatch);
+    if (isRawFramePath(point.imagePath))
+    {
+        // Mapped, not decoded: only the pages the conversion touches are read
+        MappedRawFrame raw;
+        if (!raw.open(point.imagePath))
+        {
+            throw std::runtime_error("Cannot load " + point.imagePath);
+        }
+        // A placed ROI is only known after the outline search has read the whole frame, like a full conversion does
+        if (point.margin >= 0 && point.referenceOutline.empty())
+            raw.prefetch(cv::Rect(point.ROI.x - point.margin, point.ROI.y - point.margin,
+                                  point.ROI.width + 2 * point.margin, point.ROI.height + 2 * point.margin));
+        else
+            raw.prefetchAll();
+        XVT_PROFILE_LAP(stopwatch, "load");
+        GapMeasurement measurement = measureFrame(point, raw.image(), loadedImage, overlay);
+        if (loadedImage && raw.shares(*loadedImage))
+            *loadedImage = loadedImage->clone(); // the result writer uses it after the mapping is gone
+        return measurement;
+    }
+
+    cv::Mat frame = cv::imread(point.imagePath, cv::IMREAD_UNCHANGED);
+    if (frame.empty())
+    {
+        throw std::runtime_error("Cannot load " + point.imagePath);
+    }
+    XVT_PROFILE_LAP(stopwatch, "load");
+    return measureFrame(point, frame, loadedImage, overlay);
+}
+
+GapMeasurement measureFrame(const InspectionPoint& point, const cv::Mat& frame, cv::Mat* loadedImage, ResultOverlay* overlay)
+{
+    // ROI-first conversion converts only the ROI plus margin to 8-bit and the result covers that crop only
+    XVT_PROFILE_STOPWATCH(stopwatch);
+    cv::Rect ROI = point.ROI;
+    if (!point.referenceOutline.empty())
+    {
+        // The ROI follows the cell: a fixture offset does not need an oversized ROI. Without an outline it stays put.
+        cv::Rect outline;
+        [[maybe_unused]] const bool found = locateCellOutline(frame, point.outline, outline);
+        ROI = placeROI(point.ROI, point.referenceOutline, outline, frame.size());
+        XVT_PROFILE_COUNT("outline_found", found);
+        XVT_PROFILE_LAP(stopwatch, "register");
+    }
+    cv::Mat image = point.margin < 0
+        ? convertFrame(frame, point.depth, point.clipPercent)
+        : convertFrameROI(frame, ROI, point.margin, point.depth, point.clipPercent);
+    if (image.empty())
+    {
+        throw std::runtime_error("Cannot convert " + point.imagePath);
+    }
+    XVT_PROFILE_LAP(stopwatch, "convert");
+    if (loadedImage)
+        *loadedImage = image;
+
+    if (!point.compareDenoise || point.params.denoise == DenoiseMethod::NLM)
+    {
+        return point.kernel(image, ROI, point.params, overlay);
+    }
+
+    //--------------- Compare with the NLM Baseline -----------------//
+    using Clock = std::chrono::steady_clock;
+    InspectionParams baselineParams = point.params;
+    baselineParams.denoise = DenoiseMethod::NLM;
+
+    auto t0 = Clock::now();
+    GapMeasurement selected = point.kernel(image, ROI, point.params, overlay);
+    auto t1 = Clock::now();
+    GapMeasurement baseline = point.kernel(image, ROI, baselineParams, nullptr);
+    auto t2 = Clock::now();
+
+    static const char* METHOD_NAMES[] = { "nlm", "gaussian", "box", "median", "profile" };
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(1) << point.name << ": "
+           << METHOD_NAMES[static_cast<int>(point.params.denoise)] << " "
+           << std::chrono::duration<double, std::milli>(t1 - t0).count() << " ms vs nlm "
+           << std::chrono::duration<double, std::milli>(t2 - t1).count() << " ms, gap ";
+    if (selected.valid && baseline.valid)
+        report << selected.gap << " px vs " << baseline.gap << " px (diff " << selected.gap - baseline.gap << " px)";
+    else
+        report << (selected.valid ? "found" : "not found") << " vs " << (baseline.valid ? "found" : "not found");
+    std::cout << report.str() << std::endl;
+
+    return selected;
+}
+
+cv::Mat inspectPoint(const InspectionPoint& point, GapMeasurement* measurement)
+{
+    cv::Mat image;
+    ResultOverlay overlay;
+    GapMeasurement result = measurePoint(point, &image, &overlay);
+    if (measurement)
+        *measurement = result;
+    return drawResult(image, overlay);
+}
+
+bool isGapGood(const InspectionPoint& point, const GapMeasurement& measurement)
+{
+    if (!measurement.valid)
+        return false;
+    double gap = point.params.pixelSizeUm > 0.0 ? measurement.gapUm : measurement.gap;
+    return gap >= point.gapMin && (point.gapMax <= 0.0 || gap <= point.gapMax);
+}
+
+BatchInspector::BatchInspector(unsigned int numThreads, unsigned int maxInFlight, const ResultWriterOptions& output)
+    : m_maxInFlight(maxInFlight), m_writer(output), m_pool(numThreads)
+{
+    if (m_maxInFlight == 0)
+        m_maxInFlight = 2 * m_pool.size();
+}
+
+BatchInspector::~BatchInspector()
+{
+    wait();
+}
+
+void BatchInspector::submit(const InspectionPoint& point)
+{
+    enqueue(point, m_cells++);
+}
+
+void BatchInspector::submitCell(const std::vector<InspectionPoint>& cell)
+{
+    const unsigned long long cellIndex = m_cells++;
+    for (const auto& point : cell)
+        enqueue(point, cellIndex);
+}
+
+unsigned long long BatchInspector::run(FrameSource& source, const std::vector<InspectionPoint>& points,
+                                       const std::atomic<bool>& stop)
+{
+    namespace fs = std::filesystem;
+
+    // A frame belongs to the point whose image name it is or ends with: "P3" and "cell0042_P3" both go to P3
+    std::vector<std::string> stems;
+    for (const auto& point : points)
+        stems.push_back(fs::path(point.imagePath).stem().string());
+    auto findPoint = [&](const std::string& name) {
+        int best = -1;
+        for (int i = 0; i < static_cast<int>(stems.size()); ++i) {
+            const std::string& stem = stems[i];
+            bool match = name == stem
+                || (name.size() > stem.size() && name.compare(name.size() - stem.size(), stem.size(), stem) == 0
+                    && name[name.size() - stem.size() - 1] == '_');
+            if (match && (best < 0 || stem.size() > stems[best].size()))
+                best = i;
+        }
+        return best;
+    };
+
+    // The workers measure while the next frame is read; the result writer encodes behind them
+    std::vector<unsigned long long> pointFrames(points.size(), 0);
+    unsigned long long frames = 0;
+    Frame frame;
+    while (!stop.load()) {
+        // A frame that cannot be read (allocation, decoder) is counted as failed; the source moves on to the next one
+        FrameStatus status = FrameStatus::TIMEOUT;
+        try {
+            status = source.next(frame, 100);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error processing frame source: " << e.what() << std::endl;
+            ++m_failed;
+            continue;
+        }
+        if (status == FrameStatus::END)
+            break;
+        if (status == FrameStatus::TIMEOUT)
+            continue;
+
+        const int index = findPoint(frame.name);
+        if (frame.image.empty() || index < 0) {
+            std::cerr << "Error processing " << frame.origin << ": "
+                      << (frame.image.empty() ? "empty frame" : "no inspection point for '" + frame.name + "'") << std::endl;
+            ++m_failed;
+            continue;
+        }
+
+        InspectionPoint framePoint = points[index];
+        framePoint.imagePath = frame.origin;
+        framePoint.resultPath = (fs::path(points[index].resultPath).parent_path() / (frame.name + "_Result.png")).generic_string();
+        enqueue(framePoint, pointFrames[index]++, frame.image);
+        ++frames;
+    }
+
+    wait();
+    return frames;
+}
+
+void BatchInspector::enqueue(const InspectionPoint& point, unsigned long long cellIndex, const cv::Mat& frame)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_slotFree.wait(lock, [this] { return m_inFlight < m_maxInFlight; });
+        ++m_inFlight;
+    }
+    m_pool.submit([this, point, cellIndex, frame] { process(point, cellIndex, frame); });
+}
+
+void BatchInspector::wait()
+{
+    m_pool.wait();
+    m_writer.flush();
+}
+
+bool BatchInspector::setMeasurementLog(const std::string& filePath)
+{
+    std::lock_guard<std::mutex> lock(m_logMutex);
+    bool isNew = !std::filesystem::exists(filePath);
+    m_log.close();
+    m_log.open(filePath, std::ios::app);
+    if (!m_log)
+        return false;
+
+    if (isNew)
+        m_log << "point,image,valid,gap_px,gap_um,peak_px,valley_px,confidence,"
+                 "strips,strips_accepted,strip_gap_min_px,strip_gap_max_px,strip_gap_median_px,ok\n";
+    return true;
+}
+
+void BatchInspector::process(const InspectionPoint& point, unsigned long long cellIndex, const cv::Mat& frame)
+{
+    XVT_PROFILE_POINT(point.name);
+    XVT_PROFILE_STOPWATCH(total);
+    try {
+        // The measurement is logged before anything is drawn, so the line gets the gap without waiting for the PNG
+        // A tracking point starts from the edges of its previous cells
+        const InspectionPoint* measured = &point;
+        InspectionPoint trackedPoint;
+        if (point.params.trackWindow > 0) {
+            trackedPoint = point;
+            m_tracker.apply(point.name, trackedPoint.params);
+            measured = &trackedPoint;
+        }
+
+        cv::Mat image;
+        ResultOverlay overlay;
+        GapMeasurement measurement = frame.empty()
+            ? measurePoint(*measured, &image, &overlay)
+            : measureFrame(*measured, frame, &image, &overlay);
+        m_tracker.update(point.name, measured->params, measurement);
+        const bool good = isGapGood(point, measurement);
+        if (!good)
+            ++m_ng;
+        logMeasurement(point, measurement, good);
+
+        bool annotate = false;
+        switch (point.annotate) {
+        case AnnotationPolicy::ALWAYS:  annotate = true; break;
+        case AnnotationPolicy::NG:      annotate = !good; break;
+        case AnnotationPolicy::EVERY_N: annotate = !good || cellIndex % std::max(1, point.annotateEvery) == 0; break;
+        case AnnotationPolicy::NEVER:   annotate = false; break;
+        }
+
+        // Rendering, encoding and the disk are off the measurement path; a full queue blocks here (or drops)
+        if (annotate) {
+            m_writer.submit(point.name, point.resultPath, image, overlay);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error processing " << point.name << ": " << e.what() << std::endl;
+        ++m_failed;
+    }
+    XVT_PROFILE_LAP(total, "total");
+    releaseSlot();
+}
+
+void BatchInspector::logMeasurement(const InspectionPoint& point, const GapMeasurement& measurement, bool good)
+{
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3)
+         << point.name << ',' << point.imagePath << ',' << (measurement.valid ? 1 : 0) << ','
+         << measurement.gap << ',' << measurement.gapUm << ','
+         << measurement.peakPosition << ',' << measurement.valleyPosition << ',' << measurement.confidence << ','
+         << measurement.strips.count << ',' << measurement.strips.accepted << ',' << measurement.strips.minGap << ','
+         << measurement.strips.maxGap << ',' << measurement.strips.medianGap << ',' << (good ? 1 : 0) << '\n';
+
+    std::lock_guard<std::mutex> lock(m_logMutex);
+    if (m_log.is_open())
+        m_log << line.str() << std::flush;
+}
+
+void BatchInspector::releaseSlot()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_inFlight;
+    }
+    m_slotFree.notify_one();
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
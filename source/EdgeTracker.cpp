@@ -0,0 +1,62 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "EdgeTracker.h"
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Definition                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+void EdgeTracker::apply(const std::string& point, InspectionParams& params) const
+{
+    params.trackPeak = -1.0;
+    params.trackValley = -1.0;
+    if (params.trackWindow <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_tracks.find(point);
+    if (it != m_tracks.end()) {
+        params.trackPeak = it->second.peak;
+        params.trackValley = it->second.valley;
+    }
+}
+
+void EdgeTracker::update(const std::string& point, const InspectionParams& params, const GapMeasurement& measurement)
+{
+    if (params.trackWindow <= 0)
+        return;
+
+    const bool hinted = params.trackPeak >= 0.0 && params.trackValley >= 0.0;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (measurement.tracked)
+        ++m_stats.tracked;
+    else if (hinted)
+        ++m_stats.fallbacks;
+    else
+        ++m_stats.searched;
+
+    // Only a trusted measurement moves the track; anything else sends the next cell back to the full search
+    if (measurement.valid && measurement.confidence >= params.trackMinConfidence) {
+        m_tracks[point] = Track{ measurement.peakPosition, measurement.valleyPosition };
+    }
+    else if (m_tracks.erase(point) > 0) {
+        ++m_stats.lost;
+    }
+}
+
+void EdgeTracker::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tracks.clear();
+}
+
+EdgeTrackerStats EdgeTracker::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,431 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "FrameSource.h"
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define XVT_HAS_SHM 1
+#define XVT_HAS_POLL 1
+#endif
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+const char* IMAGE_EXTENSIONS[] = { ".tif", ".tiff", ".png", ".bmp", ".raw" };
+constexpr size_t RING_HEADER_BYTES = 64;    // FrameRing::Header, padded so the slots start on a cache line
+constexpr uint32_t RING_VERSION = 1;
+constexpr uint64_t MAX_FRAME_BYTES = 256ull << 20;     // The largest frame record accepted on a stream, in pixel bytes.
+
+bool isImageFile(const fs::path& path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    for (const char* e : IMAGE_EXTENSIONS)
+        if (extension == e) return true;
+    return false;
+}
+
+/// <summary>
+/// Bytes of pixel data of a frame geometry, 0 if the geometry is invalid.
+/// </summary>
+uint64_t frameBytes(const RawFrameHeader& header)
+{
+    if (header.rows <= 0 || header.cols <= 0 || header.type < 0 || CV_MAT_CN(header.type) > 4)
+        return 0;
+    return static_cast<uint64_t>(header.rows) * header.cols * CV_ELEM_SIZE(header.type);
+}
+
+/// <summary>
+/// Wait with a short sleep until done() holds or the timeout expires. A negative timeout waits forever.
+/// </summary>
+template <typename Predicate>
+bool waitFor(Predicate done, int timeoutMs)
+{
+    const auto deadline = Clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    for (int spin = 0; !done(); ++spin) {
+        if (timeoutMs >= 0 && Clock::now() >= deadline)
+            return false;
+        if (spin < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return true;
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                              DirectoryFrameSource                                                                //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+DirectoryFrameSource::DirectoryFrameSource(const std::string& directory, int pollMs, bool skipExisting)
+    : m_directory(directory), m_pollMs(std::max(1, pollMs))
+{
+    if (!fs::is_directory(m_directory))
+    {
+        throw std::runtime_error("Cannot watch " + m_directory + ": not a directory");
+    }
+    if (skipExisting) {
+        for (const auto& entry : fs::directory_iterator(m_directory))
+            if (entry.is_regular_file())
+                m_done.insert(entry.path().string());
+    }
+}
+
+void DirectoryFrameSource::poll()
+{
+    std::error_code listError, error;
+    std::set<std::string> present;
+    for (const auto& entry : fs::directory_iterator(m_directory, listError)) {
+        const std::string path = entry.path().string();
+        present.insert(path);
+        if (!entry.is_regular_file(error) || !isImageFile(entry.path()) || m_done.count(path) || m_ready.count(path))
+            continue;
+
+        uintmax_t size = entry.file_size(error);
+        if (error) continue;
+
+        // Stable size over one poll period: the writer is done with the file
+        auto it = m_pending.find(path);
+        if (it != m_pending.end() && it->second == size && size > 0) {
+            m_pending.erase(it);
+            m_ready.insert(path);
+        }
+        else {
+            m_pending[path] = size;
+        }
+    }
+
+    // Forget the files that are gone (moved away or deleted by the line), so m_done only holds what is still there
+    if (listError)
+        return;
+    for (auto it = m_done.begin(); it != m_done.end();)
+        it = present.count(*it) ? std::next(it) : m_done.erase(it);
+    for (auto it = m_pending.begin(); it != m_pending.end();)
+        it = present.count(it->first) ? std::next(it) : m_pending.erase(it);
+}
+
+FrameStatus DirectoryFrameSource::next(Frame& frame, int timeoutMs)
+{
+    const auto deadline = Clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    for (;;) {
+        while (!m_ready.empty()) {
+            std::string path = *m_ready.begin();
+            m_ready.erase(m_ready.begin());
+            m_done.insert(path);
+
+            // A raw frame skips the decoder: one copy out of the mapping, which is closed before the frame is queued
+            cv::Mat image;
+            if (isRawFramePath(path)) {
+                MappedRawFrame raw;
+                if (raw.open(path)) {
+                    raw.prefetchAll();
+                    image = raw.image().clone();
+                }
+            }
+            else {
+                image = cv::imread(path, cv::IMREAD_UNCHANGED);
+            }
+            if (image.empty()) {
+                std::cerr << "Error loading image: " << path << std::endl;
+                continue;
+            }
+            frame.name = fs::path(path).stem().string();
+            frame.origin = path;
+            frame.image = image;
+            frame.sequence = m_sequence++;
+            return FrameStatus::OK;
+        }
+
+        if (Clock::now() >= deadline)
+            return FrameStatus::TIMEOUT;
+        poll();
+        if (m_ready.empty())
+            std::this_thread::sleep_for(std::chrono::milliseconds(m_pollMs));
+    }
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                               StreamFrameSource                                                                  //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+StreamFrameSource::StreamFrameSource(std::istream& stream, const std::string& label, int fd)
+    : m_stream(stream), m_label(label), m_fd(fd)
+{
+}
+
+FrameStatus StreamFrameSource::next(Frame& frame, int timeoutMs)
+{
+#ifdef XVT_HAS_POLL
+    // Only the start of a record is waited for: once it has begun, the rest is read blocking
+    if (m_fd >= 0 && m_stream.rdbuf()->in_avail() <= 0) {
+        pollfd request{ m_fd, POLLIN, 0 };
+        if (::poll(&request, 1, std::max(0, timeoutMs)) <= 0)
+            return FrameStatus::TIMEOUT; // nothing yet, or interrupted by a signal: the caller checks its stop flag
+    }
+#else
+    (void)timeoutMs;
+#endif
+
+    uint32_t nameLength = 0;
+    if (!m_stream.read(reinterpret_cast<char*>(&nameLength), sizeof(nameLength)))
+        return FrameStatus::END;
+
+    std::string name(std::min<uint32_t>(nameLength, 4096), '\0');
+    RawFrameHeader header;
+    if (nameLength > 4096
+        || !m_stream.read(name.data(), static_cast<std::streamsize>(name.size()))
+        || !m_stream.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, "XVTR", 4) != 0
+        || header.headerSize < sizeof(header)
+        || frameBytes(header) == 0
+        || frameBytes(header) > MAX_FRAME_BYTES)
+    {
+        std::cerr << "Corrupt frame record on " << m_label << " after frame " << m_sequence << std::endl;
+        return FrameStatus::END;
+    }
+    m_stream.ignore(header.headerSize - sizeof(header));
+
+    cv::Mat image(header.rows, header.cols, header.type);
+    if (!m_stream.read(reinterpret_cast<char*>(image.data), static_cast<std::streamsize>(frameBytes(header)))) {
+        std::cerr << "Truncated frame " << name << " on " << m_label << std::endl;
+        return FrameStatus::END;
+    }
+
+    frame.name = name;
+    frame.origin = m_label + "#" + std::to_string(m_sequence);
+    frame.image = image;
+    frame.sequence = m_sequence++;
+    return FrameStatus::OK;
+}
+
+bool writeFrameRecord(std::ostream& stream, const std::string& name, const cv::Mat& image)
+{
+    if (image.empty())
+        return false;
+
+    RawFrameHeader header;
+    header.rows = image.rows;
+    header.cols = image.cols;
+    header.type = image.type();
+    const uint32_t nameLength = static_cast<uint32_t>(name.size());
+
+    stream.write(reinterpret_cast<const char*>(&nameLength), sizeof(nameLength));
+    stream.write(name.data(), nameLength);
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const size_t rowBytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y)
+        stream.write(reinterpret_cast<const char*>(image.ptr(y)), static_cast<std::streamsize>(rowBytes));
+    return static_cast<bool>(stream);
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   FrameRing                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+FrameRing::FrameRing(const std::string& name, void* memory, size_t size, bool owner)
+    : m_name(name), m_memory(memory), m_size(size), m_owner(owner)
+{
+}
+
+unsigned char* FrameRing::slot(uint64_t index) const
+{
+    return static_cast<unsigned char*>(m_memory) + RING_HEADER_BYTES + (index % header()->slotCount) * header()->slotBytes;
+}
+
+#ifdef XVT_HAS_SHM
+
+std::unique_ptr<FrameRing> FrameRing::create(const std::string& name, uint32_t slotCount, uint64_t maxFrameBytes)
+{
+    static_assert(sizeof(Header) <= RING_HEADER_BYTES, "FrameRing::Header does not fit its reserved space");
+    slotCount = std::max(1u, slotCount);
+    const uint64_t slotBytes = (sizeof(SlotHeader) + maxFrameBytes + 63) & ~uint64_t(63);
+    const size_t size = RING_HEADER_BYTES + slotCount * slotBytes;
+
+    shm_unlink(name.c_str()); // replace a ring left behind by a crashed run
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot create shared memory " + name);
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Cannot size shared memory " + name);
+    }
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Cannot map shared memory " + name);
+    }
+
+    Header* h = new (memory) Header();
+    std::memcpy(h->magic, "XVTQ", 4);
+    h->version = RING_VERSION;
+    h->slotCount = slotCount;
+    h->reserved = 0;
+    h->slotBytes = slotBytes;
+    h->head.store(0);
+    h->tail.store(0);
+    h->closed.store(0, std::memory_order_release);
+    return std::unique_ptr<FrameRing>(new FrameRing(name, memory, size, true));
+}
+
+std::unique_ptr<FrameRing> FrameRing::open(const std::string& name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot open shared memory " + name);
+    }
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < RING_HEADER_BYTES) {
+        ::close(fd);
+        throw std::runtime_error("Shared memory " + name + " is not a frame ring");
+    }
+    const size_t size = static_cast<size_t>(info.st_size);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED)
+    {
+        throw std::runtime_error("Cannot map shared memory " + name);
+    }
+
+    const Header* h = static_cast<const Header*>(memory);
+    if (std::memcmp(h->magic, "XVTQ", 4) != 0 || h->version != RING_VERSION
+        || RING_HEADER_BYTES + h->slotCount * h->slotBytes > size) {
+        munmap(memory, size);
+        throw std::runtime_error("Shared memory " + name + " is not a frame ring");
+    }
+    return std::unique_ptr<FrameRing>(new FrameRing(name, memory, size, false));
+}
+
+FrameRing::~FrameRing()
+{
+    munmap(m_memory, m_size);
+    if (m_owner)
+        shm_unlink(m_name.c_str());
+}
+
+#else
+
+std::unique_ptr<FrameRing> FrameRing::create(const std::string& name, uint32_t, uint64_t)
+{
+    throw std::runtime_error("Shared memory frame rings are not supported on this platform (" + name + ")");
+}
+
+std::unique_ptr<FrameRing> FrameRing::open(const std::string& name)
+{
+    throw std::runtime_error("Shared memory frame rings are not supported on this platform (" + name + ")");
+}
+
+FrameRing::~FrameRing() = default;
+
+#endif
+
+bool FrameRing::push(const std::string& name, const cv::Mat& image, int timeoutMs)
+{
+    Header* h = header();
+    RawFrameHeader frame;
+    frame.rows = image.rows;
+    frame.cols = image.cols;
+    frame.type = image.type();
+    if (image.empty() || sizeof(SlotHeader) + frameBytes(frame) > h->slotBytes)
+        return false;
+
+    const uint64_t head = h->head.load(std::memory_order_relaxed);
+    if (!waitFor([&] { return head - h->tail.load(std::memory_order_acquire) < h->slotCount; }, timeoutMs))
+        return false;
+
+    unsigned char* s = slot(head);
+    SlotHeader slotHeader{};
+    std::strncpy(slotHeader.name, name.c_str(), sizeof(slotHeader.name) - 1);
+    slotHeader.frame = frame;
+    std::memcpy(s, &slotHeader, sizeof(slotHeader));
+
+    unsigned char* pixels = s + sizeof(SlotHeader);
+    const size_t rowBytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y)
+        std::memcpy(pixels + y * rowBytes, image.ptr(y), rowBytes);
+
+    h->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+FrameStatus FrameRing::pop(Frame& frame, int timeoutMs)
+{
+    Header* h = header();
+    const uint64_t tail = h->tail.load(std::memory_order_relaxed);
+    const bool ready = waitFor([&] {
+        return h->head.load(std::memory_order_acquire) != tail || h->closed.load(std::memory_order_acquire) != 0;
+    }, timeoutMs);
+    if (!ready)
+        return FrameStatus::TIMEOUT;
+    if (h->head.load(std::memory_order_acquire) == tail)
+        return FrameStatus::END; // closed and drained
+
+    const unsigned char* s = slot(tail);
+    SlotHeader slotHeader;
+    std::memcpy(&slotHeader, s, sizeof(slotHeader));
+    slotHeader.name[sizeof(slotHeader.name) - 1] = '\0';
+    const uint64_t bytes = frameBytes(slotHeader.frame);
+
+    if (bytes > 0 && sizeof(SlotHeader) + bytes <= h->slotBytes) {
+        cv::Mat image(slotHeader.frame.rows, slotHeader.frame.cols, slotHeader.frame.type);
+        std::memcpy(image.data, s + sizeof(SlotHeader), bytes);
+        frame.image = image;
+    }
+    else {
+        frame.image = cv::Mat(); // corrupt slot: delivered empty so the caller can report it
+    }
+    frame.name = slotHeader.name;
+    frame.origin = "shm:" + m_name + "#" + std::to_string(tail);
+    frame.sequence = m_sequence++;
+
+    h->tail.store(tail + 1, std::memory_order_release);
+    return FrameStatus::OK;
+}
+
+void FrameRing::close()
+{
+    header()->closed.store(1, std::memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                            SharedMemoryFrameSource                                                               //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+SharedMemoryFrameSource::SharedMemoryFrameSource(const std::string& name, uint32_t slotCount, uint64_t maxFrameBytes)
+    : m_ring(FrameRing::create(name, slotCount, maxFrameBytes))
+{
+}
+
+FrameStatus SharedMemoryFrameSource::next(Frame& frame, int timeoutMs)
+{
+    return m_ring->pop(frame, timeoutMs);
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
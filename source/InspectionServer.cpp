@@ -0,0 +1,433 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "InspectionServer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define XVT_HAS_UNIX_SOCKET 1
+#endif
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t MAX_REQUEST_BYTES = 256ull << 20;   // The largest ROI accepted, in pixel bytes.
+
+#ifdef XVT_HAS_UNIX_SOCKET
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;                // A client gone away is an error, not a SIGPIPE.
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+/// <summary>
+/// Read exactly size bytes from a socket.
+/// </summary>
+/// <returns>False at the end of the stream or on error.</returns>
+bool readAll(int fd, void* data, size_t size)
+{
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/// <summary>
+/// Write exactly size bytes to a socket.
+/// </summary>
+/// <returns>False if the peer closed the connection or on error.</returns>
+bool writeAll(int fd, const void* data, size_t size)
+{
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::send(fd, p, size, SEND_FLAGS);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/// <summary>
+/// Fill the address of a socket path; throws std::runtime_error if the path is too long.
+/// </summary>
+sockaddr_un socketAddress(const std::string& socketPath)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Invalid socket path '" + socketPath + "'");
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return address;
+}
+
+/// <summary>
+/// Remove the socket left at a path by a server that did not exit cleanly. Throws std::runtime_error if the path holds
+/// anything else: a file that is not a socket, or the socket of a server still accepting connections.
+/// </summary>
+void removeStaleSocket(const std::string& socketPath, const sockaddr_un& address)
+{
+    struct stat info {};
+    if (::lstat(socketPath.c_str(), &info) != 0)
+        return; // nothing there
+    if (!S_ISSOCK(info.st_mode))
+        throw std::runtime_error("Cannot listen on " + socketPath + ": the path exists and is not a socket");
+
+    // Nobody listening refuses the connection; anything else means a live server, or a socket we cannot judge
+    const int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool connected = probe >= 0 && ::connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    const int error = errno;
+    if (probe >= 0)
+        ::close(probe);
+    if (connected)
+        throw std::runtime_error("Cannot listen on " + socketPath + ": another server is using it");
+    if (error != ECONNREFUSED)
+        throw std::runtime_error("Cannot listen on " + socketPath + ": " + std::strerror(error));
+    ::unlink(socketPath.c_str());
+}
+#endif
+
+/// <summary>
+/// Check the header of a request before its pixels are read.
+/// </summary>
+bool isWellFormed(const InspectionRequest& request)
+{
+    const RawFrameHeader& frame = request.frame;
+    if (std::memcmp(request.magic, "XVTI", 4) != 0 || request.version != 1 || frame.rows <= 0 || frame.cols <= 0
+        || (frame.type != CV_8UC1 && frame.type != CV_16UC1))
+        return false;
+    const uint64_t bytes = static_cast<uint64_t>(frame.rows) * static_cast<uint64_t>(frame.cols) * CV_ELEM_SIZE(frame.type);
+    return bytes <= MAX_REQUEST_BYTES;
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Definition                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+#ifdef XVT_HAS_UNIX_SOCKET
+
+InspectionServer::InspectionServer(const std::vector<InspectionPoint>& points, const std::string& socketPath,
+                                   unsigned int numThreads, unsigned int maxPipeline)
+    : m_points(points), m_socketPath(socketPath), m_maxPipeline(std::max(1u, maxPipeline)), m_pool(numThreads)
+{
+    const sockaddr_un address = socketAddress(socketPath);
+    m_listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listenFd < 0)
+        throw std::runtime_error("Cannot create socket " + socketPath);
+
+    try {
+        removeStaleSocket(socketPath, address);
+    }
+    catch (const std::exception&) {
+        ::close(m_listenFd);
+        throw;
+    }
+    if (::bind(m_listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || ::listen(m_listenFd, 16) != 0) {
+        ::close(m_listenFd);
+        throw std::runtime_error("Cannot listen on " + socketPath + ": " + std::strerror(errno));
+    }
+}
+
+InspectionServer::~InspectionServer()
+{
+    reap(true);
+    ::close(m_listenFd);
+    ::unlink(m_socketPath.c_str());
+}
+
+void InspectionServer::run(const std::atomic<bool>& stop)
+{
+    while (!stop.load()) {
+        // Wake up regularly to check stop and to join the readers of closed connections
+        pollfd listener{ m_listenFd, POLLIN, 0 };
+        const int ready = ::poll(&listener, 1, 100);
+        reap(false);
+        if (ready <= 0)
+            continue;
+
+        const int fd = ::accept(m_listenFd, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        auto connection = std::make_shared<Connection>();
+        connection->fd = fd;
+        {
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            ++m_stats.connections;
+        }
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        m_connections.push_back(connection);
+        connection->reader = std::thread(&InspectionServer::serve, this, connection);
+    }
+
+    reap(true);
+}
+
+void InspectionServer::reap(bool every)
+{
+    std::list<std::shared_ptr<Connection>> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        for (auto it = m_connections.begin(); it != m_connections.end();) {
+            if (every || (*it)->done.load())
+                finished.splice(finished.end(), m_connections, it++);
+            else
+                ++it;
+        }
+    }
+    // Stop reading: every reader finishes the requests in flight on its connection, then the connection is closed
+    for (const auto& connection : finished) {
+        if (every)
+            ::shutdown(connection->fd, SHUT_RD);
+    }
+    for (const auto& connection : finished) {
+        if (connection->reader.joinable())
+            connection->reader.join();
+        ::close(connection->fd);
+    }
+}
+
+void InspectionServer::serve(std::shared_ptr<Connection> connection)
+{
+    const int fd = connection->fd;
+    for (;;) {
+        // The pipeline limit is taken before the read, so a client running ahead is held back by the socket buffer
+        {
+            std::unique_lock<std::mutex> lock(connection->mutex);
+            connection->slotFree.wait(lock, [&] { return connection->inFlight < m_maxPipeline || connection->broken; });
+            if (connection->broken)
+                break;
+            ++connection->inFlight;
+        }
+
+        InspectionRequest request;
+        cv::Mat pixels;
+        bool complete = readAll(fd, &request, sizeof(request));
+        const bool wellFormed = complete && isWellFormed(request);
+        if (wellFormed) {
+            pixels.create(request.frame.rows, request.frame.cols, request.frame.type);
+            complete = readAll(fd, pixels.data, pixels.total() * pixels.elemSize());
+        }
+        const Clock::time_point received = Clock::now();
+
+        if (!complete || !wellFormed) {
+            // A malformed header leaves the stream out of step: answer it, then drop the connection
+            if (complete) {
+                {
+                    std::lock_guard<std::mutex> lock(m_statsMutex);
+                    ++m_stats.requests;
+                    m_stats.bytesIn += sizeof(request);
+                }
+                InspectionResponse response;
+                response.id = request.id;
+                response.status = static_cast<uint32_t>(InspectionStatus::BAD_REQUEST);
+                respond(connection, response);
+            }
+            else {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                --connection->inFlight;
+            }
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            ++m_stats.requests;
+            m_stats.bytesIn += sizeof(request) + pixels.total() * pixels.elemSize();
+        }
+        m_pool.submit([this, connection, request, pixels, received] { process(connection, request, pixels, received); });
+    }
+
+    // The responses in flight still go out before the connection is closed
+    {
+        std::unique_lock<std::mutex> lock(connection->mutex);
+        connection->slotFree.wait(lock, [&] { return connection->inFlight == 0; });
+    }
+    connection->done.store(true);
+}
+
+void InspectionServer::process(const std::shared_ptr<Connection>& connection, const InspectionRequest& request,
+                               const cv::Mat& pixels, Clock::time_point received)
+{
+    InspectionResponse response;
+    response.id = request.id;
+
+    const std::string name(request.point, strnlen(request.point, sizeof(request.point)));
+    auto found = std::find_if(m_points.begin(), m_points.end(), [&](const InspectionPoint& p) { return p.name == name; });
+    if (found == m_points.end()) {
+        response.status = static_cast<uint32_t>(InspectionStatus::UNKNOWN_POINT);
+    }
+    else {
+        XVT_PROFILE_POINT(found->name);
+        try {
+            // The pixels are the ROI already: no crop, no registration
+            InspectionPoint point = *found;
+            point.imagePath = "request " + std::to_string(request.id);
+            point.ROI = request.roi[2] > 0 && request.roi[3] > 0
+                ? cv::Rect(request.roi[0], request.roi[1], request.roi[2], request.roi[3])
+                : cv::Rect(0, 0, pixels.cols, pixels.rows);
+            point.margin = -1;
+            point.referenceOutline = cv::Rect();
+            point.compareDenoise = false;
+            m_tracker.apply(point.name, point.params);
+
+            const GapMeasurement measurement = measureFrame(point, pixels);
+            m_tracker.update(point.name, point.params, measurement);
+            response.valid = measurement.valid ? 1 : 0;
+            response.good = isGapGood(point, measurement) ? 1 : 0;
+            response.tracked = measurement.tracked ? 1 : 0;
+            response.gap = measurement.gap;
+            response.gapUm = measurement.gapUm;
+            response.peakPosition = measurement.peakPosition;
+            response.valleyPosition = measurement.valleyPosition;
+            response.confidence = measurement.confidence;
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error processing request " << request.id << " (" << name << "): " << e.what() << std::endl;
+            response.status = static_cast<uint32_t>(InspectionStatus::FAILED);
+        }
+    }
+    response.processingMs = std::chrono::duration<float, std::milli>(Clock::now() - received).count();
+    respond(connection, response);
+}
+
+void InspectionServer::respond(const std::shared_ptr<Connection>& connection, const InspectionResponse& response)
+{
+    unsigned int pipeline = 0;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        pipeline = connection->inFlight;
+        if (!connection->broken && !writeAll(connection->fd, &response, sizeof(response))) {
+            // The client is gone: unblock the reader so it stops
+            connection->broken = true;
+            ::shutdown(connection->fd, SHUT_RD);
+        }
+        --connection->inFlight;
+    }
+    connection->slotFree.notify_all();
+
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    m_stats.maxPipeline = std::max(m_stats.maxPipeline, pipeline);
+    if (response.status != static_cast<uint32_t>(InspectionStatus::OK))
+        ++m_stats.failed;
+}
+
+InspectionClient::InspectionClient(const std::string& socketPath)
+{
+    const sockaddr_un address = socketAddress(socketPath);
+    m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd < 0 || ::connect(m_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        const std::string reason = std::strerror(errno);
+        if (m_fd >= 0)
+            ::close(m_fd);
+        throw std::runtime_error("Cannot connect to " + socketPath + ": " + reason);
+    }
+}
+
+InspectionClient::~InspectionClient()
+{
+    ::close(m_fd);
+}
+
+bool InspectionClient::send(uint64_t id, const std::string& point, const cv::Mat& pixels, const cv::Rect& ROI)
+{
+    if (pixels.empty() || (pixels.type() != CV_8UC1 && pixels.type() != CV_16UC1))
+        throw std::invalid_argument("Inspection requests carry 8UC1 or 16UC1 pixels.");
+    if (point.size() >= sizeof(InspectionRequest::point))
+        throw std::invalid_argument("Point name '" + point + "' is too long for a request.");
+
+    InspectionRequest request;
+    request.id = id;
+    std::memcpy(request.point, point.c_str(), point.size());
+    request.roi[0] = ROI.x;
+    request.roi[1] = ROI.y;
+    request.roi[2] = ROI.width;
+    request.roi[3] = ROI.height;
+    request.frame.rows = pixels.rows;
+    request.frame.cols = pixels.cols;
+    request.frame.type = pixels.type();
+
+    // A view into a larger frame is sent row by row instead of being copied
+    if (!writeAll(m_fd, &request, sizeof(request)))
+        return false;
+    if (pixels.isContinuous())
+        return writeAll(m_fd, pixels.data, pixels.total() * pixels.elemSize());
+    for (int y = 0; y < pixels.rows; ++y)
+        if (!writeAll(m_fd, pixels.ptr(y), pixels.cols * pixels.elemSize()))
+            return false;
+    return true;
+}
+
+bool InspectionClient::receive(InspectionResponse& response)
+{
+    return readAll(m_fd, &response, sizeof(response)) && std::memcmp(response.magic, "XVTO", 4) == 0;
+}
+
+#else
+
+InspectionServer::InspectionServer(const std::vector<InspectionPoint>& points, const std::string& socketPath,
+                                   unsigned int numThreads, unsigned int maxPipeline)
+    : m_points(points), m_socketPath(socketPath), m_maxPipeline(std::max(1u, maxPipeline)), m_pool(numThreads)
+{
+    throw std::runtime_error("Unix domain sockets are not supported on this platform (" + socketPath + ")");
+}
+
+InspectionServer::~InspectionServer() = default;
+
+void InspectionServer::run(const std::atomic<bool>&) {}
+
+void InspectionServer::reap(bool) {}
+
+void InspectionServer::serve(std::shared_ptr<Connection>) {}
+
+void InspectionServer::process(const std::shared_ptr<Connection>&, const InspectionRequest&, const cv::Mat&, Clock::time_point) {}
+
+void InspectionServer::respond(const std::shared_ptr<Connection>&, const InspectionResponse&) {}
+
+InspectionClient::InspectionClient(const std::string& socketPath)
+{
+    throw std::runtime_error("Unix domain sockets are not supported on this platform (" + socketPath + ")");
+}
+
+InspectionClient::~InspectionClient() = default;
+
+bool InspectionClient::send(uint64_t, const std::string&, const cv::Mat&, const cv::Rect&) { return false; }
+
+bool InspectionClient::receive(InspectionResponse&) { return false; }
+
+#endif
+
+InspectionServerStats InspectionServer::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    return m_stats;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -3,86 +3,172 @@
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 #include "P1.h"
 
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+/// <summary>
+/// Fill the overlay of a P1 measurement from the selected profile indices.
+/// </summary>
+/// <param name="overlay">Receives the overlay.</param>
+/// <param name="ROI">The ROI in the image.</param>
+/// <param name="imageSize">The size of the image.</param>
+/// <param name="fromTop">True if the profile runs from the top of the ROI.</param>
+/// <param name="profileLength">The length of the profile: the ROI height.</param>
+/// <param name="peakIndex">The selected peak, -1 if not found.</param>
+/// <param name="valleyIndex">The selected valley, -1 if not found.</param>
+/// <param name="innerValleyIndex">The first valley of the scan, which bounds the inner region, -1 if not searched.</param>
+void fillOverlay(ResultOverlay& overlay, cv::Rect ROI, cv::Size imageSize, bool fromTop, int profileLength,
+                 int peakIndex, int valleyIndex, int innerValleyIndex)
+{
+    [[maybe_unused]] auto toRoiRow = [&](int position) { return fromTop ? profileLength - 1 - position : position; };
+    overlay = ResultOverlay();
+    overlay.ROI = ROI;
+    overlay.rows = true;
+    if (peakIndex >= 0)
+        overlay.peakLine = toRoiRow(peakIndex);
+    if (valleyIndex >= 0)
+        overlay.valleyLine = toRoiRow(valleyIndex);
+    if (valleyIndex >= 0 && innerValleyIndex >= 0) {
+        //Addition: Draw first valley from the top, up to the end of the ROI opposite to the scan origin
+        int innerRow = toRoiRow(innerValleyIndex - 2);
+        cv::Rect ROI2 = fromTop
+            ? cv::Rect(cv::Point(0, 0), cv::Point(ROI.br().x, innerRow + 1))
+            : cv::Rect(cv::Point(0, innerRow), ROI.br());
+        overlay.innerRect = refindROI(ROI2, imageSize);
+    }
+}
+
+} // namespace
+
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 //                                                                   Definition                                                                     //
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
-cv::Mat P1ImageProcessing(const cv::Mat inputImage, cv::Rect ROI)
+GapMeasurement P1Measure(const cv::Mat& inputImage, cv::Rect ROI, const InspectionParams& params, ResultOverlay* overlay)
 {
     //================================================================ Load Image ==================================================================//
-    
+    XVT_PROFILE_STOPWATCH(stopwatch);
     if (inputImage.empty())
     {
         throw std::invalid_argument("Input image is empty.");
     }
-    cv::Mat resultImg = inputImage.clone();
-    cv::cvtColor(resultImg, resultImg, cv::COLOR_GRAY2BGR);
+    if (params.orientation != Orientation::FROM_BOTTOM && params.orientation != Orientation::FROM_TOP)
+    {
+        throw std::invalid_argument("P1 processing scans rows: orientation must be FROM_BOTTOM or FROM_TOP.");
+    }
 
     //================================================================ Setting ROI ==================================================================//
+    // The filters read the ROI in place: no copy of the frame or of the ROI is needed
     ROI = refindROI(ROI, inputImage.size());
-    cv::rectangle(resultImg, ROI, cv::Scalar(0, 255, 0), 2);
-    cv::Mat srcImg = inputImage(ROI).clone();
+    cv::Mat srcImg = inputImage(ROI);
+
+    // The intermediate images and the search buffers are reused from call to call on this thread
+    ProcessingContext& context = ProcessingContext::local();
+    [[maybe_unused]] const size_t allocatedBefore = context.allocatedBytes();
+    XVT_PROFILE_LAP(stopwatch, "prepare");
 
     //================================================================ Find 2 edges to measure the distance =========================================//
     //--------------- Preprocessing ---------------------------------//
-    cv::Mat denoisedImg;
-    cv::fastNlMeansDenoising(srcImg, denoisedImg, 10, 7, 21);
+    // The pyramid mode denoises a downsampled ROI and narrow bands around its edges instead of the full ROI. The strips
+    // need the whole filtered ROI, so they keep the full-resolution path.
+    const bool pyramid = params.pyramidLevels > 0 && params.stripWidth <= 0;
+    auto denoise = [&](const cv::Mat& image) {
+        cv::Mat denoised = context.buffer(ProcessingContext::Buffer::DENOISED, image.size(), image.type());
+        denoiseImage(image, denoised, params.denoise, 10);
+        return denoised;
+    };
 
     //--------------- Calculate Horizontal Profile -----------------//
-    cv::Mat1d horizontalProfileImg(denoisedImg.rows, 1);
-    cv::reduce(denoisedImg, horizontalProfileImg, 1, cv::REDUCE_AVG, CV_64F);
-    std::vector<double> horizontalProfile = cv::Mat_<double>(horizontalProfileImg);
+    // The edges are searched from the bottom. Scanning from the top reverses the profile instead of flipping the image,
+    // and toRoiRow maps a profile index back to the ROI row.
+    const bool fromTop = params.orientation == Orientation::FROM_TOP;
+    const int profileLength = srcImg.rows;
+    [[maybe_unused]] auto toRoiRow = [&](int position) { return fromTop ? profileLength - 1 - position : position; };
 
-    //1st derivative
-    std::vector<double> derivativeProfile(horizontalProfile.size(), 0.0);
-    for (size_t i = 1; i < horizontalProfile.size(); ++i) {
-        derivativeProfile[i] = horizontalProfile[i] - horizontalProfile[i - 1];
+    // Allocation-free search: the buffers are kept in the context and reused across images
+    FindPeak::Workspace& peakWorkspace = context.peakWorkspace;
+    std::vector<FindPeak::PeakInfo>& peaks = context.peaks;
+    std::vector<FindPeak::PeakInfo>& valleys = context.valleys;
+
+    //--------------- Tracked Search --------------------------------//
+    // With the edges of the previous cells as a hint, only two bands around them are denoised. Without a hint, or when the
+    // tracked edges are not trusted, the full search below runs.
+    GapMeasurement measurement;
+    int peakIndex = -1, valleyIndex = -1;
+    const bool tracked = params.stripWidth <= 0
+        && trackEdges(srcImg, 1, fromTop, params, denoise, context, peakIndex, valleyIndex, measurement);
+    if (params.trackWindow > 0) {
+        XVT_PROFILE_COUNT("tracked", tracked);
+        XVT_PROFILE_LAP(stopwatch, "track");
     }
 
-    //----------------- Find Peaks and Valleys --------------------//
-    FindPeak findPeak(FindPeak::Mode::PEAK);
-    std::vector<FindPeak::PeakInfo> peaks;
-    findPeak.setMinDistance(20);
-    findPeak.setMinProminence(5);
-    peaks = findPeak.run(derivativeProfile);
+    cv::Mat denoisedImg = pyramid || tracked ? srcImg : denoise(srcImg);
+    XVT_PROFILE_LAP(stopwatch, "denoise");
 
-    FindPeak findValley(FindPeak::Mode::VALLEY);
-    std::vector<FindPeak::PeakInfo> valleys;
-    findValley.setMinDistance(20);
-    findValley.setMinProminence(5);
-    valleys = findValley.run(derivativeProfile);
-
-    //---------------------- Draw Results -------------------------//
-    // First valley from the bottom
-    if (!valleys.empty()) {
-        cv::line(resultImg(ROI),
-            cv::Point(0, valleys.back().position),
-            cv::Point(resultImg.cols, valleys.back().position),
-            cv::Scalar(255, 0, 255),
-            4
-        );
-        //Addition: Draw first valley from the top
-        cv::Rect ROI2 = cv::Rect(cv::Point(0, valleys.front().position - 2), ROI.br());
-        ROI2 = refindROI(ROI2, resultImg.size());
-        cv::rectangle(resultImg(ROI), ROI2, cv::Scalar(255, 0, 0), 4);
-    }
-
-    // First peak from the bottom
-    if (!peaks.empty()) {
-        cv::line(resultImg(ROI),
-            cv::Point(0, peaks.back().position),
-            cv::Point(resultImg.cols, peaks.back().position),
-            cv::Scalar(0, 255, 255),
-            4
-        );
+    if (tracked) {
+        // Nothing else was searched: no candidates to draw
+        peaks.clear();
+        valleys.clear();
+    }
+    else if (pyramid) {
+        // Candidate edges on the coarse profile, at full-resolution positions
+        pyramidCoarseSearch(srcImg, 1, fromTop, params, denoise, context);
+        XVT_PROFILE_LAP(stopwatch, "coarse_search");
     }
+    else {
+        // Row averages and their 1st derivative, in scan order
+        computeProfile(denoisedImg, 1, fromTop, context.profile, params.denoise == DenoiseMethod::PROFILE ? 7 : 0);
+        XVT_PROFILE_LAP(stopwatch, "profile");
 
-    if(!peaks.empty() && !valleys.empty())
-    {
-        drawDoubleArrow(resultImg(ROI),
-            cv::Point(ROI.width / 2, valleys.back().position),
-            cv::Point(ROI.width / 2, peaks.back().position),
-            cv::Scalar(0, 0, 255)
-        );
+        //----------------- Find Peaks and Valleys --------------------//
+        const std::span<const double> derivativeSpan(context.profile.derivative);
+        FindPeak findPeak(FindPeak::Mode::PEAK);
+        findPeak.setMinDistance(params.minDistance);
+        findPeak.setMinProminence(params.peakProminence);
+        findPeak.run<FindPeak::Mode::PEAK>(derivativeSpan, peaks, peakWorkspace);
+        XVT_PROFILE_COUNT("peak_extrema", peakWorkspace.extrema);
+        XVT_PROFILE_COUNT("peak_prominent", peakWorkspace.prominent);
+        XVT_PROFILE_COUNT("peaks", peaks.size());
+
+        FindPeak findValley(FindPeak::Mode::VALLEY);
+        findValley.setMinDistance(params.minDistance);
+        findValley.setMinProminence(params.valleyProminence);
+        findValley.run<FindPeak::Mode::VALLEY>(derivativeSpan, valleys, peakWorkspace);
+        XVT_PROFILE_COUNT("valley_extrema", peakWorkspace.extrema);
+        XVT_PROFILE_COUNT("valley_prominent", peakWorkspace.prominent);
+        XVT_PROFILE_COUNT("valleys", valleys.size());
+        XVT_PROFILE_LAP(stopwatch, "find_peaks");
+    }
+    const std::vector<double>& derivativeProfile = pyramid || tracked ? context.pyramid.derivative : context.profile.derivative;
+
+    //---------------------- Measure Gap --------------------------//
+    // First peak and first valley from the bottom (the tracked search has measured already)
+    if (!tracked) {
+        peakIndex = peaks.empty() ? -1 : peaks.back().position;
+        valleyIndex = valleys.empty() ? -1 : valleys.back().position;
+        if (pyramid) {
+            // Only the bands around the two selected edges are denoised at full resolution
+            if (peakIndex >= 0)
+                peakIndex = pyramidRefine(srcImg, 1, fromTop, peakIndex, FindPeak::Mode::PEAK, params, denoise, context);
+            if (valleyIndex >= 0)
+                valleyIndex = pyramidRefine(srcImg, 1, fromTop, valleyIndex, FindPeak::Mode::VALLEY, params, denoise, context);
+            XVT_PROFILE_LAP(stopwatch, "refine");
+        }
+        if (peakIndex >= 0 && valleyIndex >= 0) {
+            measureGap(derivativeProfile, peakIndex, valleyIndex, fromTop, params.pixelSizeUm, measurement);
+        }
+    }
+    if (params.stripWidth > 0) {
+        measureStrips(denoisedImg, 1, fromTop, params, true, true, measurement);
+    }
+    XVT_PROFILE_LAP(stopwatch, "measure");
+    XVT_PROFILE_COUNT("bytes_allocated", context.allocatedBytes() - allocatedBefore);
+
+    //---------------------- Result Overlay -----------------------//
+    if (overlay) {
+        fillOverlay(*overlay, ROI, inputImage.size(), fromTop, profileLength, peakIndex, valleyIndex,
+                    valleys.empty() ? -1 : valleys.front().position);
     }
 
     //================================================================ DEBUG: Plot Signal, Peaks and Valleys =========================================//
@@ -95,8 +181,8 @@ cv::Mat P1ImageProcessing(const cv::Mat inputImage, cv::Rect ROI)
     double minVal = *std::min_element(derivativeProfile.begin(), derivativeProfile.end());
     for (size_t i = 1; i < derivativeProfile.size(); ++i) {
         cv::line(debugImg,
-            cv::Point(static_cast<int>(debugImg.cols - static_cast<int>((derivativeProfile[i - 1] - minVal) / (maxVal - minVal) * debugImg.cols)), static_cast<int>(i - 1)),
-            cv::Point(static_cast<int>(debugImg.cols - static_cast<int>((derivativeProfile[i] - minVal) / (maxVal - minVal) * debugImg.cols)), static_cast<int>(i)),
+            cv::Point(static_cast<int>(debugImg.cols - static_cast<int>((derivativeProfile[i - 1] - minVal) / (maxVal - minVal) * debugImg.cols)), toRoiRow(static_cast<int>(i - 1))),
+            cv::Point(static_cast<int>(debugImg.cols - static_cast<int>((derivativeProfile[i] - minVal) / (maxVal - minVal) * debugImg.cols)), toRoiRow(static_cast<int>(i))),
             cv::Scalar(0, 255, 0),
             1
         );
@@ -105,8 +191,8 @@ cv::Mat P1ImageProcessing(const cv::Mat inputImage, cv::Rect ROI)
     // Draw peaks and valleys
     for (const auto& peak : peaks) {
         cv::line(debugImg,
-            cv::Point(static_cast<int>(0), peak.position),
-            cv::Point(static_cast<int>(debugImg.cols), peak.position),
+            cv::Point(static_cast<int>(0), toRoiRow(peak.position)),
+            cv::Point(static_cast<int>(debugImg.cols), toRoiRow(peak.position)),
             cv::Scalar(0, 0, 255),
             2
         );
@@ -114,8 +200,8 @@ cv::Mat P1ImageProcessing(const cv::Mat inputImage, cv::Rect ROI)
 
     for (const auto& valley : valleys) {
         cv::line(debugImg,
-            cv::Point(static_cast<int>(0), valley.position),
-            cv::Point(static_cast<int>(debugImg.cols), valley.position),
+            cv::Point(static_cast<int>(0), toRoiRow(valley.position)),
+            cv::Point(static_cast<int>(debugImg.cols), toRoiRow(valley.position)),
             cv::Scalar(255, 0, 0),
             2
         );
@@ -123,8 +209,98 @@ cv::Mat P1ImageProcessing(const cv::Mat inputImage, cv::Rect ROI)
 
 #endif // DEBUG
 
-    return resultImg;
+    return measurement;
+}
+
+std::vector<GapMeasurement> P1MeasureBatch(std::span<const cv::Mat> images, cv::Rect ROI, const InspectionParams& params,
+                                           std::vector<ResultOverlay>* overlays)
+{
+    XVT_PROFILE_STOPWATCH(stopwatch);
+    const int count = static_cast<int>(images.size());
+    std::vector<GapMeasurement> measurements(count);
+    if (overlays)
+        overlays->assign(count, ResultOverlay());
+    if (count == 0)
+        return measurements;
+    for (const cv::Mat& image : images) {
+        if (image.empty() || image.size() != images[0].size() || image.type() != images[0].type())
+            throw std::invalid_argument("Batch images must be non-empty and share one size and type.");
+    }
+    if (params.orientation != Orientation::FROM_BOTTOM && params.orientation != Orientation::FROM_TOP)
+    {
+        throw std::invalid_argument("P1 processing scans rows: orientation must be FROM_BOTTOM or FROM_TOP.");
+    }
+
+    // The pyramid and tracked searches filter bands picked per frame: nothing to share across the batch
+    const bool tracking = params.trackWindow > 0 && params.trackPeak >= 0.0 && params.trackValley >= 0.0;
+    if ((params.pyramidLevels > 0 || tracking) && params.stripWidth <= 0) {
+        for (int i = 0; i < count; ++i)
+            measurements[i] = P1Measure(images[i], ROI, params, overlays ? &(*overlays)[i] : nullptr);
+        return measurements;
+    }
+
+    ROI = refindROI(ROI, images[0].size());
+    ProcessingContext& context = ProcessingContext::local();
+    const int profileLength = ROI.height;
+    cv::Mat batch = context.buffer(ProcessingContext::Buffer::BATCH, cv::Size(ROI.width, profileLength * count), images[0].type());
+    XVT_PROFILE_LAP(stopwatch, "prepare");
+
+    //--------------- Preprocessing ---------------------------------//
+    // Each ROI is denoised from its frame straight into its slot of the stack, the frames in parallel
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; ++i) {
+            cv::Mat slot = batch.rowRange(i * profileLength, (i + 1) * profileLength);
+            cv::Mat denoised = slot;
+            denoiseImage(images[i](ROI), denoised, params.denoise, 10);
+            if (denoised.data != slot.data) // the PROFILE backend hands back its input
+                denoised.copyTo(slot);
+        }
+    });
+    XVT_PROFILE_LAP(stopwatch, "denoise");
+
+    //--------------- Profiles of the Whole Stack -------------------//
+    const bool fromTop = params.orientation == Orientation::FROM_TOP;
+    computeProfileBatch(batch, count, 1, fromTop, context.profile, params.denoise == DenoiseMethod::PROFILE ? 7 : 0);
+    XVT_PROFILE_LAP(stopwatch, "profile");
 
+    //--------------- Edges and Gap of Each Frame -------------------//
+    // First peak and first valley from the bottom, as in P1Measure
+    FindPeak findPeak(FindPeak::Mode::PEAK);
+    findPeak.setMinDistance(params.minDistance);
+    findPeak.setMinProminence(params.peakProminence);
+    FindPeak findValley(FindPeak::Mode::VALLEY);
+    findValley.setMinDistance(params.minDistance);
+    findValley.setMinProminence(params.valleyProminence);
+    std::vector<FindPeak::PeakInfo>& peaks = context.peaks;
+    std::vector<FindPeak::PeakInfo>& valleys = context.valleys;
+    for (int i = 0; i < count; ++i) {
+        const std::span<const double> derivative(context.profile.derivative.data() + static_cast<size_t>(i) * profileLength, profileLength);
+        findPeak.run<FindPeak::Mode::PEAK>(derivative, peaks, context.peakWorkspace);
+        findValley.run<FindPeak::Mode::VALLEY>(derivative, valleys, context.peakWorkspace);
+
+        const int peakIndex = peaks.empty() ? -1 : peaks.back().position;
+        const int valleyIndex = valleys.empty() ? -1 : valleys.back().position;
+        if (peakIndex >= 0 && valleyIndex >= 0)
+            measureGap(derivative, peakIndex, valleyIndex, fromTop, params.pixelSizeUm, measurements[i]);
+        if (params.stripWidth > 0)
+            measureStrips(batch.rowRange(i * profileLength, (i + 1) * profileLength), 1, fromTop, params, true, true, measurements[i]);
+        if (overlays)
+            fillOverlay((*overlays)[i], ROI, images[i].size(), fromTop, profileLength, peakIndex, valleyIndex,
+                        valleys.empty() ? -1 : valleys.front().position);
+    }
+    XVT_PROFILE_LAP(stopwatch, "measure");
+    XVT_PROFILE_COUNT("batch_size", count);
+    return measurements;
+}
+
+cv::Mat P1ImageProcessing(const cv::Mat inputImage, cv::Rect ROI, const InspectionParams& params,
+                          GapMeasurement* measurement)
+{
+    ResultOverlay overlay;
+    GapMeasurement result = P1Measure(inputImage, ROI, params, &overlay);
+    if (measurement)
+        *measurement = result;
+    return drawResult(inputImage, overlay);
 }
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -3,95 +3,244 @@
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 #include "P6.h"
 
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+/// <summary>
+/// CLAHE of the whole ROI. Its 8x8 tiles equalize their own histograms, so it must not run on a narrow band: the tiles
+/// would shrink to a few pixels and flatten the edge step.
+/// </summary>
+/// <param name="image">The ROI. (8UC1 or 16UC1)</param>
+/// <param name="context">The context whose CLAHE buffer receives the result.</param>
+/// <param name="lap">Called with the name of the stage when it is done, for the profiler.</param>
+/// <returns>The contrast-enhanced ROI, a view into a buffer of the context.</returns>
+template <typename Lap>
+cv::Mat equalizeImage(const cv::Mat& image, ProcessingContext& context, Lap&& lap)
+{
+    cv::Mat claheImg = context.buffer(ProcessingContext::Buffer::CLAHE, image.size(), image.type());
+    CLAHEOpenCV(image, claheImg, context, 3.0, cv::Size(8, 8));
+    lap("clahe");
+    return claheImg;
+}
+
+/// <summary>
+/// Denoising, and the bilateral filter that cleans up the NLM output (the cheaper backends replace both filters).
+/// Local filters only: the band filter of the pyramid and tracked searches.
+/// </summary>
+/// <param name="claheImg">The contrast-enhanced ROI, or a band of it. (8UC1 or 16UC1)</param>
+/// <param name="params">The kernel parameters.</param>
+/// <param name="context">The context whose buffers receive the intermediate images.</param>
+/// <param name="lap">Called with the name of each stage when it is done, for the profiler.</param>
+/// <returns>The filtered image, a view into a buffer of the context.</returns>
+template <typename Lap>
+cv::Mat filterImage(const cv::Mat& claheImg, const InspectionParams& params, ProcessingContext& context, Lap&& lap)
+{
+    // Denoising
+    cv::Mat denoisedImg = context.buffer(ProcessingContext::Buffer::DENOISED, claheImg.size(), claheImg.type());
+    denoiseImage(claheImg, denoisedImg, params.denoise, 15);
+    lap("denoise");
+
+    if (params.denoise != DenoiseMethod::NLM)
+        return denoisedImg;
+
+    cv::Mat blurImg = context.buffer(ProcessingContext::Buffer::BLURRED, denoisedImg.size(), denoisedImg.type());
+    if (denoisedImg.depth() == CV_16U) {
+        // The bilateral filter has no 16-bit variant: filter in float, with the colour sigma on the 16-bit scale
+        cv::Mat src32 = context.buffer(ProcessingContext::Buffer::FLOAT_SRC, denoisedImg.size(), CV_32FC1);
+        cv::Mat dst32 = context.buffer(ProcessingContext::Buffer::FLOAT_DST, denoisedImg.size(), CV_32FC1);
+        denoisedImg.convertTo(src32, CV_32F);
+        cv::bilateralFilter(src32, dst32, 9, 75 * U16_PER_U8, 150);
+        dst32.convertTo(blurImg, CV_16U);
+    }
+    else {
+        cv::bilateralFilter(denoisedImg, blurImg, 9, 75, 150);
+    }
+    lap("bilateral");
+    return blurImg;
+}
+
+/// <summary>
+/// The whole filter chain of the full-resolution path: CLAHE, then the local filters.
+/// </summary>
+/// <param name="image">The ROI. (8UC1 or 16UC1)</param>
+/// <param name="params">The kernel parameters.</param>
+/// <param name="context">The context whose buffers receive the intermediate images.</param>
+/// <param name="claheImg">Receives the contrast-enhanced ROI.</param>
+/// <param name="lap">Called with the name of each stage when it is done, for the profiler.</param>
+/// <returns>The filtered ROI, a view into a buffer of the context.</returns>
+template <typename Lap>
+cv::Mat preprocessImage(const cv::Mat& image, const InspectionParams& params, ProcessingContext& context, cv::Mat& claheImg, Lap&& lap)
+{
+    claheImg = equalizeImage(image, context, lap);
+    return filterImage(claheImg, params, context, lap);
+}
+
+/// <summary>
+/// Fill the overlay of a P6 measurement from the selected profile indices.
+/// </summary>
+/// <param name="overlay">Receives the overlay.</param>
+/// <param name="ROI">The ROI in the image.</param>
+/// <param name="fromRight">True if the profile runs from the right of the ROI.</param>
+/// <param name="profileLength">The length of the profile: the ROI width.</param>
+/// <param name="peakIndex">The selected peak, -1 if not found.</param>
+/// <param name="valleyIndex">The selected valley, -1 if not found.</param>
+/// <param name="innerValleyIndex">The first valley of the scan, which bounds the inner region, -1 if not searched.</param>
+void fillOverlay(ResultOverlay& overlay, cv::Rect ROI, bool fromRight, int profileLength, int peakIndex, int valleyIndex,
+                 int innerValleyIndex)
+{
+    auto toRoiCol = [&](int position) { return fromRight ? profileLength - 1 - position : position; };
+    overlay = ResultOverlay();
+    overlay.ROI = ROI;
+    overlay.rows = false;
+    overlay.lineType = cv::LINE_AA;
+    if (peakIndex >= 0)
+        overlay.peakLine = toRoiCol(peakIndex);
+    if (valleyIndex >= 0)
+        overlay.valleyLine = toRoiCol(valleyIndex);
+    if (valleyIndex >= 0 && innerValleyIndex >= 0) {
+        //Addition: Draw first valley from the left, up to the end of the ROI opposite to the scan origin
+        int innerCol = toRoiCol(innerValleyIndex);
+        overlay.innerRect = fromRight
+            ? cv::Rect(cv::Point(0, 0), cv::Point(innerCol + 1, ROI.br().y))
+            : cv::Rect(cv::Point(innerCol, 0), ROI.br());
+    }
+}
+
+} // namespace
+
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 //                                                                      Definition                                                                  //
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
 
-cv::Mat P6ImageProcessing(const cv::Mat inputImage, cv::Rect ROI) {
+GapMeasurement P6Measure(const cv::Mat& inputImage, cv::Rect ROI, const InspectionParams& params, ResultOverlay* overlay) {
     //================================================================ Load Image ==================================================================//
+    XVT_PROFILE_STOPWATCH(stopwatch);
     if (inputImage.empty()) {
         std::cerr << "Error loading image: " << std::endl;
     }
-    cv::Mat resultImg = inputImage.clone();
-    cv::cvtColor(resultImg, resultImg, cv::COLOR_GRAY2BGR);
+    if (params.orientation != Orientation::FROM_LEFT && params.orientation != Orientation::FROM_RIGHT) {
+        throw std::invalid_argument("P6 processing scans columns: orientation must be FROM_LEFT or FROM_RIGHT.");
+    }
 
     //================================================================ Setting ROI ==================================================================//
+    // The filters read the ROI in place: no copy of the frame or of the ROI is needed
     ROI = refindROI(ROI, inputImage.size());
-    cv::rectangle(resultImg, ROI, cv::Scalar(0, 255, 0), 2);
-    cv::Mat srcImg = inputImage(ROI).clone();
+    cv::Mat srcImg = inputImage(ROI);
+
+    // The intermediate images, the CLAHE instance and the search buffers are reused from call to call on this thread
+    ProcessingContext& context = ProcessingContext::local();
+    [[maybe_unused]] const size_t allocatedBefore = context.allocatedBytes();
+    XVT_PROFILE_LAP(stopwatch, "prepare");
 
     //================================================================ Find 2 edges to measure the distance =========================================//
     //--------------- Preprocessing ---------------------------------//
+    // CLAHE, denoising, and the bilateral filter that cleans up the NLM output (the cheaper backends replace both filters).
+    // The pyramid mode equalizes the whole ROI once, then runs the local filters on a downsampled copy and on narrow bands
+    // around its edges instead of the full ROI. The strips need the whole filtered ROI, so they keep the full-resolution path.
+    const bool pyramid = params.pyramidLevels > 0 && params.stripWidth <= 0;
     cv::Mat claheImg;
-    CLAHEOpenCV(srcImg, claheImg, 3.0, cv::Size(8, 8));
-
-    // Denoising
-    cv::Mat denoisedImg;
-    cv::fastNlMeansDenoising(claheImg, denoisedImg, 15, 7, 21);
-
-    cv::Mat blurImg;
-    cv::bilateralFilter(denoisedImg, blurImg, 9, 75, 150);
+    auto lap = [&]([[maybe_unused]] const char* stage) { XVT_PROFILE_LAP(stopwatch, stage); };
+    auto preprocess = [&](const cv::Mat& image) { return preprocessImage(image, params, context, claheImg, lap); };
+    auto bandFilter = [&](const cv::Mat& image) { return filterImage(image, params, context, lap); };
 
     //---------------- Calculate Vertical Profile -------------------//
-    // Vertical Profile
-    std::vector<double> verticalProfile(blurImg.cols, 0.0);
-    cv::reduce(blurImg, verticalProfile, 0, cv::REDUCE_AVG, CV_64F);
+    // The edges are searched from the left. Scanning from the right reverses the profile instead of flipping the image,
+    // and toRoiCol maps a profile index back to the ROI column.
+    const bool fromRight = params.orientation == Orientation::FROM_RIGHT;
+    const int profileLength = srcImg.cols;
+    [[maybe_unused]] auto toRoiCol = [&](int position) { return fromRight ? profileLength - 1 - position : position; };
+
+    // Allocation-free search: the buffers are kept in the context and reused across images
+    FindPeak::Workspace& peakWorkspace = context.peakWorkspace;
+    std::vector<FindPeak::PeakInfo>& peaks = context.peaks;
+    std::vector<FindPeak::PeakInfo>& valleys = context.valleys;
 
-    // 1st derivative
-    std::vector<double> derivativeProfile(verticalProfile.size(), 0.0);
-    for (size_t i = 1; i < verticalProfile.size(); ++i) {
-        derivativeProfile[i] = verticalProfile[i] - verticalProfile[i - 1];
+    //--------------- Tracked Search --------------------------------//
+    // With the edges of the previous cells as a hint, only two bands around them go through the local filters, on the
+    // CLAHE of the whole ROI like the full search. Without a hint, or when the tracked edges are not trusted, the full
+    // search below runs and reuses that CLAHE.
+    GapMeasurement measurement;
+    int peakIndex = -1, valleyIndex = -1;
+    const bool trackable = params.stripWidth <= 0 && params.trackWindow > 0 && params.trackPeak >= 0.0 && params.trackValley >= 0.0;
+    if (trackable)
+        claheImg = equalizeImage(srcImg, context, lap);
+    const bool tracked = trackable
+        && trackEdges(claheImg, 0, fromRight, params, bandFilter, context, peakIndex, valleyIndex, measurement);
+    if (params.trackWindow > 0) {
+        XVT_PROFILE_COUNT("tracked", tracked);
+        XVT_PROFILE_LAP(stopwatch, "track");
     }
 
-    //----------------- Find Peaks and Valleys --------------------//
-    // Find the Distance
-    FindPeak findPeak(FindPeak::Mode::PEAK);
-    std::vector<FindPeak::PeakInfo> peaks;
-    findPeak.setMinDistance(20);
-    findPeak.setMinProminence(5);
-    peaks = findPeak.run(derivativeProfile);
+    cv::Mat blurImg = pyramid || tracked ? srcImg : claheImg.empty() ? preprocess(srcImg) : bandFilter(claheImg);
 
-    FindPeak findValley(FindPeak::Mode::VALLEY);
-    std::vector<FindPeak::PeakInfo> valleys;
-    findValley.setMinDistance(20);
-    findValley.setMinProminence(4);
-    valleys = findValley.run(derivativeProfile);
-
-    //---------------------- Draw Results -------------------------//
-    // First peak from the left
-    if (!peaks.empty()) {
-        cv::line(resultImg(ROI),
-            cv::Point(peaks.front().position, 0),
-            cv::Point(peaks.front().position, resultImg.rows),
-            cv::Scalar(0, 255, 255),
-            4,
-            cv::LINE_AA
-        );
+    if (tracked) {
+        // Nothing else was searched: no candidates to draw
+        peaks.clear();
+        valleys.clear();
     }
+    else if (pyramid) {
+        // Candidate edges on the coarse profile, at full-resolution positions
+        if (claheImg.empty())
+            claheImg = equalizeImage(srcImg, context, lap);
+        pyramidCoarseSearch(claheImg, 0, fromRight, params, bandFilter, context);
+        XVT_PROFILE_LAP(stopwatch, "coarse_search");
+    }
+    else {
+        // Column averages and their 1st derivative, in scan order
+        computeProfile(blurImg, 0, fromRight, context.profile, params.denoise == DenoiseMethod::PROFILE ? 7 : 0);
+        XVT_PROFILE_LAP(stopwatch, "profile");
 
-    // First valley from the right
-    if (!valleys.empty()) {
-        cv::line(resultImg(ROI),
-            cv::Point(valleys.back().position, 0),
-            cv::Point(valleys.back().position, resultImg.rows),
-            cv::Scalar(255, 0, 255),
-            4,
-            cv::LINE_AA
-        );
+        //----------------- Find Peaks and Valleys --------------------//
+        // Find the Distance
+        const std::span<const double> derivativeSpan(context.profile.derivative);
+        FindPeak findPeak(FindPeak::Mode::PEAK);
+        findPeak.setMinDistance(params.minDistance);
+        findPeak.setMinProminence(params.peakProminence);
+        findPeak.run<FindPeak::Mode::PEAK>(derivativeSpan, peaks, peakWorkspace);
+        XVT_PROFILE_COUNT("peak_extrema", peakWorkspace.extrema);
+        XVT_PROFILE_COUNT("peak_prominent", peakWorkspace.prominent);
+        XVT_PROFILE_COUNT("peaks", peaks.size());
 
-        //Addition: Draw first valley from the left
-        cv::Rect ROI2 = cv::Rect(cv::Point(valleys.front().position, 0),
-            ROI.br());
-        cv::rectangle(resultImg(ROI), ROI2, cv::Scalar(255, 0, 0), 4, cv::LINE_AA);
+        FindPeak findValley(FindPeak::Mode::VALLEY);
+        findValley.setMinDistance(params.minDistance);
+        findValley.setMinProminence(params.valleyProminence);
+        findValley.run<FindPeak::Mode::VALLEY>(derivativeSpan, valleys, peakWorkspace);
+        XVT_PROFILE_COUNT("valley_extrema", peakWorkspace.extrema);
+        XVT_PROFILE_COUNT("valley_prominent", peakWorkspace.prominent);
+        XVT_PROFILE_COUNT("valleys", valleys.size());
+        XVT_PROFILE_LAP(stopwatch, "find_peaks");
     }
+    const std::vector<double>& derivativeProfile = pyramid || tracked ? context.pyramid.derivative : context.profile.derivative;
 
-    // Draw double arrow
-    if (!peaks.empty() && !valleys.empty()) {
-        drawDoubleArrow(resultImg(ROI),
-            cv::Point(peaks.front().position, ROI.height / 2),
-            cv::Point(valleys.back().position, ROI.height / 2),
-            cv::Scalar(0, 0, 255)
-        );
+    //---------------------- Measure Gap --------------------------//
+    // First peak from the left, first valley from the right (the tracked search has measured already)
+    if (!tracked) {
+        peakIndex = peaks.empty() ? -1 : peaks.front().position;
+        valleyIndex = valleys.empty() ? -1 : valleys.back().position;
+        if (pyramid) {
+            // Only the bands around the two selected edges go through the filter chain at full resolution
+            if (peakIndex >= 0)
+                peakIndex = pyramidRefine(claheImg, 0, fromRight, peakIndex, FindPeak::Mode::PEAK, params, bandFilter, context);
+            if (valleyIndex >= 0)
+                valleyIndex = pyramidRefine(claheImg, 0, fromRight, valleyIndex, FindPeak::Mode::VALLEY, params, bandFilter, context);
+            XVT_PROFILE_LAP(stopwatch, "refine");
+        }
+        if (peakIndex >= 0 && valleyIndex >= 0) {
+            measureGap(derivativeProfile, peakIndex, valleyIndex, fromRight, params.pixelSizeUm, measurement);
+        }
+    }
+    if (params.stripWidth > 0) {
+        measureStrips(blurImg, 0, fromRight, params, false, true, measurement);
+    }
+    XVT_PROFILE_LAP(stopwatch, "measure");
+    XVT_PROFILE_COUNT("bytes_allocated", context.allocatedBytes() - allocatedBefore);
+
+    //---------------------- Result Overlay -----------------------//
+    if (overlay) {
+        fillOverlay(*overlay, ROI, fromRight, profileLength, peakIndex, valleyIndex,
+                    valleys.empty() ? -1 : valleys.front().position);
     }
 
     //================================================================ DEBUG ==================================================================//
@@ -105,8 +254,8 @@ cv::Mat P6ImageProcessing(const cv::Mat inputImage, cv::Rect ROI) {
 
     for (size_t i = 1; i < derivativeProfile.size(); ++i) {
         cv::line(debugImg,
-            cv::Point(static_cast<int>(i - 1), static_cast<int>(debugImg.rows - (derivativeProfile[i - 1] - minVal) / (maxVal - minVal) * debugImg.rows)),
-            cv::Point(static_cast<int>(i), static_cast<int>(debugImg.rows - (derivativeProfile[i] - minVal) / (maxVal - minVal) * debugImg.rows)),
+            cv::Point(toRoiCol(static_cast<int>(i - 1)), static_cast<int>(debugImg.rows - (derivativeProfile[i - 1] - minVal) / (maxVal - minVal) * debugImg.rows)),
+            cv::Point(toRoiCol(static_cast<int>(i)), static_cast<int>(debugImg.rows - (derivativeProfile[i] - minVal) / (maxVal - minVal) * debugImg.rows)),
             cv::Scalar(0, 255, 0),
             1
         );
@@ -115,8 +264,8 @@ cv::Mat P6ImageProcessing(const cv::Mat inputImage, cv::Rect ROI) {
     // Draw peaks and valleys
     for (const auto& peak : peaks) {
         cv::line(debugImg,
-            cv::Point(static_cast<int>(peak.position), static_cast<int>(0)),
-            cv::Point(static_cast<int>(peak.position), static_cast<int>(debugImg.rows)),
+            cv::Point(toRoiCol(peak.position), static_cast<int>(0)),
+            cv::Point(toRoiCol(peak.position), static_cast<int>(debugImg.rows)),
             cv::Scalar(0, 0, 255),
             2
         );
@@ -124,15 +273,104 @@ cv::Mat P6ImageProcessing(const cv::Mat inputImage, cv::Rect ROI) {
 
     for (const auto& valley : valleys) {
         cv::line(debugImg,
-            cv::Point(static_cast<int>(valley.position), static_cast<int>(0)),
-            cv::Point(static_cast<int>(valley.position), static_cast<int>(debugImg.rows)),
+            cv::Point(toRoiCol(valley.position), static_cast<int>(0)),
+            cv::Point(toRoiCol(valley.position), static_cast<int>(debugImg.rows)),
             cv::Scalar(255, 0, 0),
             2
         );
     }
 #endif
 
-    return resultImg;
+    return measurement;
+}
+
+std::vector<GapMeasurement> P6MeasureBatch(std::span<const cv::Mat> images, cv::Rect ROI, const InspectionParams& params,
+                                           std::vector<ResultOverlay>* overlays)
+{
+    XVT_PROFILE_STOPWATCH(stopwatch);
+    const int count = static_cast<int>(images.size());
+    std::vector<GapMeasurement> measurements(count);
+    if (overlays)
+        overlays->assign(count, ResultOverlay());
+    if (count == 0)
+        return measurements;
+    for (const cv::Mat& image : images) {
+        if (image.empty() || image.size() != images[0].size() || image.type() != images[0].type())
+            throw std::invalid_argument("Batch images must be non-empty and share one size and type.");
+    }
+    if (params.orientation != Orientation::FROM_LEFT && params.orientation != Orientation::FROM_RIGHT) {
+        throw std::invalid_argument("P6 processing scans columns: orientation must be FROM_LEFT or FROM_RIGHT.");
+    }
+
+    // The pyramid and tracked searches filter bands picked per frame: nothing to share across the batch
+    const bool tracking = params.trackWindow > 0 && params.trackPeak >= 0.0 && params.trackValley >= 0.0;
+    if ((params.pyramidLevels > 0 || tracking) && params.stripWidth <= 0) {
+        for (int i = 0; i < count; ++i)
+            measurements[i] = P6Measure(images[i], ROI, params, overlays ? &(*overlays)[i] : nullptr);
+        return measurements;
+    }
+
+    ROI = refindROI(ROI, images[0].size());
+    ProcessingContext& context = ProcessingContext::local();
+    const int profileLength = ROI.width;
+    cv::Mat batch = context.buffer(ProcessingContext::Buffer::BATCH, cv::Size(profileLength, ROI.height * count), images[0].type());
+    XVT_PROFILE_LAP(stopwatch, "prepare");
+
+    //--------------- Preprocessing ---------------------------------//
+    // The filter chain of each ROI runs on the thread that takes it, with that thread's buffers; the result is copied into
+    // its slot of the stack
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& range) {
+        ProcessingContext& local = ProcessingContext::local();
+        cv::Mat claheImg;
+        for (int i = range.start; i < range.end; ++i) {
+            cv::Mat filtered = preprocessImage(images[i](ROI), params, local, claheImg, [](const char*) {});
+            cv::Mat slot = batch.rowRange(i * ROI.height, (i + 1) * ROI.height);
+            filtered.copyTo(slot);
+        }
+    });
+    XVT_PROFILE_LAP(stopwatch, "preprocess");
+
+    //--------------- Profiles of the Whole Stack -------------------//
+    const bool fromRight = params.orientation == Orientation::FROM_RIGHT;
+    computeProfileBatch(batch, count, 0, fromRight, context.profile, params.denoise == DenoiseMethod::PROFILE ? 7 : 0);
+    XVT_PROFILE_LAP(stopwatch, "profile");
+
+    //--------------- Edges and Gap of Each Frame -------------------//
+    // First peak from the left, first valley from the right, as in P6Measure
+    FindPeak findPeak(FindPeak::Mode::PEAK);
+    findPeak.setMinDistance(params.minDistance);
+    findPeak.setMinProminence(params.peakProminence);
+    FindPeak findValley(FindPeak::Mode::VALLEY);
+    findValley.setMinDistance(params.minDistance);
+    findValley.setMinProminence(params.valleyProminence);
+    std::vector<FindPeak::PeakInfo>& peaks = context.peaks;
+    std::vector<FindPeak::PeakInfo>& valleys = context.valleys;
+    for (int i = 0; i < count; ++i) {
+        const std::span<const double> derivative(context.profile.derivative.data() + static_cast<size_t>(i) * profileLength, profileLength);
+        findPeak.run<FindPeak::Mode::PEAK>(derivative, peaks, context.peakWorkspace);
+        findValley.run<FindPeak::Mode::VALLEY>(derivative, valleys, context.peakWorkspace);
+
+        const int peakIndex = peaks.empty() ? -1 : peaks.front().position;
+        const int valleyIndex = valleys.empty() ? -1 : valleys.back().position;
+        if (peakIndex >= 0 && valleyIndex >= 0)
+            measureGap(derivative, peakIndex, valleyIndex, fromRight, params.pixelSizeUm, measurements[i]);
+        if (params.stripWidth > 0)
+            measureStrips(batch.rowRange(i * ROI.height, (i + 1) * ROI.height), 0, fromRight, params, false, true, measurements[i]);
+        if (overlays)
+            fillOverlay((*overlays)[i], ROI, fromRight, profileLength, peakIndex, valleyIndex, valleys.empty() ? -1 : valleys.front().position);
+    }
+    XVT_PROFILE_LAP(stopwatch, "measure");
+    XVT_PROFILE_COUNT("batch_size", count);
+    return measurements;
+}
+
+cv::Mat P6ImageProcessing(const cv::Mat inputImage, cv::Rect ROI, const InspectionParams& params,
+                          GapMeasurement* measurement) {
+    ResultOverlay overlay;
+    GapMeasurement result = P6Measure(inputImage, ROI, params, &overlay);
+    if (measurement)
+        *measurement = result;
+    return drawResult(inputImage, overlay);
 }
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
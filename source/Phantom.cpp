@@ -0,0 +1,163 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "Phantom.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+constexpr int ROI_LEAD_IN = 48;     // Jelly roll kept in the ROI before the cathode/separator edge.
+constexpr int ROI_TAIL = 40;        // Can wall kept in the ROI after the anode/can edge.
+constexpr int ROI_SIDE = 16;        // Margin between the ROI and the frame across the scan axis.
+
+/// <summary>
+/// Response of a pixel to a unit step: the step blurred by a Gaussian of the given sigma and integrated over the pixel.
+/// Symmetric about the edge, so the edge of the rendered profile sits exactly where it was placed.
+/// </summary>
+/// <param name="d">The distance from the edge to the pixel centre, in pixels.</param>
+/// <param name="sigma">The sigma of the point spread function, in pixels.</param>
+double stepResponse(double d, double sigma)
+{
+    if (sigma < 1e-3)
+        return std::clamp(d + 0.5, 0.0, 1.0);
+    if (d > 0.5 + 8.0 * sigma) return 1.0;
+    if (d < -0.5 - 8.0 * sigma) return 0.0;
+
+    // Integral of the normal CDF: G(z) = z * Phi(z) + phi(z)
+    auto integral = [](double z) { return z * 0.5 * std::erfc(-z / std::sqrt(2.0)) + std::exp(-0.5 * z * z) / std::sqrt(2.0 * PI); };
+    return sigma * (integral((d + 0.5) / sigma) - integral((d - 0.5) / sigma));
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Definition                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+Phantom makePhantom(const PhantomSpec& spec)
+{
+    // Edges along the scan axis, before the mirroring
+    const double separatorEdge = spec.cathodeEnd;
+    const double anodeEdge = separatorEdge + spec.separatorWidth;
+    const double canEdge = anodeEdge + spec.gap;
+    if (spec.separatorWidth <= 0.0 || spec.gap <= 0.0 || spec.width <= 2 * ROI_SIDE + 8
+        || separatorEdge < ROI_LEAD_IN || std::ceil(canEdge) + ROI_TAIL > spec.length) {
+        throw std::invalid_argument("Phantom edges do not fit in the frame.");
+    }
+
+    //--------------- Torn Separator and Layers --------------------//
+    std::mt19937 rng(spec.seed);
+    const int tornWidth = static_cast<int>(std::lround(std::clamp(spec.tornFraction, 0.0, 1.0) * (spec.width - 2 * ROI_SIDE)));
+    const int tornStart = ROI_SIDE + std::uniform_int_distribution<int>(0, spec.width - 2 * ROI_SIDE - tornWidth)(rng);
+    const double layerPhase = std::uniform_real_distribution<double>(0.0, 2.0 * PI)(rng);
+
+    //--------------- Render ----------------------------------------//
+    // Layers stacked along the rows; the mirroring and the transposition for P6 come last
+    cv::Mat frame(spec.length, spec.width, CV_32F);
+    const double centre = 0.5 * (spec.width - 1);
+    const double slope = std::tan(spec.tiltDeg * PI / 180.0);
+    for (int x = 0; x < spec.width; ++x) {
+        const double shift = (x - centre) * slope;
+        const bool torn = x >= tornStart && x < tornStart + tornWidth;
+        const double layer = spec.layerPeriod > 0.0 ? 0.5 * spec.layerContrast * std::sin(2.0 * PI * x / spec.layerPeriod + layerPhase) : 0.0;
+        const double ramp = spec.beamFalloff * x / (spec.width - 1);
+
+        for (int y = 0; y < spec.length; ++y) {
+            const double s1 = stepResponse(y - separatorEdge - shift, spec.edgeBlur);
+            const double s2 = stepResponse(y - anodeEdge - shift, spec.edgeBlur);
+            const double s3 = stepResponse(y - canEdge - shift, spec.edgeBlur);
+
+            // A torn separator lets the cathode run up to the anode: only the separator/anode edge remains
+            const double cathode = torn ? 1.0 - s2 : 1.0 - s1;
+            const double separator = torn ? 0.0 : s1 - s2;
+            const double anode = s2 - s3;
+            frame.at<float>(y, x) = static_cast<float>(
+                spec.cathodeLevel * cathode + spec.separatorLevel * separator + spec.anodeLevel * anode + spec.canLevel * s3
+                + layer * (cathode + anode) + ramp);
+        }
+    }
+
+    //--------------- Noise -----------------------------------------//
+    // Sensor noise plus quantum noise whose variance grows with the intensity
+    cv::Mat noise(frame.size(), CV_32F);
+    cv::RNG(static_cast<uint64_t>(spec.seed) * 2654435761u + 1u).fill(noise, cv::RNG::NORMAL, 0.0, 1.0);
+    const double readVariance = spec.readNoise * spec.readNoise;
+    for (int y = 0; y < frame.rows; ++y) {
+        float* row = frame.ptr<float>(y);
+        const float* n = noise.ptr<float>(y);
+        for (int x = 0; x < frame.cols; ++x)
+            row[x] += static_cast<float>(n[x] * std::sqrt(readVariance + spec.quantumGain * std::max(0.0f, row[x])));
+    }
+
+    Phantom phantom;
+    phantom.spec = spec;
+    frame.convertTo(phantom.image, CV_16U);
+
+    //--------------- Orientation and Ground Truth ------------------//
+    // Pixel y maps to length - 1 - y when mirrored, and so do the continuous edge positions
+    const int roiStart = static_cast<int>(std::floor(separatorEdge)) - ROI_LEAD_IN;
+    const int roiEnd = static_cast<int>(std::ceil(canEdge)) + ROI_TAIL;
+    auto mirror = [&](double position) { return spec.mirrored ? spec.length - 1 - position : position; };
+    phantom.peakEdge = mirror(anodeEdge);
+    phantom.valleyEdge = mirror(canEdge);
+    phantom.gap = spec.gap;
+
+    const int along = spec.mirrored ? spec.length - roiEnd : roiStart;
+    const int alongSize = roiEnd - roiStart;
+    const int acrossSize = spec.width - 2 * ROI_SIDE;
+    if (spec.mirrored)
+        cv::flip(phantom.image, phantom.image, 0);
+    if (spec.columns) {
+        phantom.image = phantom.image.t();
+        phantom.ROI = cv::Rect(along, ROI_SIDE, alongSize, acrossSize);
+    }
+    else {
+        phantom.ROI = cv::Rect(ROI_SIDE, along, acrossSize, alongSize);
+    }
+    return phantom;
+}
+
+PhantomSpec randomPhantomSpec(unsigned int seed, bool columns, double maxNoise)
+{
+    std::mt19937 rng(seed);
+    auto uniform = [&](double lo, double hi) { return std::uniform_real_distribution<double>(lo, hi)(rng); };
+    auto chance = [&](double p) { return std::bernoulli_distribution(p)(rng); };
+
+    PhantomSpec spec;
+    spec.length = 384;
+    spec.width = 320;
+    spec.columns = columns;
+    spec.mirrored = chance(0.5);
+
+    spec.cathodeEnd = uniform(64.0, 120.0);
+    spec.separatorWidth = uniform(8.0, 40.0);
+    spec.gap = uniform(15.0, 140.0);
+    spec.tiltDeg = uniform(-1.0, 1.0);
+
+    spec.cathodeLevel = uniform(24000.0, 36000.0);
+    spec.separatorLevel = spec.cathodeLevel * uniform(0.45, 0.75);
+    spec.anodeLevel = spec.cathodeLevel * uniform(1.02, 1.25);
+    spec.canLevel = uniform(6000.0, 12000.0);
+    spec.beamFalloff = uniform(0.0, 6000.0);
+    spec.layerContrast = uniform(0.0, 3000.0);
+    spec.layerPeriod = uniform(4.0, 12.0);
+
+    spec.edgeBlur = uniform(0.5, 2.5);
+    spec.readNoise = uniform(std::min(100.0, maxNoise), maxNoise);
+    spec.quantumGain = uniform(0.0, 4.0);
+    spec.tornFraction = chance(0.2) ? uniform(0.05, 0.35) : 0.0;
+    spec.seed = seed;
+    return spec;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
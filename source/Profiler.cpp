@@ -0,0 +1,273 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "Profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+thread_local std::string g_currentPoint;
+thread_local bool g_pointChanged = true;    // The point of the thread changed since its store last resolved it
+const std::string UNNAMED_POINT = "unnamed";
+
+/// <summary>
+/// Escape a name for a JSON string or a Prometheus label value (both use backslash escapes for '"' and '\').
+/// </summary>
+std::string escape(const std::string& text)
+{
+    std::string out;
+    out.reserve(text.size());
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (c == '\n') { out += "\\n"; continue; }
+        out += c;
+    }
+    return out;
+}
+
+/// <summary>
+/// Add the samples of a histogram or a counter to another.
+/// </summary>
+void mergeInto(Profiler::Histogram& total, const Profiler::Histogram& h)
+{
+    total.minMs = total.count == 0 ? h.minMs : std::min(total.minMs, h.minMs);
+    total.maxMs = total.count == 0 ? h.maxMs : std::max(total.maxMs, h.maxMs);
+    for (int i = 0; i < Profiler::BUCKET_COUNT; ++i)
+        total.buckets[i] += h.buckets[i];
+    total.count += h.count;
+    total.sumMs += h.sumMs;
+}
+
+void mergeInto(Profiler::Counter& total, const Profiler::Counter& c)
+{
+    total.min = total.samples == 0 ? c.min : std::min(total.min, c.min);
+    total.max = total.samples == 0 ? c.max : std::max(total.max, c.max);
+    total.samples += c.samples;
+    total.sum += c.sum;
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Definition                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+/// <summary>
+/// The samples of one thread. Its owner takes the lock per sample and the reports take it to read, so it is never
+/// contended while the kernels run. The names are keyed by address; merge groups them by content.
+/// </summary>
+struct Profiler::ThreadStats
+{
+    struct Point
+    {
+        std::unordered_map<const char*, Histogram> stages;
+        std::unordered_map<const char*, Counter> counters;
+    };
+
+    std::mutex mutex;
+    std::map<std::string, Point> points;
+    Point* current = nullptr;   // The point of the owner thread. Map nodes are stable and reset keeps them.
+
+    /// <summary>
+    /// Get the samples of the current point of the owner thread. Called with the lock held.
+    /// </summary>
+    Point& currentPoint()
+    {
+        if (g_pointChanged || current == nullptr) {
+            current = &points[g_currentPoint.empty() ? UNNAMED_POINT : g_currentPoint];
+            g_pointChanged = false;
+        }
+        return *current;
+    }
+};
+
+Profiler& Profiler::instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::setCurrentPoint(const std::string& point)
+{
+    g_currentPoint = point;
+    g_pointChanged = true;
+}
+
+const std::string& Profiler::currentPoint()
+{
+    return g_currentPoint;
+}
+
+Profiler::ThreadStats& Profiler::threadStats()
+{
+    thread_local std::shared_ptr<ThreadStats> stats = [this] {
+        auto created = std::make_shared<ThreadStats>();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads.push_back(created);
+        return created;
+    }();
+    return *stats;
+}
+
+void Profiler::record(const char* stage, double ms)
+{
+    int bucket = static_cast<int>(std::lower_bound(std::begin(BUCKET_BOUNDS_MS), std::end(BUCKET_BOUNDS_MS), ms)
+                                  - std::begin(BUCKET_BOUNDS_MS));
+    ThreadStats& stats = threadStats();
+
+    std::lock_guard<std::mutex> lock(stats.mutex);
+    Histogram& h = stats.currentPoint().stages[stage];
+    h.minMs = h.count == 0 ? ms : std::min(h.minMs, ms);
+    h.maxMs = h.count == 0 ? ms : std::max(h.maxMs, ms);
+    ++h.buckets[bucket];
+    ++h.count;
+    h.sumMs += ms;
+}
+
+void Profiler::count(const char* name, double value)
+{
+    ThreadStats& stats = threadStats();
+
+    std::lock_guard<std::mutex> lock(stats.mutex);
+    Counter& c = stats.currentPoint().counters[name];
+    c.min = c.samples == 0 ? value : std::min(c.min, value);
+    c.max = c.samples == 0 ? value : std::max(c.max, value);
+    ++c.samples;
+    c.sum += value;
+}
+
+void Profiler::reset()
+{
+    // The samples are cleared in place: the other threads may hold a pointer to their current point
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& thread : m_threads) {
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+        for (auto& [point, stats] : thread->points) {
+            for (auto& [stage, h] : stats.stages) h = Histogram();
+            for (auto& [name, c] : stats.counters) c = Counter();
+        }
+    }
+}
+
+std::map<std::string, Profiler::PointStats> Profiler::merge() const
+{
+    std::map<std::string, PointStats> points;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& thread : m_threads) {
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+        for (const auto& [point, stats] : thread->points) {
+            for (const auto& [stage, h] : stats.stages)
+                if (h.count > 0) mergeInto(points[point].stages[stage], h);
+            for (const auto& [name, c] : stats.counters)
+                if (c.samples > 0) mergeInto(points[point].counters[name], c);
+        }
+    }
+    return points;
+}
+
+std::string Profiler::toJson() const
+{
+    std::ostringstream out;
+    out << std::setprecision(6) << "{\n  \"enabled\": " << (enabled ? "true" : "false") << ",\n  \"bucket_bounds_ms\": [";
+    for (int i = 0; i < BUCKET_COUNT - 1; ++i)
+        out << (i ? ", " : "") << BUCKET_BOUNDS_MS[i];
+    out << "],\n  \"points\": {";
+
+    bool firstPoint = true;
+    for (const auto& [point, stats] : merge()) {
+        out << (firstPoint ? "\n" : ",\n") << "    \"" << escape(point) << "\": {\n      \"stages\": {";
+        firstPoint = false;
+
+        bool first = true;
+        for (const auto& [stage, h] : stats.stages) {
+            out << (first ? "\n" : ",\n") << "        \"" << escape(stage) << "\": { \"count\": " << h.count
+                << ", \"sum_ms\": " << h.sumMs << ", \"mean_ms\": " << h.sumMs / h.count
+                << ", \"min_ms\": " << h.minMs << ", \"max_ms\": " << h.maxMs << ", \"buckets\": [";
+            for (int i = 0; i < BUCKET_COUNT; ++i)
+                out << (i ? ", " : "") << h.buckets[i];
+            out << "] }";
+            first = false;
+        }
+        out << "\n      },\n      \"counters\": {";
+
+        first = true;
+        for (const auto& [name, c] : stats.counters) {
+            out << (first ? "\n" : ",\n") << "        \"" << escape(name) << "\": { \"samples\": " << c.samples
+                << ", \"sum\": " << c.sum << ", \"mean\": " << c.sum / c.samples
+                << ", \"min\": " << c.min << ", \"max\": " << c.max << " }";
+            first = false;
+        }
+        out << "\n      }\n    }";
+    }
+    out << "\n  }\n}\n";
+    return out.str();
+}
+
+std::string Profiler::toPrometheus() const
+{
+    std::ostringstream out;
+    out << std::setprecision(6)
+        << "# HELP xvt_stage_duration_ms Duration of an inspection stage in milliseconds.\n"
+        << "# TYPE xvt_stage_duration_ms histogram\n";
+
+    const std::map<std::string, PointStats> points = merge();
+    for (const auto& [point, stats] : points) {
+        for (const auto& [stage, h] : stats.stages) {
+            std::string labels = "point=\"" + escape(point) + "\",stage=\"" + escape(stage) + "\"";
+            long long cumulative = 0;
+            for (int i = 0; i < BUCKET_COUNT; ++i) {
+                cumulative += h.buckets[i];
+                out << "xvt_stage_duration_ms_bucket{" << labels << ",le=\"";
+                if (i < BUCKET_COUNT - 1) out << BUCKET_BOUNDS_MS[i];
+                else out << "+Inf";
+                out << "\"} " << cumulative << '\n';
+            }
+            out << "xvt_stage_duration_ms_sum{" << labels << "} " << h.sumMs << '\n'
+                << "xvt_stage_duration_ms_count{" << labels << "} " << h.count << '\n';
+        }
+    }
+
+    out << "# HELP xvt_counter Per-image value of an inspection counter.\n"
+        << "# TYPE xvt_counter summary\n";
+    for (const auto& [point, stats] : points) {
+        for (const auto& [name, c] : stats.counters) {
+            std::string labels = "point=\"" + escape(point) + "\",name=\"" + escape(name) + "\"";
+            out << "xvt_counter_sum{" << labels << "} " << c.sum << '\n'
+                << "xvt_counter_count{" << labels << "} " << c.samples << '\n';
+        }
+    }
+    return out.str();
+}
+
+bool Profiler::dump(const std::string& filePath) const
+{
+    const bool json = filePath.size() >= 5 && filePath.compare(filePath.size() - 5, 5, ".json") == 0;
+    std::string report = json ? toJson() : toPrometheus();
+
+    std::ofstream file(filePath, std::ios::trunc);
+    if (!file)
+        return false;
+    file << report;
+    return static_cast<bool>(file);
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    double rank = std::clamp(p, 0.0, 100.0) / 100.0 * (values.size() - 1);
+    size_t lo = static_cast<size_t>(rank);
+    size_t hi = std::min(lo + 1, values.size() - 1);
+    return values[lo] + (values[hi] - values[lo]) * (rank - lo);
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
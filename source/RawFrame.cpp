@@ -0,0 +1,194 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "RawFrame.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Definition                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+size_t writeRawFrame(const std::string& filePath, const cv::Mat& image)
+{
+    if (image.empty())
+        return 0;
+
+    RawFrameHeader header;
+    header.rows = image.rows;
+    header.cols = image.cols;
+    header.type = image.type();
+
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return 0;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const size_t rowBytes = image.cols * image.elemSize();
+    if (image.isContinuous()) {
+        file.write(reinterpret_cast<const char*>(image.data), static_cast<std::streamsize>(rowBytes * image.rows));
+    }
+    else {
+        for (int y = 0; y < image.rows; ++y)
+            file.write(reinterpret_cast<const char*>(image.ptr(y)), static_cast<std::streamsize>(rowBytes));
+    }
+    return file ? sizeof(header) + rowBytes * image.rows : 0;
+}
+
+bool isRawFramePath(const std::string& filePath)
+{
+    std::string extension = std::filesystem::path(filePath).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension == ".raw";
+}
+
+MappedRawFrame::MappedRawFrame(const std::string& filePath)
+{
+    if (!open(filePath))
+    {
+        throw std::runtime_error("Cannot map raw frame " + filePath);
+    }
+}
+
+MappedRawFrame::~MappedRawFrame()
+{
+    close();
+}
+
+MappedRawFrame::MappedRawFrame(MappedRawFrame&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedRawFrame& MappedRawFrame::operator=(MappedRawFrame&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        std::swap(m_memory, other.m_memory);
+        std::swap(m_size, other.m_size);
+        std::swap(m_image, other.m_image);
+    }
+    return *this;
+}
+
+bool MappedRawFrame::open(const std::string& filePath)
+{
+    close();
+
+    //--------------- Map the File ----------------------------------//
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize{};
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart >= static_cast<LONGLONG>(sizeof(RawFrameHeader)))
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+        return false;
+    void* memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // the view keeps the mapping alive
+    if (!memory)
+        return false;
+    const size_t size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info {};
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(RawFrameHeader)) {
+        ::close(fd);
+        return false;
+    }
+    const size_t size = static_cast<size_t>(info.st_size);
+    void* memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file open
+    if (memory == MAP_FAILED)
+        return false;
+#endif
+    m_memory = memory;
+    m_size = size;
+
+    //--------------- Validate the Header ---------------------------//
+    RawFrameHeader header;
+    std::memcpy(&header, m_memory, sizeof(header));
+    const bool valid = std::memcmp(header.magic, "XVTR", 4) == 0
+        && header.headerSize >= sizeof(RawFrameHeader)
+        && header.rows > 0 && header.cols > 0 && header.type >= 0 && CV_MAT_CN(header.type) <= 4
+        && header.headerSize + static_cast<uint64_t>(header.rows) * header.cols * CV_ELEM_SIZE(header.type) <= m_size;
+    if (!valid) {
+        close();
+        return false;
+    }
+
+    m_image = cv::Mat(header.rows, header.cols, header.type, static_cast<unsigned char*>(m_memory) + header.headerSize);
+    return true;
+}
+
+void MappedRawFrame::close()
+{
+    m_image.release();
+    if (!m_memory)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(m_memory);
+#else
+    munmap(m_memory, m_size);
+#endif
+    m_memory = nullptr;
+    m_size = 0;
+}
+
+void MappedRawFrame::prefetch(const cv::Rect& region) const
+{
+#ifndef _WIN32
+    cv::Rect r = region & cv::Rect(0, 0, m_image.cols, m_image.rows);
+    if (r.empty())
+        return;
+
+    // Only the rows of the region are converted: no read-ahead of the rest of the frame around them
+    madvise(m_memory, m_size, MADV_RANDOM);
+
+    // Page-aligned byte range from the first to the last row of the region
+    static const uintptr_t PAGE = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(m_image.ptr(r.y, r.x));
+    uintptr_t end = reinterpret_cast<uintptr_t>(m_image.ptr(r.y + r.height - 1, r.x + r.width - 1)) + m_image.elemSize();
+    begin &= ~(PAGE - 1);
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+#else
+    (void)region;
+#endif
+}
+
+void MappedRawFrame::prefetchAll() const
+{
+#ifndef _WIN32
+    if (!m_memory)
+        return;
+
+    // The whole frame is read once, front to back: aggressive read-ahead, and start it now
+    madvise(m_memory, m_size, MADV_SEQUENTIAL);
+    madvise(m_memory, m_size, MADV_WILLNEED);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,436 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "Recipe.h"
+#include "P1.h"
+#include "P6.h"
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+/// <summary>
+/// A value of the recipe with the line it was read from.
+/// </summary>
+struct RecipeValue
+{
+    std::string text;
+    int line;
+};
+
+using RecipeSection = std::map<std::string, RecipeValue>;
+
+/// <summary>
+/// A kernel, its default parameters and the two orientations it can scan.
+/// </summary>
+struct AlgorithmEntry
+{
+    const char* name;
+    MeasureKernel kernel;
+    const InspectionParams* defaults;
+    Orientation orientations[2];
+};
+
+const AlgorithmEntry ALGORITHMS[] = {
+    { "P1", P1Measure, &P1_DEFAULT_PARAMS, { Orientation::FROM_BOTTOM, Orientation::FROM_TOP } },
+    { "P6", P6Measure, &P6_DEFAULT_PARAMS, { Orientation::FROM_LEFT, Orientation::FROM_RIGHT } },
+};
+
+std::string trim(const std::string& s)
+{
+    const char* ws = " \t\r\n";
+    size_t begin = s.find_first_not_of(ws);
+    if (begin == std::string::npos) return "";
+    size_t end = s.find_last_not_of(ws);
+    return s.substr(begin, end - begin + 1);
+}
+
+// '#' and ';' start a comment at the start of the line or after whitespace only, so "/data/line#2" stays a whole value
+std::string stripComment(const std::string& text)
+{
+    for (size_t pos = text.find_first_of("#;"); pos != std::string::npos; pos = text.find_first_of("#;", pos + 1))
+        if (pos == 0 || text[pos - 1] == ' ' || text[pos - 1] == '\t')
+            return text.substr(0, pos);
+    return text;
+}
+
+[[noreturn]] void fail(const std::string& filePath, int line, const std::string& message)
+{
+    throw std::runtime_error(filePath + ":" + std::to_string(line) + ": " + message);
+}
+
+double parseNumber(const std::string& filePath, const RecipeValue& value)
+{
+    size_t used = 0;
+    double number = 0.0;
+    try {
+        number = std::stod(value.text, &used);
+    }
+    catch (const std::exception&) {
+        used = 0;
+    }
+    if (used == 0 || trim(value.text.substr(used)) != "")
+        fail(filePath, value.line, "invalid number '" + value.text + "'");
+    return number;
+}
+
+cv::Rect parseRect(const std::string& filePath, const RecipeValue& value, const std::string& key = "roi")
+{
+    std::stringstream ss(value.text);
+    std::string field;
+    int v[4] = {};
+    int n = 0;
+    while (std::getline(ss, field, ',')) {
+        if (n == 4)
+            fail(filePath, value.line, key + " expects x, y, width, height");
+        v[n++] = static_cast<int>(parseNumber(filePath, { trim(field), value.line }));
+    }
+    if (n != 4 || v[2] <= 0 || v[3] <= 0)
+        fail(filePath, value.line, key + " expects x, y, width, height");
+    return cv::Rect(v[0], v[1], v[2], v[3]);
+}
+
+Orientation parseOrientation(const std::string& filePath, const RecipeValue& value)
+{
+    if (value.text == "top")    return Orientation::FROM_TOP;
+    if (value.text == "bottom") return Orientation::FROM_BOTTOM;
+    if (value.text == "left")   return Orientation::FROM_LEFT;
+    if (value.text == "right")  return Orientation::FROM_RIGHT;
+    fail(filePath, value.line, "invalid orientation '" + value.text + "'");
+}
+
+DenoiseMethod parseDenoise(const std::string& filePath, const RecipeValue& value)
+{
+    if (value.text == "nlm")      return DenoiseMethod::NLM;
+    if (value.text == "gaussian") return DenoiseMethod::GAUSSIAN;
+    if (value.text == "box")      return DenoiseMethod::BOX;
+    if (value.text == "median")   return DenoiseMethod::MEDIAN;
+    if (value.text == "profile")  return DenoiseMethod::PROFILE;
+    fail(filePath, value.line, "invalid denoise method '" + value.text + "'");
+}
+
+/// <summary>
+/// Parse a processing bit depth: 8 or 16.
+/// </summary>
+int parseBitDepth(const std::string& filePath, const RecipeValue& value)
+{
+    if (value.text == "8")  return CV_8U;
+    if (value.text == "16") return CV_16U;
+    fail(filePath, value.line, "invalid bit depth '" + value.text + "', expected 8 or 16");
+}
+
+/// <summary>
+/// Parse a clip percentage, in [0, 49].
+/// </summary>
+double parseClipPercent(const std::string& filePath, const RecipeValue& value)
+{
+    double percent = parseNumber(filePath, value);
+    if (percent < 0.0 || percent > 49.0)
+        fail(filePath, value.line, "clip_percent must be between 0 and 49");
+    return percent;
+}
+
+/// <summary>
+/// Parse the polarity of the cell in the frame: dark (absorbs more than the background) or bright.
+/// </summary>
+bool parseDarkCell(const std::string& filePath, const RecipeValue& value)
+{
+    if (value.text == "dark")   return true;
+    if (value.text == "bright") return false;
+    fail(filePath, value.line, "invalid outline polarity '" + value.text + "', expected dark or bright");
+}
+
+/// <summary>
+/// Parse the decimation of the outline search, at least 1.
+/// </summary>
+int parseDecimation(const std::string& filePath, const RecipeValue& value)
+{
+    double decimation = parseNumber(filePath, value);
+    if (decimation < 1.0)
+        fail(filePath, value.line, "outline_decimation must be at least 1");
+    return static_cast<int>(decimation);
+}
+
+/// <summary>
+/// Parse a result image format: png, jpeg, raw or thumbnail.
+/// </summary>
+ResultFormat parseResultFormat(const std::string& filePath, const RecipeValue& value)
+{
+    if (value.text == "png")       return ResultFormat::PNG;
+    if (value.text == "jpeg")      return ResultFormat::JPEG;
+    if (value.text == "raw")       return ResultFormat::RAW;
+    if (value.text == "thumbnail") return ResultFormat::THUMBNAIL;
+    fail(filePath, value.line, "invalid result format '" + value.text + "'");
+}
+
+/// <summary>
+/// Parse an annotation policy: always, ng, never or "every N".
+/// </summary>
+void parseAnnotation(const std::string& filePath, const RecipeValue& value, AnnotationPolicy& policy, int& every)
+{
+    if (value.text == "always") { policy = AnnotationPolicy::ALWAYS; return; }
+    if (value.text == "ng")     { policy = AnnotationPolicy::NG; return; }
+    if (value.text == "never")  { policy = AnnotationPolicy::NEVER; return; }
+    if (value.text.rfind("every", 0) == 0) {
+        double n = parseNumber(filePath, { trim(value.text.substr(5)), value.line });
+        if (n < 1)
+            fail(filePath, value.line, "annotate every expects a period of at least 1");
+        policy = AnnotationPolicy::EVERY_N;
+        every = static_cast<int>(n);
+        return;
+    }
+    fail(filePath, value.line, "invalid annotate policy '" + value.text + "'");
+}
+
+/// <summary>
+/// Resolve a [name] section into an inspection point.
+/// </summary>
+InspectionPoint makePoint(const std::string& filePath, const Recipe& recipe, const std::string& name,
+                          int sectionLine, const RecipeSection& section)
+{
+    auto find = [&](const char* key) -> const RecipeValue* {
+        auto it = section.find(key);
+        return it == section.end() ? nullptr : &it->second;
+    };
+    auto require = [&](const char* key) -> const RecipeValue& {
+        const RecipeValue* value = find(key);
+        if (!value)
+            fail(filePath, sectionLine, "[" + name + "] is missing '" + key + "'");
+        return *value;
+    };
+
+    const RecipeValue& algorithmValue = require("algorithm");
+    const AlgorithmEntry* algorithm = nullptr;
+    for (const auto& entry : ALGORITHMS)
+        if (algorithmValue.text == entry.name)
+            algorithm = &entry;
+    if (!algorithm)
+        fail(filePath, algorithmValue.line, "unknown algorithm '" + algorithmValue.text + "'");
+
+    InspectionPoint point;
+    point.name = name;
+    point.kernel = algorithm->kernel;
+    point.params = *algorithm->defaults;
+    point.ROI = parseRect(filePath, require("roi"));
+
+    point.outline = recipe.outline;
+    if (const RecipeValue* value = find("reference_outline"))
+        point.referenceOutline = parseRect(filePath, *value, "reference_outline");
+    if (const RecipeValue* value = find("outline_decimation"))
+        point.outline.decimation = parseDecimation(filePath, *value);
+    if (const RecipeValue* value = find("outline_polarity"))
+        point.outline.darkCell = parseDarkCell(filePath, *value);
+
+    if (const RecipeValue* value = find("orientation")) {
+        Orientation orientation = parseOrientation(filePath, *value);
+        if (orientation != algorithm->orientations[0] && orientation != algorithm->orientations[1])
+            fail(filePath, value->line, "orientation '" + value->text + "' is not supported by " + algorithm->name);
+        point.params.orientation = orientation;
+    }
+
+    if (const RecipeValue* value = find("margin"))
+        point.margin = static_cast<int>(parseNumber(filePath, *value));
+    else
+        point.margin = recipe.margin;
+
+    point.depth = recipe.depth;
+    if (const RecipeValue* value = find("bit_depth"))
+        point.depth = parseBitDepth(filePath, *value);
+    point.clipPercent = recipe.clipPercent;
+    if (const RecipeValue* value = find("clip_percent"))
+        point.clipPercent = parseClipPercent(filePath, *value);
+
+    if (const RecipeValue* value = find("denoise"))
+        point.params.denoise = parseDenoise(filePath, *value);
+    if (const RecipeValue* value = find("compare_nlm"))
+        point.compareDenoise = parseNumber(filePath, *value) != 0.0;
+
+    point.params.pixelSizeUm = recipe.pixelSizeUm;
+    if (const RecipeValue* value = find("pixel_size_um"))
+        point.params.pixelSizeUm = parseNumber(filePath, *value);
+
+    point.annotate = recipe.annotate;
+    point.annotateEvery = recipe.annotateEvery;
+    if (const RecipeValue* value = find("annotate"))
+        parseAnnotation(filePath, *value, point.annotate, point.annotateEvery);
+    if (const RecipeValue* value = find("gap_min"))
+        point.gapMin = parseNumber(filePath, *value);
+    if (const RecipeValue* value = find("gap_max"))
+        point.gapMax = parseNumber(filePath, *value);
+
+    if (const RecipeValue* value = find("strip_width"))
+        point.params.stripWidth = static_cast<int>(parseNumber(filePath, *value));
+    if (const RecipeValue* value = find("pyramid_levels")) {
+        point.params.pyramidLevels = static_cast<int>(parseNumber(filePath, *value));
+        if (point.params.pyramidLevels < 0 || point.params.pyramidLevels > 5)
+            fail(filePath, value->line, "pyramid_levels must be between 0 and 5");
+    }
+    if (const RecipeValue* value = find("track_window")) {
+        point.params.trackWindow = static_cast<int>(parseNumber(filePath, *value));
+        if (point.params.trackWindow < 0)
+            fail(filePath, value->line, "track_window must be positive, or 0 to search every cell in full");
+    }
+    if (const RecipeValue* value = find("track_min_confidence")) {
+        point.params.trackMinConfidence = parseNumber(filePath, *value);
+        if (point.params.trackMinConfidence <= 0.0)
+            fail(filePath, value->line, "track_min_confidence must be positive");
+    }
+
+    if (const RecipeValue* value = find("min_distance")) {
+        point.params.minDistance = static_cast<int>(parseNumber(filePath, *value));
+        if (point.params.minDistance < 0)
+            fail(filePath, value->line, "min_distance must be positive or 0");
+    }
+    if (const RecipeValue* value = find("peak_prominence"))
+        point.params.peakProminence = parseNumber(filePath, *value);
+    if (const RecipeValue* value = find("valley_prominence"))
+        point.params.valleyProminence = parseNumber(filePath, *value);
+
+    const RecipeValue* image = find("image");
+    namespace fs = std::filesystem;
+    point.imagePath = (fs::path(recipe.imageDir) / (image ? image->text : name + ".tif")).generic_string();
+    point.resultPath = (fs::path(recipe.resultDir) / (name + "_Result.png")).generic_string();
+    return point;
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Definition                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+Recipe loadRecipe(const std::string& filePath, const std::vector<std::pair<std::string, std::string>>& overrides)
+{
+    std::ifstream file(filePath);
+    if (!file)
+    {
+        throw std::runtime_error("Cannot open recipe " + filePath);
+    }
+
+    static const char* GLOBAL_KEYS[] = { "image_dir", "result_dir", "threads", "max_in_flight", "margin",
+                                         "bit_depth", "clip_percent", "pixel_size_um", "measurement_log", "profile_output",
+                                         "annotate", "result_format", "png_compression", "jpeg_quality", "thumbnail_size",
+                                         "writer_threads", "writer_queue", "writer_drop", "outline_decimation", "outline_polarity" };
+    static const char* POINT_KEYS[] = { "algorithm", "roi", "orientation", "image", "margin", "bit_depth", "clip_percent",
+                                        "denoise", "compare_nlm", "min_distance", "peak_prominence", "valley_prominence",
+                                        "pixel_size_um", "strip_width", "pyramid_levels", "track_window", "track_min_confidence",
+                                        "reference_outline", "outline_decimation", "outline_polarity",
+                                        "annotate", "gap_min", "gap_max" };
+
+    RecipeSection globals;
+    std::vector<std::pair<std::string, int>> sectionNames;
+    std::vector<RecipeSection> sections;
+
+    //--------------- Read Key/Value Pairs --------------------------//
+    std::string text;
+    for (int line = 1; std::getline(file, text); ++line) {
+        text = trim(stripComment(text));
+        if (text.empty())
+            continue;
+
+        if (text.front() == '[') {
+            if (text.back() != ']' || trim(text.substr(1, text.size() - 2)).empty())
+                fail(filePath, line, "invalid section '" + text + "'");
+            std::string name = trim(text.substr(1, text.size() - 2));
+            for (const auto& existing : sectionNames)
+                if (existing.first == name)
+                    fail(filePath, line, "duplicate point [" + name + "]");
+            sectionNames.emplace_back(name, line);
+            sections.emplace_back();
+            continue;
+        }
+
+        size_t eq = text.find('=');
+        if (eq == std::string::npos)
+            fail(filePath, line, "expected 'key = value'");
+        std::string key = trim(text.substr(0, eq));
+        std::string value = trim(text.substr(eq + 1));
+
+        bool known = false;
+        if (sections.empty()) {
+            for (const char* k : GLOBAL_KEYS) known = known || key == k;
+        }
+        else {
+            for (const char* k : POINT_KEYS) known = known || key == k;
+        }
+        if (!known)
+            fail(filePath, line, "unknown key '" + key + "'");
+
+        RecipeSection& section = sections.empty() ? globals : sections.back();
+        if (!section.emplace(key, RecipeValue{ value, line }).second)
+            fail(filePath, line, "duplicate key '" + key + "'");
+    }
+
+    // Command-line overrides replace the global keys of the file
+    for (const auto& [key, value] : overrides) {
+        bool known = false;
+        for (const char* k : GLOBAL_KEYS) known = known || key == k;
+        if (!known)
+            throw std::runtime_error("Unknown recipe key '" + key + "'");
+        globals[key] = RecipeValue{ value, 0 };
+    }
+
+    //--------------- Build the Point Table -------------------------//
+    Recipe recipe;
+    if (auto it = globals.find("image_dir"); it != globals.end())
+        recipe.imageDir = it->second.text;
+    if (auto it = globals.find("result_dir"); it != globals.end())
+        recipe.resultDir = it->second.text;
+    if (auto it = globals.find("threads"); it != globals.end())
+        recipe.threads = static_cast<unsigned int>(std::max(0.0, parseNumber(filePath, it->second)));
+    if (auto it = globals.find("max_in_flight"); it != globals.end())
+        recipe.maxInFlight = static_cast<unsigned int>(std::max(0.0, parseNumber(filePath, it->second)));
+    if (auto it = globals.find("margin"); it != globals.end())
+        recipe.margin = static_cast<int>(parseNumber(filePath, it->second));
+    if (auto it = globals.find("bit_depth"); it != globals.end())
+        recipe.depth = parseBitDepth(filePath, it->second);
+    if (auto it = globals.find("clip_percent"); it != globals.end())
+        recipe.clipPercent = parseClipPercent(filePath, it->second);
+    if (auto it = globals.find("pixel_size_um"); it != globals.end())
+        recipe.pixelSizeUm = parseNumber(filePath, it->second);
+    if (auto it = globals.find("measurement_log"); it != globals.end())
+        recipe.measurementLog = it->second.text;
+    if (auto it = globals.find("profile_output"); it != globals.end())
+        recipe.profileOutput = it->second.text;
+    if (auto it = globals.find("annotate"); it != globals.end())
+        parseAnnotation(filePath, it->second, recipe.annotate, recipe.annotateEvery);
+    if (auto it = globals.find("outline_decimation"); it != globals.end())
+        recipe.outline.decimation = parseDecimation(filePath, it->second);
+    if (auto it = globals.find("outline_polarity"); it != globals.end())
+        recipe.outline.darkCell = parseDarkCell(filePath, it->second);
+
+    ResultWriterOptions& output = recipe.output;
+    if (auto it = globals.find("result_format"); it != globals.end())
+        output.format = parseResultFormat(filePath, it->second);
+    if (auto it = globals.find("png_compression"); it != globals.end())
+        output.pngCompression = std::clamp(static_cast<int>(parseNumber(filePath, it->second)), 0, 9);
+    if (auto it = globals.find("jpeg_quality"); it != globals.end())
+        output.jpegQuality = std::clamp(static_cast<int>(parseNumber(filePath, it->second)), 0, 100);
+    if (auto it = globals.find("thumbnail_size"); it != globals.end())
+        output.thumbnailSize = static_cast<int>(parseNumber(filePath, it->second));
+    if (auto it = globals.find("writer_threads"); it != globals.end())
+        output.threads = static_cast<unsigned int>(std::max(1.0, parseNumber(filePath, it->second)));
+    if (auto it = globals.find("writer_queue"); it != globals.end())
+        output.queueCapacity = static_cast<unsigned int>(std::max(1.0, parseNumber(filePath, it->second)));
+    if (auto it = globals.find("writer_drop"); it != globals.end())
+        output.dropWhenFull = parseNumber(filePath, it->second) != 0.0;
+
+    recipe.points.reserve(sections.size());
+    for (size_t i = 0; i < sections.size(); ++i)
+        recipe.points.push_back(makePoint(filePath, recipe, sectionNames[i].first, sectionNames[i].second, sections[i]));
+
+    if (recipe.points.empty())
+    {
+        throw std::runtime_error("Recipe " + filePath + " has no inspection point");
+    }
+    return recipe;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,176 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "ResultWriter.h"
+#include "RawFrame.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                    Definition                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+
+ResultWriter::ResultWriter(const ResultWriterOptions& options)
+    : m_options(options), m_pool(std::max(1u, options.threads))
+{
+    m_options.queueCapacity = std::max(1u, m_options.queueCapacity);
+}
+
+ResultWriter::~ResultWriter()
+{
+    flush();
+}
+
+std::string ResultWriter::outputPath(const std::string& filePath, ResultFormat format)
+{
+    std::filesystem::path path(filePath);
+    switch (format) {
+    case ResultFormat::PNG:       path.replace_extension(".png"); break;
+    case ResultFormat::JPEG:      path.replace_extension(".jpg"); break;
+    case ResultFormat::RAW:       path.replace_extension(".raw"); break;
+    case ResultFormat::THUMBNAIL: path.replace_extension(".thumb.jpg"); break;
+    }
+    return path.generic_string();
+}
+
+bool ResultWriter::submit(const std::string& name, const std::string& filePath, const cv::Mat& image, const ResultOverlay& overlay)
+{
+    using Clock = std::chrono::steady_clock;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_queued >= m_options.queueCapacity) {
+            if (m_options.dropWhenFull) {
+                ++m_stats.dropped;
+                return false;
+            }
+            auto t0 = Clock::now();
+            m_slotFree.wait(lock, [this] { return m_queued < m_options.queueCapacity; });
+            ++m_stats.blocked;
+            m_stats.blockedMs += std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        }
+        ++m_queued;
+        ++m_stats.submitted;
+        m_stats.maxQueueDepth = std::max(m_stats.maxQueueDepth, m_queued);
+    }
+
+    m_pool.submit([this, name, filePath, image, overlay] {
+        write(name, filePath, image, overlay); // Does not throw: the slot is released whether or not the result was written
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_queued;
+        }
+        m_slotFree.notify_one();
+    });
+    return true;
+}
+
+void ResultWriter::flush()
+{
+    m_pool.wait();
+}
+
+unsigned int ResultWriter::queueDepth() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queued;
+}
+
+ResultWriterStats ResultWriter::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void ResultWriter::write(const std::string& name, const std::string& filePath, const cv::Mat& image, const ResultOverlay& overlay)
+{
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+
+    // Runs on a pool worker, which must not throw: a failure to render, encode or write is counted as a failed result
+    try {
+        XVT_PROFILE_POINT(name);
+        XVT_PROFILE_STOPWATCH(stopwatch);
+        const std::string path = outputPath(filePath, m_options.format);
+
+        //--------------- Render ----------------------------------------//
+        // A thumbnail only renders the ROI plus margin: the overlay is shifted into the crop
+        auto t0 = Clock::now();
+        cv::Mat result;
+        if (m_options.format == ResultFormat::THUMBNAIL && !overlay.ROI.empty()) {
+            const int m = std::max(0, m_options.thumbnailMargin);
+            cv::Rect crop = refindROI(cv::Rect(overlay.ROI.x - m, overlay.ROI.y - m, overlay.ROI.width + 2 * m, overlay.ROI.height + 2 * m),
+                                      image.size());
+            ResultOverlay shifted = overlay;
+            shifted.ROI -= crop.tl();
+            result = drawResult(image(crop), shifted);
+
+            const int longest = std::max(result.cols, result.rows);
+            if (longest > m_options.thumbnailSize && m_options.thumbnailSize > 0) {
+                double scale = static_cast<double>(m_options.thumbnailSize) / longest;
+                cv::resize(result, result, cv::Size(), scale, scale, cv::INTER_AREA);
+            }
+        }
+        else {
+            result = drawResult(image, overlay);
+        }
+        auto t1 = Clock::now();
+        XVT_PROFILE_LAP(stopwatch, "render");
+
+        //--------------- Encode ----------------------------------------//
+        std::vector<uchar> buffer;
+        bool encoded = true;
+        switch (m_options.format) {
+        case ResultFormat::PNG:
+            encoded = cv::imencode(".png", result, buffer, { cv::IMWRITE_PNG_COMPRESSION, m_options.pngCompression });
+            break;
+        case ResultFormat::JPEG:
+        case ResultFormat::THUMBNAIL:
+            encoded = cv::imencode(".jpg", result, buffer, { cv::IMWRITE_JPEG_QUALITY, m_options.jpegQuality });
+            break;
+        case ResultFormat::RAW:
+            break; // written as is
+        }
+        auto t2 = Clock::now();
+        XVT_PROFILE_LAP(stopwatch, "encode");
+
+        //--------------- Write -----------------------------------------//
+        size_t bytes = 0;
+        if (encoded) {
+            if (m_options.format == ResultFormat::RAW) {
+                bytes = writeRawFrame(path, result);
+            }
+            else {
+                std::ofstream file(path, std::ios::binary | std::ios::trunc);
+                file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+                bytes = file ? buffer.size() : 0;
+            }
+        }
+        auto t3 = Clock::now();
+        XVT_PROFILE_LAP(stopwatch, "write");
+
+        if (bytes == 0)
+            std::cerr << "Error processing " << name << ": Cannot write " << path << std::endl;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (bytes == 0) {
+            ++m_stats.failed;
+        }
+        else {
+            ++m_stats.written;
+            m_stats.bytes += bytes;
+        }
+        m_stats.renderMs += ms(t0, t1);
+        m_stats.encodeMs += ms(t1, t2);
+        m_stats.writeMs += ms(t2, t3);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error processing " << name << ": " << e.what() << std::endl;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_stats.failed;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -3,23 +3,87 @@
 //==============================================================================================================================================//
 
 #include "xvtLib.h"
+#include "RawFrame.h"
+#include <opencv2/core/hal/intrin.hpp>
 
 //==============================================================================================================================================//
 //                                                              Definition                                                                      //
 //==============================================================================================================================================//
 
 cv::Mat loadImage(const std::string& filePath) {
+    if (isRawFramePath(filePath)) {
+        MappedRawFrame raw;
+        if (!raw.open(filePath)) {
+            std::cerr << "Error loading image: " << filePath << std::endl;
+            return cv::Mat();
+        }
+        raw.prefetchAll();
+        cv::Mat image = convertFrame(raw.image());
+        return raw.shares(image) ? image.clone() : image; // an 8-bit frame comes back as a view on the mapping
+    }
+
     cv::Mat image = cv::imread(filePath, cv::IMREAD_UNCHANGED);
     if (image.empty()) {
         std::cerr << "Error loading image: " << filePath << std::endl;
     }
+    return convertFrame(image);
+}
+
+cv::Mat loadImageROI(const std::string& filePath, cv::Rect& ROI, int margin) {
+    // A raw frame is mapped, not read: only the pages of the ROI plus margin are touched
+    if (isRawFramePath(filePath)) {
+        MappedRawFrame raw;
+        if (!raw.open(filePath)) {
+            std::cerr << "Error loading image: " << filePath << std::endl;
+            return cv::Mat();
+        }
+        raw.prefetch(cv::Rect(ROI.x - margin, ROI.y - margin, ROI.width + 2 * margin, ROI.height + 2 * margin));
+        return convertFrameROI(raw.image(), ROI, margin);
+    }
+
+    cv::Mat image = cv::imread(filePath, cv::IMREAD_UNCHANGED);
+    if (image.empty()) {
+        std::cerr << "Error loading image: " << filePath << std::endl;
+        return image;
+    }
+    return convertFrameROI(image, ROI, margin);
+}
+
+cv::Mat convertFrame(const cv::Mat& frame, int depth, double clipPercent) {
+    cv::Mat image;
+    double lowVal = 0, highVal = 0;
+    if (frame.type() != CV_16UC1 || !normalizePercentile(frame, image, depth, clipPercent, lowVal, highVal))
+        image = frame;
+    return image;
+}
+
+cv::Mat convertFrameROI(const cv::Mat& image, cv::Rect& ROI, int margin, int depth, double clipPercent) {
+    if (image.empty())
+        return cv::Mat();
+
+    margin = std::max(0, margin);
+    cv::Rect crop = refindROI(cv::Rect(ROI.x - margin, ROI.y - margin, ROI.width + 2 * margin, ROI.height + 2 * margin),
+                              image.size());
+    if (crop.empty()) {
+        ROI = cv::Rect();
+        return cv::Mat();
+    }
 
+    cv::Mat cropImg;
     if (image.type() == CV_16UC1)
     {
-        double minVal = 0, maxVal = 0;
-        convert16To8bit(image, image, minVal, maxVal);
+        double lowVal = 0, highVal = 0;
+        if (!normalizePercentile(image(crop), cropImg, depth, clipPercent, lowVal, highVal))
+            cropImg = cv::Mat::zeros(crop.size(), depth == CV_16U ? CV_16UC1 : CV_8UC1); // flat region
     }
-    return image;
+    else
+    {
+        cropImg = image(crop).clone(); // don't keep the whole frame alive through the view
+    }
+
+    ROI.x -= crop.x;
+    ROI.y -= crop.y;
+    return cropImg;
 }
 
 cv::Rect refindROI(const cv::Rect& ROI, const cv::Size& imageSize) {
@@ -38,6 +102,60 @@ cv::Rect refindROI(const cv::Rect& ROI, const cv::Size& imageSize) {
     return cv::Rect(x, y, w, h);
 }
 
+bool locateCellOutline(const cv::Mat& frame, const OutlineParams& params, cv::Rect& outline)
+{
+    XVT_PROFILE_STOPWATCH(stopwatch);
+    outline = cv::Rect();
+    if (frame.empty() || frame.channels() != 1)
+        return false;
+
+    //--------------- Decimate --------------------------------------//
+    // The area average doubles as the denoising; the stretch is on the small image, so it costs nothing
+    const int decimation = std::clamp(params.decimation, 1, std::max(1, std::min(frame.rows, frame.cols) / 16));
+    cv::Mat small;
+    cv::resize(frame, small, cv::Size(frame.cols / decimation, frame.rows / decimation), 0, 0, cv::INTER_AREA);
+    cv::normalize(small, small, 0, 255, cv::NORM_MINMAX, CV_8U);
+    cv::GaussianBlur(small, small, cv::Size(5, 5), 0);
+    XVT_PROFILE_LAP(stopwatch, "decimate");
+
+    //--------------- Segment the Cell ------------------------------//
+    cv::Mat mask;
+    cv::threshold(small, mask, 0, 255, (params.darkCell ? cv::THRESH_BINARY_INV : cv::THRESH_BINARY) | cv::THRESH_OTSU);
+    cv::morphologyEx(mask, mask, cv::MORPH_OPEN, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(5, 5)));
+
+    std::vector<std::vector<cv::Point>> contours;
+    cv::findContours(mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    double bestArea = params.minAreaFraction * static_cast<double>(small.total());
+    const std::vector<cv::Point>* best = nullptr;
+    for (const auto& contour : contours) {
+        const double area = cv::contourArea(contour);
+        if (area >= bestArea) {
+            bestArea = area;
+            best = &contour;
+        }
+    }
+    XVT_PROFILE_LAP(stopwatch, "segment");
+    if (!best)
+        return false;
+
+    // Back to frame coordinates: the decimated pixel (x, y) covers [x * decimation, (x + 1) * decimation)
+    const cv::Rect box = cv::boundingRect(*best);
+    outline = refindROI(cv::Rect(box.x * decimation, box.y * decimation, box.width * decimation, box.height * decimation),
+                        frame.size());
+    return !outline.empty();
+}
+
+cv::Rect placeROI(const cv::Rect& ROI, const cv::Rect& reference, const cv::Rect& outline, const cv::Size& imageSize)
+{
+    if (reference.empty() || outline.empty())
+        return refindROI(ROI, imageSize);
+
+    // The centre is the mean of both sides of the outline: half the error of either corner
+    const int dx = static_cast<int>(std::lround((outline.x + 0.5 * outline.width) - (reference.x + 0.5 * reference.width)));
+    const int dy = static_cast<int>(std::lround((outline.y + 0.5 * outline.height) - (reference.y + 0.5 * reference.height)));
+    return refindROI(ROI + cv::Point(dx, dy), imageSize);
+}
+
 void restore8To16bit(const cv::Mat& src8, cv::Mat& dst16, double minVal, double maxVal)
 {
     CV_Assert(src8.type() == CV_8UC1);
@@ -67,147 +185,751 @@ bool convert16To8bit(const cv::Mat& src16,
     return true;
 }
 
+bool normalizePercentile(const cv::Mat& src16,
+    cv::Mat& dst,
+    int depth,
+    double clipPercent,
+    double& lowVal,
+    double& highVal)
+{
+    CV_Assert(src16.type() == CV_16UC1 && (depth == CV_8U || depth == CV_16U));
+
+    if (clipPercent <= 0.0) {
+        cv::minMaxLoc(src16, &lowVal, &highVal);
+    }
+    else {
+        //--------------- Histogram -----------------------------------//
+        // The bins outside the min/max are empty: only that range is walked and cleared. Four interleaved sub-histograms
+        // let consecutive equal pixels increment different counters, so the increments do not wait on each other.
+        // The sub-histograms are kept per thread (1 MiB) and left zeroed between calls.
+        double minVal = 0.0, maxVal = 0.0;
+        cv::minMaxLoc(src16, &minVal, &maxVal);
+        const int lo = static_cast<int>(minVal), hi = static_cast<int>(maxVal);
+        std::vector<unsigned int>& histogram = ProcessingContext::local().histogram;
+        if (histogram.size() != 4 * 65536)
+            histogram.assign(4 * 65536, 0u);
+        unsigned int* bins[4] = { histogram.data(), histogram.data() + 65536, histogram.data() + 2 * 65536, histogram.data() + 3 * 65536 };
+        for (int y = 0; y < src16.rows; ++y) {
+            const ushort* row = src16.ptr<ushort>(y);
+            int x = 0;
+            for (; x + 4 <= src16.cols; x += 4) {
+                ++bins[0][row[x]];
+                ++bins[1][row[x + 1]];
+                ++bins[2][row[x + 2]];
+                ++bins[3][row[x + 3]];
+            }
+            for (; x < src16.cols; ++x)
+                ++bins[0][row[x]];
+        }
+        for (int v = lo; v <= hi; ++v) {
+            bins[0][v] += bins[1][v] + bins[2][v] + bins[3][v];
+            bins[1][v] = bins[2][v] = bins[3][v] = 0u;
+        }
+
+        //--------------- Percentiles ---------------------------------//
+        const unsigned int* merged = bins[0];
+        const double total = static_cast<double>(src16.total());
+        const double clip = std::min(clipPercent, 49.0) / 100.0 * total;
+        double count = 0.0;
+        int low = lo;
+        for (; low < hi && count + merged[low] <= clip; ++low)
+            count += merged[low];
+        count = 0.0;
+        int high = hi;
+        for (; high > low && count + merged[high] <= clip; --high)
+            count += merged[high];
+        std::fill(bins[0] + lo, bins[0] + hi + 1, 0u);
+        lowVal = low;
+        highVal = high;
+    }
+
+    if (highVal - lowVal < 1e-6)
+        return false;   // flat image
+
+    //--------------- Stretch -------------------------------------//
+    // convertTo saturates the clipped tails and is vectorized
+    const double top = depth == CV_16U ? 65535.0 : 255.0;
+    const double scale = top / (highVal - lowVal);
+    src16.convertTo(dst, depth, scale, -lowVal * scale);
+    return true;
+}
+
 void CLAHEOpenCV(const cv::Mat& src,
     cv::Mat& dst,
     double clipLimit,
     cv::Size tileGridSize)
 {
-    cv::Mat src8, dst8;
-    double minVal = 0.0, maxVal = 255.0;
+    CLAHEOpenCV(src, dst, ProcessingContext::local(), clipLimit, tileGridSize);
+}
 
-    if (src.type() == CV_16UC1) {
-        if (!convert16To8bit(src, src8, minVal, maxVal)) {
-            dst = src.clone();
-            return;
-        }
-    }
-    else if (src.type() == CV_8UC1) {
-        src8 = src;
-    }
-    else {
+void CLAHEOpenCV(const cv::Mat& src,
+    cv::Mat& dst,
+    ProcessingContext& context,
+    double clipLimit,
+    cv::Size tileGridSize)
+{
+    // OpenCV's CLAHE works on 8UC1 and 16UC1 directly: a 16-bit image keeps its precision
+    if (src.type() != CV_8UC1 && src.type() != CV_16UC1) {
         std::cout << "Unsupported image type\n";
         return;
     }
 
-    cv::Ptr<cv::CLAHE> clahe =
-        cv::createCLAHE(clipLimit, tileGridSize);
-    clahe->apply(src8, dst8);
+    cv::Mat result = dst; // written in place if it is already a buffer of the right size and type
+    context.clahe(clipLimit, tileGridSize).apply(src, result);
+    dst = result;
+}
 
-    if (src.type() == CV_16UC1)
-        restore8To16bit(dst8, dst, minVal, maxVal);
-    else
-        dst = dst8;
+ProcessingContext& ProcessingContext::local()
+{
+    thread_local ProcessingContext context;
+    return context;
 }
 
-void drawDoubleArrow(const cv::Mat& img, cv::Point p1, cv::Point p2, cv::Scalar color, int thickness, double tipLength)
+cv::CLAHE& ProcessingContext::clahe(double clipLimit, cv::Size tileGridSize)
 {
-    cv::arrowedLine(img, p1, p2, color,
-        thickness, cv::LINE_AA, 0, tipLength);
-    cv::arrowedLine(img, p2, p1, color,
-        thickness, cv::LINE_AA, 0, tipLength);
+    if (!m_clahe) {
+        m_clahe = cv::createCLAHE(clipLimit, tileGridSize);
+    }
+    else if (clipLimit != m_clipLimit || tileGridSize != m_tileGridSize) {
+        m_clahe->setClipLimit(clipLimit);
+        m_clahe->setTilesGridSize(tileGridSize);
+    }
+    m_clipLimit = clipLimit;
+    m_tileGridSize = tileGridSize;
+    return *m_clahe;
 }
 
-std::vector<FindPeak::PeakInfo> FindPeak::run(const std::vector<double>& signal)
+cv::Mat ProcessingContext::buffer(Buffer slot, cv::Size size, int type)
 {
-    if (signal.size() < 3) return {};
+    cv::Mat& pool = m_buffers[static_cast<int>(slot)];
+    if (pool.type() != type || pool.cols < size.width || pool.rows < size.height) {
+        // Grow to the largest ROI seen in either direction, so alternating P1/P6 shapes settle on one buffer
+        const int rows = pool.type() == type ? std::max(pool.rows, size.height) : size.height;
+        const int cols = pool.type() == type ? std::max(pool.cols, size.width) : size.width;
+        pool.create(rows, cols, type);
+        m_allocatedBytes += pool.total() * pool.elemSize();
+    }
+    return pool(cv::Rect(0, 0, size.width, size.height));
+}
 
-    auto extrema = findLocalExtrema(signal);
-    applyProminenceFilter(extrema, signal);
-    applyDistanceFilter(extrema);
-    sortByPosition(extrema);
+void denoiseImage(const cv::Mat& src,
+    cv::Mat& dst,
+    DenoiseMethod method,
+    float h)
+{
+    switch (method) {
+    case DenoiseMethod::NLM:
+        // 16-bit NLM needs the L1 norm, with h on the 16-bit scale
+        if (src.depth() == CV_16U)
+            cv::fastNlMeansDenoising(src, dst, std::vector<float>{ static_cast<float>(h * U16_PER_U8) }, 7, 21, cv::NORM_L1);
+        else
+            cv::fastNlMeansDenoising(src, dst, h, 7, 21);
+        break;
+    case DenoiseMethod::GAUSSIAN:
+        cv::GaussianBlur(src, dst, cv::Size(7, 7), 0);
+        break;
+    case DenoiseMethod::BOX:
+        cv::blur(src, dst, cv::Size(7, 7));
+        break;
+    case DenoiseMethod::MEDIAN:
+        cv::medianBlur(src, dst, 5);
+        break;
+    case DenoiseMethod::PROFILE:
+        dst = src;
+        break;
+    }
+}
 
-    return extrema;
+void computeProfile(const cv::Mat& src,
+    int dim,
+    bool reverse,
+    ProfileWorkspace& workspace,
+    int smoothKernelSize)
+{
+    computeProfileBatch(src, 1, dim, reverse, workspace, smoothKernelSize);
 }
 
-std::vector<FindPeak::PeakInfo> FindPeak::findLocalExtrema(const std::vector<double>& s)
+void computeProfileBatch(const cv::Mat& src,
+    int count,
+    int dim,
+    bool reverse,
+    ProfileWorkspace& workspace,
+    int smoothKernelSize)
 {
-    std::vector<PeakInfo> out;
-    for (int i = 1; i < (int)s.size() - 1; ++i) {
-        if (m_mode == Mode::PEAK) {
-            if (s[i] > s[i - 1] && s[i] > s[i + 1])
-                out.push_back({ i, s[i] });
+    CV_Assert((src.type() == CV_8UC1 || src.type() == CV_16UC1) && (dim == 0 || dim == 1));
+    CV_Assert(count > 0 && src.rows % count == 0);
+
+    // The images are stacked along the rows: image t covers the rows [t * rows, (t + 1) * rows)
+    const int rows = src.rows / count;
+    const int cols = src.cols;
+    const int length = dim == 0 ? cols : rows;
+    workspace.profile.resize(static_cast<size_t>(count) * length);
+    workspace.derivative.resize(static_cast<size_t>(count) * length);
+    if (length == 0) return;
+    double* profile = workspace.profile.data();
+
+    // 16-bit sums are 32-bit too: exact up to 65537 rows/columns, far beyond any ROI
+    const bool wide = src.depth() == CV_16U;
+    CV_Assert(!wide || std::max(rows, cols) <= 65537);
+    const double unit = wide ? 1.0 / U16_PER_U8 : 1.0;
+
+    if (dim == 0) {
+        //--------------- Column Sums ---------------------------------//
+        workspace.sums.assign(static_cast<size_t>(count) * cols, 0u);
+        for (int y = 0; y < src.rows; ++y) {
+            unsigned int* sums = workspace.sums.data() + static_cast<size_t>(y / rows) * cols;
+            int x = 0;
+            if (wide) {
+                const ushort* row = src.ptr<ushort>(y);
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+                const int lanes16 = cv::VTraits<cv::v_uint16>::vlanes();
+                const int lanes32 = cv::VTraits<cv::v_uint32>::vlanes();
+                for (; x <= cols - lanes16; x += lanes16) {
+                    cv::v_uint32 s0, s1;
+                    cv::v_expand(cv::vx_load(row + x), s0, s1);
+                    unsigned int* acc = sums + x;
+                    cv::v_store(acc, cv::v_add(cv::vx_load(acc), s0));
+                    cv::v_store(acc + lanes32, cv::v_add(cv::vx_load(acc + lanes32), s1));
+                }
+#endif
+                for (; x < cols; ++x)
+                    sums[x] += row[x];
+                continue;
+            }
+
+            const uchar* row = src.ptr<uchar>(y);
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+            const int lanes8 = cv::VTraits<cv::v_uint8>::vlanes();
+            const int lanes32 = cv::VTraits<cv::v_uint32>::vlanes();
+            for (; x <= cols - lanes8; x += lanes8) {
+                cv::v_uint16 lo16, hi16;
+                cv::v_uint32 s0, s1, s2, s3;
+                cv::v_expand(cv::vx_load(row + x), lo16, hi16);
+                cv::v_expand(lo16, s0, s1);
+                cv::v_expand(hi16, s2, s3);
+                unsigned int* acc = sums + x;
+                cv::v_store(acc, cv::v_add(cv::vx_load(acc), s0));
+                cv::v_store(acc + lanes32, cv::v_add(cv::vx_load(acc + lanes32), s1));
+                cv::v_store(acc + 2 * lanes32, cv::v_add(cv::vx_load(acc + 2 * lanes32), s2));
+                cv::v_store(acc + 3 * lanes32, cv::v_add(cv::vx_load(acc + 3 * lanes32), s3));
+            }
+#endif
+            for (; x < cols; ++x)
+                sums[x] += row[x];
+        }
+
+        const double scale = unit / rows;
+        for (int t = 0; t < count; ++t) {
+            const unsigned int* sums = workspace.sums.data() + static_cast<size_t>(t) * cols;
+            double* segment = profile + static_cast<size_t>(t) * cols;
+            for (int x = 0; x < cols; ++x)
+                segment[reverse ? cols - 1 - x : x] = sums[x] * scale;
         }
-        else {
-            if (s[i] < s[i - 1] && s[i] < s[i + 1])
-                out.push_back({ i, s[i] });
+    }
+    else {
+        //--------------- Row Sums ------------------------------------//
+        const double scale = unit / cols;
+        for (int y = 0; y < src.rows; ++y) {
+            unsigned int sum = 0;
+            int x = 0;
+            if (wide) {
+                const ushort* row = src.ptr<ushort>(y);
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+                const int lanes16 = cv::VTraits<cv::v_uint16>::vlanes();
+                cv::v_uint32 acc = cv::vx_setzero_u32();
+                for (; x <= cols - lanes16; x += lanes16) {
+                    cv::v_uint32 s0, s1;
+                    cv::v_expand(cv::vx_load(row + x), s0, s1);
+                    acc = cv::v_add(acc, cv::v_add(s0, s1));
+                }
+                sum = cv::v_reduce_sum(acc);
+#endif
+                for (; x < cols; ++x)
+                    sum += row[x];
+            }
+            else {
+                const uchar* row = src.ptr<uchar>(y);
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+                const int lanes8 = cv::VTraits<cv::v_uint8>::vlanes();
+                cv::v_uint32 acc = cv::vx_setzero_u32();
+                for (; x <= cols - lanes8; x += lanes8) {
+                    cv::v_uint16 lo16, hi16;
+                    cv::v_expand(cv::vx_load(row + x), lo16, hi16);
+                    cv::v_uint32 s0, s1;
+                    cv::v_expand(cv::v_add(lo16, hi16), s0, s1);
+                    acc = cv::v_add(acc, cv::v_add(s0, s1));
+                }
+                sum = cv::v_reduce_sum(acc);
+#endif
+                for (; x < cols; ++x)
+                    sum += row[x];
+            }
+            const int t = y / rows, r = y - t * rows;
+            profile[static_cast<size_t>(t) * rows + (reverse ? rows - 1 - r : r)] = sum * scale;
         }
     }
-    return out;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    cv::vx_cleanup();
+#endif
+
+    //--------------- 1st Derivative ------------------------------//
+    // One profile per matrix row: a 1-D kernel along the rows smooths every image at once without mixing them
+    if (smoothKernelSize > 0 && length > 1) {
+        cv::Mat profileMat(count, length, CV_64F, profile);
+        cv::Mat smoothed;
+        cv::GaussianBlur(profileMat, smoothed, cv::Size(smoothKernelSize, 1), 0, 0, cv::BORDER_REPLICATE);
+        smoothed.copyTo(profileMat);
+    }
+
+    for (int t = 0; t < count; ++t) {
+        const double* segment = profile + static_cast<size_t>(t) * length;
+        double* derivative = workspace.derivative.data() + static_cast<size_t>(t) * length;
+        derivative[0] = 0.0;
+        for (int i = 1; i < length; ++i)
+            derivative[i] = segment[i] - segment[i - 1];
+    }
 }
 
+double refinePeakPosition(std::span<const double> s, int position)
+{
+    if (position <= 0 || position >= (int)s.size() - 1)
+        return position;
+
+    double left = s[position - 1];
+    double center = s[position];
+    double right = s[position + 1];
+    double curvature = left - 2.0 * center + right;
+    if (curvature == 0.0)
+        return position;
+
+    double offset = 0.5 * (left - right) / curvature;
+    return position + std::clamp(offset, -0.5, 0.5);
+}
 
-void FindPeak::applyProminenceFilter(std::vector<PeakInfo>& peaks, const std::vector<double>& s)
+void measureGap(std::span<const double> derivative,
+    int peakIndex,
+    int valleyIndex,
+    bool reversed,
+    double pixelSizeUm,
+    GapMeasurement& measurement,
+    double noiseSigma)
 {
-    std::vector<PeakInfo> out;
+    const double last = static_cast<double>(derivative.size()) - 1.0;
+    double peak = refinePeakPosition(derivative, peakIndex);
+    double valley = refinePeakPosition(derivative, valleyIndex);
+
+    measurement.valid = true;
+    measurement.peakPosition = reversed ? last - peak : peak;
+    measurement.valleyPosition = reversed ? last - valley : valley;
+    measurement.gap = std::abs(peak - valley);
+    measurement.gapUm = measurement.gap * pixelSizeUm;
+
+    const double sigma = noiseSigma < 0.0 ? derivativeNoise(derivative) : noiseSigma;
+    double contrast = std::min(std::abs(derivative[peakIndex]), std::abs(derivative[valleyIndex]));
+    measurement.confidence = sigma > 0.0 ? contrast / sigma : 0.0;
+}
 
-    for (auto& p : peaks) {
-        double leftBase = p.value;
-        for (int i = p.position - 1; i >= 0; --i) {
-            if ((m_mode == Mode::PEAK && s[i] > p.value) ||
-                (m_mode == Mode::VALLEY && s[i] < p.value))
-                break;
-            leftBase = (m_mode == Mode::PEAK)
-                ? std::min(leftBase, s[i])
-                : std::max(leftBase, s[i]);
-        }
+double derivativeNoise(std::span<const double> derivative)
+{
+    if (derivative.empty()) return 0.0;
+
+    // Noise level of the derivative from its mean absolute deviation (x1.2533 gives sigma for Gaussian noise)
+    double mean = 0.0;
+    for (double d : derivative) mean += d;
+    mean /= derivative.size();
+    double deviation = 0.0;
+    for (double d : derivative) deviation += std::abs(d - mean);
+    return 1.2533 * deviation / derivative.size();
+}
+
+double robustDerivativeNoise(std::span<double> samples)
+{
+    if (samples.empty()) return 0.0;
+
+    // 1.4826 x median |d - median| gives sigma for Gaussian noise; two selections, no sort
+    const auto middle = samples.begin() + samples.size() / 2;
+    std::nth_element(samples.begin(), middle, samples.end());
+    const double median = *middle;
+    for (double& d : samples) d = std::abs(d - median);
+    std::nth_element(samples.begin(), middle, samples.end());
+    return 1.4826 * *middle;
+}
 
-        double rightBase = p.value;
-        for (int i = p.position + 1; i < (int)s.size(); ++i) {
-            if ((m_mode == Mode::PEAK && s[i] > p.value) ||
-                (m_mode == Mode::VALLEY && s[i] < p.value))
-                break;
-            rightBase = (m_mode == Mode::PEAK)
-                ? std::min(rightBase, s[i])
-                : std::max(rightBase, s[i]);
+void measureStrips(const cv::Mat& src,
+    int dim,
+    bool reverse,
+    const InspectionParams& params,
+    bool peakFromEnd,
+    bool valleyFromEnd,
+    GapMeasurement& measurement)
+{
+    CV_Assert((src.type() == CV_8UC1 || src.type() == CV_16UC1) && (dim == 0 || dim == 1));
+    StripStatistics& stats = measurement.strips;
+    stats = StripStatistics();
+    measurement.valid = false;
+    measurement.gap = 0.0;
+    measurement.gapUm = 0.0;
+    const double unit = src.depth() == CV_16U ? 1.0 / U16_PER_U8 : 1.0;
+
+    const int length = dim == 0 ? src.cols : src.rows;      // along the profile
+    const int across = dim == 0 ? src.rows : src.cols;      // along which the strips are cut
+    const int blockSize = std::max(1, params.stripWidth / 2);
+    const int blockCount = std::max(1, across / blockSize);
+    if (length < 3) return;
+
+    //--------------- Half-Strip Block Sums -----------------------//
+    // blockSums[b * length + i]: sum of the profile sample i over block b. The last block takes the remainder.
+    std::vector<double> blockSums(static_cast<size_t>(blockCount) * length, 0.0);
+    std::vector<int> blockWidth(blockCount, blockSize);
+    blockWidth.back() = across - blockSize * (blockCount - 1);
+
+    auto sumBlocks = [&]<typename T>() {
+        for (int y = 0; y < src.rows; ++y) {
+            const T* row = src.ptr<T>(y);
+            if (dim == 0) {
+                double* sums = &blockSums[static_cast<size_t>(std::min(y / blockSize, blockCount - 1)) * length];
+                for (int x = 0; x < src.cols; ++x)
+                    sums[x] += row[x];
+            }
+            else {
+                for (int b = 0; b < blockCount; ++b) {
+                    int begin = b * blockSize;
+                    int end = begin + blockWidth[b];
+                    unsigned int sum = 0;
+                    for (int x = begin; x < end; ++x)
+                        sum += row[x];
+                    blockSums[static_cast<size_t>(b) * length + y] = sum;
+                }
+            }
+        }
+    };
+    if (src.depth() == CV_16U)
+        sumBlocks.template operator()<ushort>();
+    else
+        sumBlocks.template operator()<uchar>();
+
+    //--------------- Gap per Strip -------------------------------//
+    // Strip j covers blocks j and j + 1 (a single block if the ROI is narrower than one strip).
+    const int stripCount = std::max(1, blockCount - 1);
+    const int blocksPerStrip = blockCount > 1 ? 2 : 1;
+    std::vector<double> gaps(stripCount, std::numeric_limits<double>::quiet_NaN());
+
+    cv::parallel_for_(cv::Range(0, stripCount), [&](const cv::Range& range) {
+        ProfileWorkspace workspace;
+        FindPeak::Workspace peakWorkspace;
+        std::vector<FindPeak::PeakInfo> peaks, valleys;
+        std::vector<double> window(length, 0.0);
+        int windowWidth = 0;
+
+        // Sliding window over the blocks: add the entering block, subtract the leaving one
+        for (int b = range.start; b < range.start + blocksPerStrip; ++b) {
+            const double* sums = &blockSums[static_cast<size_t>(b) * length];
+            for (int i = 0; i < length; ++i) window[i] += sums[i];
+            windowWidth += blockWidth[b];
         }
 
-        double prominence = (m_mode == Mode::PEAK)
-            ? p.value - std::max(leftBase, rightBase)
-            : std::min(leftBase, rightBase) - p.value;
+        for (int j = range.start; j < range.end; ++j) {
+            if (j > range.start) {
+                const double* leaving = &blockSums[static_cast<size_t>(j - 1) * length];
+                const double* entering = &blockSums[static_cast<size_t>(j + blocksPerStrip - 1) * length];
+                for (int i = 0; i < length; ++i) window[i] += entering[i] - leaving[i];
+                windowWidth += blockWidth[j + blocksPerStrip - 1] - blockWidth[j - 1];
+            }
 
-        if (prominence >= m_minProminence)
-            out.push_back(p);
-    }
+            workspace.profile.resize(length);
+            workspace.derivative.resize(length);
+            for (int i = 0; i < length; ++i)
+                workspace.profile[reverse ? length - 1 - i : i] = window[i] * unit / windowWidth;
+            if (params.denoise == DenoiseMethod::PROFILE)
+                smoothProfile(workspace.profile);
+            workspace.derivative[0] = 0.0;
+            for (int i = 1; i < length; ++i)
+                workspace.derivative[i] = workspace.profile[i] - workspace.profile[i - 1];
+
+            const std::span<const double> derivative(workspace.derivative);
+            FindPeak findPeak(FindPeak::Mode::PEAK, params.minDistance);
+            findPeak.setMinProminence(params.peakProminence);
+            findPeak.run<FindPeak::Mode::PEAK>(derivative, peaks, peakWorkspace);
+            FindPeak findValley(FindPeak::Mode::VALLEY, params.minDistance);
+            findValley.setMinProminence(params.valleyProminence);
+            findValley.run<FindPeak::Mode::VALLEY>(derivative, valleys, peakWorkspace);
+            if (peaks.empty() || valleys.empty())
+                continue;
+
+            GapMeasurement strip;
+            measureGap(derivative,
+                peakFromEnd ? peaks.back().position : peaks.front().position,
+                valleyFromEnd ? valleys.back().position : valleys.front().position,
+                reverse, params.pixelSizeUm, strip);
+            gaps[j] = strip.gap;
+        }
+    });
+
+    //--------------- Outlier Rejection ---------------------------//
+    // Median and MAD of the valid strips; a strip further than 3 sigma (at least 1 px) from the median is rejected.
+    stats.count = stripCount;
+    std::vector<double> valid;
+    for (double gap : gaps)
+        if (!std::isnan(gap)) valid.push_back(gap);
+    if (valid.empty()) return;
+
+    auto median = [](std::vector<double> v) {
+        size_t mid = v.size() / 2;
+        std::nth_element(v.begin(), v.begin() + mid, v.end());
+        double upper = v[mid];
+        if (v.size() % 2 != 0) return upper;
+        return 0.5 * (upper + *std::max_element(v.begin(), v.begin() + mid));
+    };
+    const double center = median(valid);
+    std::vector<double> deviations;
+    for (double gap : valid) deviations.push_back(std::abs(gap - center));
+    const double tolerance = std::max(1.0, 3.0 * 1.4826 * median(deviations));
+
+    std::vector<double> accepted;
+    for (double gap : valid)
+        if (std::abs(gap - center) <= tolerance) accepted.push_back(gap);
+
+    stats.accepted = static_cast<int>(accepted.size());
+    stats.minGap = *std::min_element(accepted.begin(), accepted.end());
+    stats.maxGap = *std::max_element(accepted.begin(), accepted.end());
+    stats.medianGap = median(accepted);
+
+    // The reported gap comes from the intact regions only
+    measurement.valid = true;
+    measurement.gap = stats.medianGap;
+    measurement.gapUm = measurement.gap * params.pixelSizeUm;
+}
 
-    peaks.swap(out);
+void pyramidCoarseSearch(const cv::Mat& src,
+    int dim,
+    bool reverse,
+    const InspectionParams& params,
+    const BandFilter& filter,
+    ProcessingContext& context)
+{
+    CV_Assert(dim == 0 || dim == 1);
+    PyramidWorkspace& pyramid = context.pyramid;
+    pyramid.bandSamples.clear();
+    const int length = dim == 0 ? src.cols : src.rows;
+    const int factor = 1 << std::clamp(params.pyramidLevels, 0, 5);
+
+    //--------------- Downsample and Filter -----------------------//
+    // The area average is itself a denoiser: the coarse ROI has 1/factor^2 of the pixels and factor times less noise
+    const cv::Size coarseSize(std::max(1, src.cols / factor), std::max(1, src.rows / factor));
+    cv::Mat coarse = context.buffer(ProcessingContext::Buffer::COARSE, coarseSize, src.type());
+    cv::resize(src, coarse, coarseSize, 0, 0, cv::INTER_AREA);
+    const cv::Mat filtered = filter(coarse);
+    computeProfile(filtered, dim, reverse, pyramid.coarse, params.denoise == DenoiseMethod::PROFILE ? 3 : 0);
+
+    //--------------- Coarse Candidates ---------------------------//
+    const std::vector<double>& coarseDerivative = pyramid.coarse.derivative;
+    const std::span<const double> derivativeSpan(coarseDerivative);
+    FindPeak findPeak(FindPeak::Mode::PEAK);
+    findPeak.setMinDistance(std::max(1, params.minDistance / factor));
+    findPeak.setMinProminence(params.peakProminence);
+    findPeak.run<FindPeak::Mode::PEAK>(derivativeSpan, context.peaks, context.peakWorkspace);
+    FindPeak findValley(FindPeak::Mode::VALLEY);
+    findValley.setMinDistance(std::max(1, params.minDistance / factor));
+    findValley.setMinProminence(params.valleyProminence);
+    findValley.run<FindPeak::Mode::VALLEY>(derivativeSpan, context.valleys, context.peakWorkspace);
+
+    // Coarse sample i covers the full-resolution samples [i * scale, (i + 1) * scale): map it to their centre
+    const int coarseLength = static_cast<int>(coarseDerivative.size());
+    const double scale = static_cast<double>(length) / coarseLength;
+    auto toFine = [&](int i) { return std::clamp(static_cast<int>((i + 0.5) * scale), 0, length - 1); };
+    for (auto& peak : context.peaks) peak.position = toFine(peak.position);
+    for (auto& valley : context.valleys) valley.position = toFine(valley.position);
+
+    // Outside the refined bands, the derivative is the coarse one per full-resolution sample
+    pyramid.derivative.resize(length);
+    for (int i = 0; i < length; ++i)
+        pyramid.derivative[i] = coarseDerivative[std::min(coarseLength - 1, static_cast<int>(i / scale))] / scale;
 }
 
+int pyramidRefine(const cv::Mat& src,
+    int dim,
+    bool reverse,
+    int position,
+    FindPeak::Mode mode,
+    const InspectionParams& params,
+    const BandFilter& filter,
+    ProcessingContext& context)
+{
+    // The band covers the coarse uncertainty: one coarse sample each side, plus slack
+    const int halfWidth = 2 * (1 << std::clamp(params.pyramidLevels, 0, 5)) + 2;
+    return refineEdgeInBand(src, dim, reverse, position, halfWidth, mode, params, filter, context);
+}
 
-void FindPeak::applyDistanceFilter(std::vector<PeakInfo>& peaks)
+int refineEdgeInBand(const cv::Mat& src,
+    int dim,
+    bool reverse,
+    int position,
+    int halfWidth,
+    FindPeak::Mode mode,
+    const InspectionParams& params,
+    const BandFilter& filter,
+    ProcessingContext& context)
 {
-    if (peaks.empty()) return;
+    // The filters get a margin of full-resolution context so the band interior matches the full-ROI result:
+    // NLM reaches 13 px, the blurs 4 px. This holds for local filters only: the BandFilter must not contain CLAHE.
+    constexpr int FILTER_MARGIN = 16;
+    PyramidWorkspace& pyramid = context.pyramid;
+    const int length = dim == 0 ? src.cols : src.rows;
+
+    const int first = std::max(0, position - halfWidth);                // scan positions searched
+    const int last = std::min(length - 1, position + halfWidth);
+    const int lowest = reverse ? length - 1 - last : first;             // the same, in ROI coordinates
+    const int highest = reverse ? length - 1 - first : last;
+    const int begin = std::max(0, lowest - FILTER_MARGIN);              // the band, in ROI coordinates
+    const int end = std::min(length, highest + FILTER_MARGIN + 1);
+
+    //--------------- Filter and Profile the Band -----------------//
+    const cv::Mat band = dim == 0 ? src.colRange(begin, end) : src.rowRange(begin, end);
+    const cv::Mat filtered = filter(band);
+    computeProfile(filtered, dim, reverse, pyramid.band, params.denoise == DenoiseMethod::PROFILE ? 7 : 0);
+
+    // Band sample k is scan position offset + k; its first sample has no backward difference and is skipped
+    const int offset = reverse ? length - end : begin;
+    const std::vector<double>& bandDerivative = pyramid.band.derivative;
+    pyramid.bandSamples.insert(pyramid.bandSamples.end(), bandDerivative.begin() + 1, bandDerivative.end());
+    int best = position;
+    for (int q = std::max(first, offset + 1); q <= last; ++q) {
+        const double d = bandDerivative[q - offset];
+        pyramid.derivative[q] = d;
+        if (q == std::max(first, offset + 1)
+            || (mode == FindPeak::Mode::PEAK ? d > pyramid.derivative[best] : d < pyramid.derivative[best]))
+            best = q;
+    }
+    // The neighbours of the extremum feed the sub-pixel parabola of measureGap
+    for (int q : { first - 1, last + 1 })
+        if (q > offset && q < offset + static_cast<int>(bandDerivative.size()))
+            pyramid.derivative[q] = bandDerivative[q - offset];
+    return best;
+}
 
-    // sort by priority
-    std::sort(peaks.begin(), peaks.end(),
-        [this](const PeakInfo& a, const PeakInfo& b) {
-            return (m_mode == Mode::PEAK)
-                ? a.value > b.value
-                : a.value < b.value;
-        });
+bool trackEdges(const cv::Mat& src,
+    int dim,
+    bool reverse,
+    const InspectionParams& params,
+    const BandFilter& filter,
+    ProcessingContext& context,
+    int& peakIndex,
+    int& valleyIndex,
+    GapMeasurement& measurement)
+{
+    const int length = dim == 0 ? src.cols : src.rows;
+    const int window = params.trackWindow;
+    if (window <= 0 || params.trackPeak < 0.0 || params.trackValley < 0.0 || length < 3)
+        return false;
+
+    // The track is in ROI coordinates; the search runs in scan order
+    auto toScan = [&](double position) {
+        const int index = static_cast<int>(std::lround(position));
+        return reverse ? length - 1 - index : index;
+    };
+    const int peakHint = toScan(params.trackPeak);
+    const int valleyHint = toScan(params.trackValley);
+    if (peakHint < 0 || peakHint >= length || valleyHint < 0 || valleyHint >= length)
+        return false;
+
+    //--------------- Search the Two Bands ------------------------//
+    PyramidWorkspace& pyramid = context.pyramid;
+    pyramid.derivative.assign(length, 0.0);
+    pyramid.bandSamples.clear();
+    peakIndex = refineEdgeInBand(src, dim, reverse, peakHint, window, FindPeak::Mode::PEAK, params, filter, context);
+    valleyIndex = refineEdgeInBand(src, dim, reverse, valleyHint, window, FindPeak::Mode::VALLEY, params, filter, context);
+
+    // An extremum on the border of its window may only be the slope of an edge that moved out of it
+    auto onBorder = [&](int index, int hint) {
+        return (index == hint - window && index > 0) || (index == hint + window && index < length - 1);
+    };
+    if (onBorder(peakIndex, peakHint) || onBorder(valleyIndex, valleyHint) || peakIndex == valleyIndex
+        || pyramid.derivative[peakIndex] <= 0.0 || pyramid.derivative[valleyIndex] >= 0.0)
+        return false;
+
+    //--------------- Measure -------------------------------------//
+    // The rest of the derivative was not computed: the noise comes from the bands. Both edges are in them, a large share
+    // of so few samples, so the estimate is the median deviation, which they do not inflate
+    measureGap(pyramid.derivative, peakIndex, valleyIndex, reverse, params.pixelSizeUm, measurement,
+               robustDerivativeNoise(pyramid.bandSamples));
+    if (measurement.confidence < params.trackMinConfidence) {
+        measurement = GapMeasurement();
+        return false;
+    }
+    measurement.tracked = true;
+    return true;
+}
 
-    std::vector<PeakInfo> selected;
+void smoothProfile(std::vector<double>& profile, int kernelSize)
+{
+    if (profile.size() < 2) return;
 
-    for (const auto& p : peaks) {
-        bool conflict = false;
-        for (const auto& s : selected) {
-            if (std::abs(p.position - s.position) < m_minDistance) {
-                conflict = true;
-                break;
-            }
-        }
-        if (!conflict)
-            selected.push_back(p);
+    cv::Mat profileMat(1, static_cast<int>(profile.size()), CV_64F, profile.data());
+    cv::Mat smoothed;
+    cv::GaussianBlur(profileMat, smoothed, cv::Size(kernelSize, 1), 0, 0, cv::BORDER_REPLICATE);
+    smoothed.copyTo(profileMat);
+}
+
+cv::Mat drawResult(const cv::Mat& image, const ResultOverlay& overlay)
+{
+    XVT_PROFILE_STOPWATCH(stopwatch);
+    cv::Mat resultImg;
+    if (image.depth() == CV_16U) {
+        image.convertTo(resultImg, CV_8U, 1.0 / U16_PER_U8);
+        cv::cvtColor(resultImg, resultImg, cv::COLOR_GRAY2BGR);
+    }
+    else {
+        cv::cvtColor(image, resultImg, cv::COLOR_GRAY2BGR);
+    }
+    cv::rectangle(resultImg, overlay.ROI, cv::Scalar(0, 255, 0), 2);
+    if (overlay.ROI.empty())
+        return resultImg;
+
+    cv::Mat roiImg = resultImg(overlay.ROI);
+    const cv::Size size = overlay.ROI.size();
+    auto edge = [&](int line, cv::Scalar color) {
+        if (line < 0) return;
+        if (overlay.rows)
+            cv::line(roiImg, cv::Point(0, line), cv::Point(size.width, line), color, 4, overlay.lineType);
+        else
+            cv::line(roiImg, cv::Point(line, 0), cv::Point(line, size.height), color, 4, overlay.lineType);
+    };
+
+    edge(overlay.valleyLine, cv::Scalar(255, 0, 255));
+    if (!overlay.innerRect.empty())
+        cv::rectangle(roiImg, overlay.innerRect, cv::Scalar(255, 0, 0), 4, overlay.lineType);
+    edge(overlay.peakLine, cv::Scalar(0, 255, 255));
+
+    if (overlay.peakLine >= 0 && overlay.valleyLine >= 0) {
+        drawDoubleArrow(roiImg,
+            overlay.rows ? cv::Point(size.width / 2, overlay.valleyLine) : cv::Point(overlay.valleyLine, size.height / 2),
+            overlay.rows ? cv::Point(size.width / 2, overlay.peakLine) : cv::Point(overlay.peakLine, size.height / 2),
+            cv::Scalar(0, 0, 255)
+        );
     }
 
-    peaks.swap(selected);
+    XVT_PROFILE_LAP(stopwatch, "annotate");
+    XVT_PROFILE_COUNT("annotation_bytes", resultImg.total() * resultImg.elemSize());
+    return resultImg;
+}
+
+void drawDoubleArrow(const cv::Mat& img, cv::Point p1, cv::Point p2, cv::Scalar color, int thickness, double tipLength)
+{
+    cv::arrowedLine(img, p1, p2, color,
+        thickness, cv::LINE_AA, 0, tipLength);
+    cv::arrowedLine(img, p2, p1, color,
+        thickness, cv::LINE_AA, 0, tipLength);
 }
 
-void FindPeak::sortByPosition(std::vector<PeakInfo>& peaks)
+std::vector<FindPeak::PeakInfo> FindPeak::run(const std::vector<double>& signal)
 {
-    std::sort(peaks.begin(), peaks.end(),
-        [](const PeakInfo& a, const PeakInfo& b) {
-            return a.position < b.position;
-        });
+    std::vector<PeakInfo> peaks;
+    Workspace workspace;
+    if (m_mode == Mode::PEAK)
+        run<Mode::PEAK>(std::span<const double>(signal), peaks, workspace);
+    else
+        run<Mode::VALLEY>(std::span<const double>(signal), peaks, workspace);
+    return peaks;
 }
 
 //--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,142 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                 FrameFeeder.cpp                                                                  //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+// Stand-in for the acquisition process of the streaming mode: reads the images of a directory and feeds them to a
+// running Quizz2, either into its shared memory ring (Quizz2 --shm NAME) or as frame records on stdout
+// (FrameFeeder ... | Quizz2 --stdin). Frames are named "cell<N>_<image stem>" so they match the recipe points.
+//
+// Usage: FrameFeeder --images DIR [--shm NAME] [--fps N] [--loop N]
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "FrameSource.h"
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+struct FeederConfig {
+    std::string imageDir;
+    std::string shmName;            // empty: write frame records to stdout
+    double fps = 0.0;               // frames per second, 0 for as fast as the consumer takes them
+    int loops = 1;                  // passes over the directory
+};
+
+bool parseArguments(int argc, char** argv, FeederConfig& config)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--images") config.imageDir = value;
+        else if (arg == "--shm") config.shmName = value;
+        else if (arg == "--fps") config.fps = std::max(0.0, std::atof(value.c_str()));
+        else if (arg == "--loop") config.loops = std::max(1, std::atoi(value.c_str()));
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return !config.imageDir.empty();
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Main Function                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+int main(int argc, char** argv)
+{
+    FeederConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        std::cerr << "Usage: FrameFeeder --images DIR [--shm NAME] [--fps N] [--loop N]" << std::endl;
+        return 2;
+    }
+
+    // The images are decoded once up front, so the feeder runs at acquisition speed rather than codec speed
+    std::vector<std::pair<std::string, cv::Mat>> images;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(config.imageDir, error)) {
+        cv::Mat image = cv::imread(entry.path().string(), cv::IMREAD_UNCHANGED);
+        if (!image.empty())
+            images.emplace_back(entry.path().stem().string(), image);
+    }
+    std::sort(images.begin(), images.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    if (images.empty()) {
+        std::cerr << "No images in " << config.imageDir << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<FrameRing> ring;
+    if (!config.shmName.empty()) {
+        try {
+            ring = FrameRing::open(config.shmName);
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        std::ios::sync_with_stdio(false);
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const auto period = config.fps > 0.0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / config.fps))
+                                         : Clock::duration::zero();
+    auto due = Clock::now();
+    unsigned long long sent = 0;
+    const auto t0 = Clock::now();
+
+    for (int loop = 0; loop < config.loops; ++loop) {
+        // One pass over the directory is one cell
+        const std::string cell = "cell" + std::to_string(loop) + "_";
+        for (const auto& [stem, image] : images) {
+            if (period != Clock::duration::zero()) {
+                std::this_thread::sleep_until(due);
+                due += period;
+            }
+            bool ok = ring ? ring->push(cell + stem, image) : writeFrameRecord(std::cout, cell + stem, image);
+            if (!ok) {
+                std::cerr << "Cannot send frame " << cell + stem << (ring ? ": larger than a ring slot" : ": stdout closed") << std::endl;
+                if (ring) ring->close();
+                return 1;
+            }
+            ++sent;
+        }
+    }
+
+    if (ring)
+        ring->close();
+    else
+        std::cout.flush();
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+    std::cerr << sent << " frames sent in " << seconds << " s (" << (seconds > 0.0 ? sent / seconds : 0.0) << " frames/s)" << std::endl;
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
@@ -0,0 +1,234 @@
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                InspectionLoad.cpp                                                                //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+// Load tester of the inspection server (Quizz2 --serve PATH): crops the ROI of each recipe point out of its raw frame,
+// once, then sends the ROIs round-robin over several connections, keeping a number of requests in flight on each.
+// Reports the throughput and the latency seen by the client next to the processing time reported by the server; the
+// difference is the queueing and the transport.
+//
+// Usage: InspectionLoad --socket PATH [--recipe FILE] [--requests N] [--connections N] [--pipeline N] [--point NAME]
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                     Include                                                                      //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+#include "InspectionServer.h"
+#include "Profiler.h"
+#include "RawFrame.h"
+#include "Recipe.h"
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Local Helpers                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadConfig {
+    std::string socketPath;
+    std::string recipePath = "recipe/Quizz2.rcp";
+    std::string point;              // empty: every point of the recipe
+    unsigned long long requests = 1000;
+    int connections = 1;
+    int pipeline = 4;               // requests in flight per connection
+};
+
+/// <summary>
+/// One request body: a recipe point and its ROI pixels.
+/// </summary>
+struct Payload {
+    std::string point;
+    cv::Mat pixels;
+};
+
+/// <summary>
+/// What one connection saw.
+/// </summary>
+struct ConnectionResult {
+    std::vector<double> latencyMs;  // send to response, client side
+    std::vector<double> serverMs;   // as reported by the server
+    unsigned long long failed = 0;  // status other than OK
+    unsigned long long notFound = 0;// OK, but no gap
+    std::string error;
+};
+
+bool parseArguments(int argc, char** argv, LoadConfig& config)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--socket") config.socketPath = value;
+        else if (arg == "--recipe") config.recipePath = value;
+        else if (arg == "--point") config.point = value;
+        else if (arg == "--requests") config.requests = std::max(1ull, std::strtoull(value.c_str(), nullptr, 10));
+        else if (arg == "--connections") config.connections = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--pipeline") config.pipeline = std::max(1, std::atoi(value.c_str()));
+        else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return !config.socketPath.empty();
+}
+
+/// <summary>
+/// Crop the ROI of a point out of its raw frame, placed on the cell outline if the point has a reference outline.
+/// </summary>
+cv::Mat loadPayload(const InspectionPoint& point)
+{
+    cv::Mat frame;
+    MappedRawFrame raw;
+    if (isRawFramePath(point.imagePath)) {
+        if (raw.open(point.imagePath)) {
+            if (!point.referenceOutline.empty())
+                raw.prefetchAll(); // the outline search reads the whole frame
+            frame = raw.image();
+        }
+    }
+    else {
+        frame = cv::imread(point.imagePath, cv::IMREAD_UNCHANGED);
+    }
+    if (frame.empty() || frame.channels() != 1)
+        return cv::Mat();
+
+    cv::Rect outline;
+    cv::Rect ROI = point.referenceOutline.empty() || !locateCellOutline(frame, point.outline, outline)
+        ? refindROI(point.ROI, frame.size())
+        : placeROI(point.ROI, point.referenceOutline, outline, frame.size());
+    return ROI.empty() ? cv::Mat() : frame(ROI).clone();
+}
+
+/// <summary>
+/// Send count requests over one connection, keeping config.pipeline of them in flight.
+/// </summary>
+void runConnection(const LoadConfig& config, const std::vector<Payload>& payloads, uint64_t firstId, unsigned long long count,
+                   ConnectionResult& result)
+{
+    try {
+        InspectionClient client(config.socketPath);
+        std::vector<Clock::time_point> sentAt(count);
+        unsigned long long sent = 0;
+        auto sendNext = [&] {
+            const Payload& payload = payloads[(firstId + sent) % payloads.size()];
+            sentAt[sent] = Clock::now();
+            if (!client.send(firstId + sent, payload.point, payload.pixels))
+                throw std::runtime_error("connection closed by the server");
+            ++sent;
+        };
+
+        while (sent < count && sent < static_cast<unsigned long long>(config.pipeline))
+            sendNext();
+        for (unsigned long long received = 0; received < count; ++received) {
+            InspectionResponse response;
+            if (!client.receive(response))
+                throw std::runtime_error("connection closed by the server");
+            const Clock::time_point now = Clock::now();
+            if (response.id < firstId || response.id >= firstId + sent)
+                throw std::runtime_error("response to an unknown request " + std::to_string(response.id));
+
+            result.latencyMs.push_back(std::chrono::duration<double, std::milli>(now - sentAt[response.id - firstId]).count());
+            result.serverMs.push_back(response.processingMs);
+            if (response.status != static_cast<uint32_t>(InspectionStatus::OK))
+                ++result.failed;
+            else if (!response.valid)
+                ++result.notFound;
+            if (sent < count)
+                sendNext();
+        }
+    }
+    catch (const std::exception& e) {
+        result.error = e.what();
+    }
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                  Main Function                                                                   //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+int main(int argc, char** argv)
+{
+    LoadConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        std::cerr << "Usage: InspectionLoad --socket PATH [--recipe FILE] [--requests N] [--connections N] [--pipeline N] "
+                     "[--point NAME]" << std::endl;
+        return 2;
+    }
+
+    // The ROIs are cropped once up front, so the client runs at socket speed rather than codec speed
+    std::vector<Payload> payloads;
+    double payloadPixels = 0.0;
+    try {
+        const Recipe recipe = loadRecipe(config.recipePath);
+        for (const auto& point : recipe.points) {
+            if (!config.point.empty() && point.name != config.point)
+                continue;
+            cv::Mat pixels = loadPayload(point);
+            if (pixels.empty()) {
+                std::cerr << "Cannot load the ROI of " << point.name << " from " << point.imagePath << std::endl;
+                continue;
+            }
+            payloadPixels += static_cast<double>(pixels.total());
+            payloads.push_back({ point.name, pixels });
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+    if (payloads.empty()) {
+        std::cerr << "No ROI to send" << std::endl;
+        return 1;
+    }
+
+    //--------------- Run the Connections ---------------------------//
+    std::vector<ConnectionResult> results(config.connections);
+    std::vector<std::thread> threads;
+    const auto t0 = Clock::now();
+    for (int c = 0; c < config.connections; ++c) {
+        const unsigned long long count = config.requests / config.connections + (static_cast<unsigned long long>(c) < config.requests % config.connections ? 1 : 0);
+        const uint64_t firstId = static_cast<uint64_t>(c) * config.requests;
+        threads.emplace_back(runConnection, std::cref(config), std::cref(payloads), firstId, count, std::ref(results[c]));
+    }
+    for (auto& thread : threads)
+        thread.join();
+    const double seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    //--------------- Report ----------------------------------------//
+    ConnectionResult total;
+    for (const auto& result : results) {
+        total.latencyMs.insert(total.latencyMs.end(), result.latencyMs.begin(), result.latencyMs.end());
+        total.serverMs.insert(total.serverMs.end(), result.serverMs.begin(), result.serverMs.end());
+        total.failed += result.failed;
+        total.notFound += result.notFound;
+        if (!result.error.empty())
+            std::cerr << "Connection error: " << result.error << std::endl;
+    }
+    const double answered = static_cast<double>(total.latencyMs.size());
+    const double meanPixels = payloadPixels / payloads.size();
+    std::printf("%.0f requests in %.2f s over %d connection(s), pipeline %d: %.1f requests/s, %.1f MPix/s\n", answered, seconds,
+                config.connections, config.pipeline, seconds > 0.0 ? answered / seconds : 0.0,
+                seconds > 0.0 ? answered * meanPixels / seconds / 1e6 : 0.0);
+    std::printf("latency ms    p50 %8.2f   p95 %8.2f   p99 %8.2f   max %8.2f\n", percentile(total.latencyMs, 50.0),
+                percentile(total.latencyMs, 95.0), percentile(total.latencyMs, 99.0), percentile(total.latencyMs, 100.0));
+    std::printf("server ms     p50 %8.2f   p95 %8.2f   p99 %8.2f   max %8.2f\n", percentile(total.serverMs, 50.0),
+                percentile(total.serverMs, 95.0), percentile(total.serverMs, 99.0), percentile(total.serverMs, 100.0));
+    std::printf("%llu failed, %llu without a gap\n", total.failed, total.notFound);
+
+    return total.failed == 0 && answered == static_cast<double>(config.requests) ? 0 : 1;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------------------//
+//                                                                   End of file                                                                    //
+//--------------------------------------------------------------------------------------------------------------------------------------------------//